@@ -360,11 +360,10 @@ bool CodeGenInspector::preorder(const IR::BlockStatement* s) {
     builder->blockStart();
     bool first = true;
     for (auto a : s->components) {
-        if (!first) {
+        if (!first)
             builder->newline();
-            builder->emitIndent();
-        }
         first = false;
+        builder->emitIndent();
         visit(a);
     }
     if (!s->components.empty())
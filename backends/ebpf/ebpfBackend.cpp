@@ -29,6 +29,17 @@ limitations under the License.
 
 namespace EBPF {
 
+// Writes formats of trace points to the file given by --trace-ringbuf.
+static void emitTraceFormats(const EbpfOptions& options, const KernelSamplesTarget* target) {
+    if (options.traceFormatsFile.isNullOrEmpty())
+        return;
+    auto stream = openFile(options.traceFormatsFile, false);
+    if (stream == nullptr)
+        return;
+    target->emitTraceFormats(*stream);
+    stream->flush();
+}
+
 void emitFilterModel(const EbpfOptions& options, Target* target, const IR::ToplevelBlock* toplevel,
                      P4::ReferenceMap* refMap, P4::TypeMap* typeMap) {
     CodeBuilder c(target);
@@ -79,8 +90,12 @@ void run_ebpf_backend(const EbpfOptions& options, const IR::ToplevelBlock* tople
     }
 
     Target* target;
+    KernelSamplesTarget* kernelTarget = nullptr;
     if (options.target.isNullOrEmpty() || options.target == "kernel") {
-        target = new KernelSamplesTarget(options.emitTraceMessages);
+        kernelTarget = new KernelSamplesTarget(options.emitTraceMessages, "Linux kernel",
+                                               !options.traceFormatsFile.isNullOrEmpty(),
+                                               options.mapPrefix);
+        target = kernelTarget;
     } else if (options.target == "bcc") {
         target = new BccTarget();
     } else if (options.target == "test") {
@@ -91,8 +106,20 @@ void run_ebpf_backend(const EbpfOptions& options, const IR::ToplevelBlock* tople
         return;
     }
 
+    if (!options.traceFormatsFile.isNullOrEmpty() && kernelTarget == nullptr) {
+        ::error(ErrorType::ERR_UNSUPPORTED,
+                "--trace-ringbuf is only supported by the 'kernel' target");
+        return;
+    }
+    if (!options.mapPrefix.isNullOrEmpty() && kernelTarget == nullptr) {
+        ::error(ErrorType::ERR_UNSUPPORTED,
+                "--map-prefix is only supported by the 'kernel' target");
+        return;
+    }
+
     if (options.arch.isNullOrEmpty() || options.arch == "filter") {
         emitFilterModel(options, target, toplevel, refMap, typeMap);
+        emitTraceFormats(options, kernelTarget);
     } else if (options.arch == "psa") {
         auto backend = new EBPF::PSASwitchBackend(options, target, refMap, typeMap);
         backend->convert(toplevel);
@@ -100,6 +127,22 @@ void run_ebpf_backend(const EbpfOptions& options, const IR::ToplevelBlock* tople
         if (options.outputFile.isNullOrEmpty())
             return;
 
+        if (!options.mapInitManifest.isNullOrEmpty()) {
+            auto manifestStream = openFile(options.mapInitManifest, false);
+            if (manifestStream == nullptr)
+                return;
+            backend->emitMapInitManifest(*manifestStream);
+            manifestStream->flush();
+        }
+
+        if (!options.mapLayoutManifest.isNullOrEmpty()) {
+            auto manifestStream = openFile(options.mapLayoutManifest, false);
+            if (manifestStream == nullptr)
+                return;
+            backend->emitMapLayoutManifest(*manifestStream);
+            manifestStream->flush();
+        }
+
         cstring cfile = options.outputFile;
         auto cstream = openFile(cfile, false);
         if (cstream == nullptr)
@@ -107,6 +150,24 @@ void run_ebpf_backend(const EbpfOptions& options, const IR::ToplevelBlock* tople
 
         backend->codegen(*cstream);
         cstream->flush();
+        emitTraceFormats(options, kernelTarget);
+
+        if (!options.controlPlaneLibrary.isNullOrEmpty()) {
+            cstring libfile = options.controlPlaneLibrary;
+            cstring libhfile;
+            const char* dot = libfile.findlast('.');
+            if (dot == nullptr)
+                libhfile = libfile + ".h";
+            else
+                libhfile = libfile.before(dot) + ".h";
+            auto libstream = openFile(libfile, false);
+            auto libhstream = openFile(libhfile, false);
+            if (libstream == nullptr || libhstream == nullptr)
+                return;
+            backend->emitControlPlaneLibrary(*libstream, *libhstream, libhfile);
+            libstream->flush();
+            libhstream->flush();
+        }
     } else {
         ::error(ErrorType::ERR_UNKNOWN,
                 "Unknown architecture %s; legal choices are 'filter', and 'psa'", options.arch);
@@ -252,6 +252,7 @@ void ControlBodyTranslator::compileEmit(const IR::Vector<IR::Argument>* args) {
     builder->appendFormat("%s = %s;", program->errorVar.c_str(),
                           p4lib.packetTooShort.str());
     builder->newline();
+    program->emitDropCount(builder, "DEPARSER_PACKET_TOO_SHORT");
 
     builder->emitIndent();
     builder->appendFormat("return %s;", builder->target->abortReturnCode().c_str());
@@ -319,6 +320,7 @@ void ControlBodyTranslator::processApply(const P4::ApplyMethod* method) {
     builder->blockStart();
 
     BUG_CHECK(method->expr->arguments->size() == 0, "%1%: table apply with arguments", method);
+    table->emitStatsDeclarations(builder);
     cstring keyname = "key";
     if (table->keyGenerator != nullptr) {
         builder->emitIndent();
@@ -334,6 +336,7 @@ void ControlBodyTranslator::processApply(const P4::ApplyMethod* method) {
     cstring valueName = "value";
     builder->appendFormat("struct %s *%s = NULL", table->valueTypeName.c_str(), valueName.c_str());
     builder->endOfStatement(true);
+    table->emitLookupDeclarations(builder, valueName);
 
     if (table->keyGenerator != nullptr) {
         builder->emitIndent();
@@ -353,15 +356,19 @@ void ControlBodyTranslator::processApply(const P4::ApplyMethod* method) {
     builder->emitIndent();
     builder->appendFormat("%s = 0", control->hitVariable.c_str());
     builder->endOfStatement(true);
+    table->emitStatsIncrement(builder, "misses");
 
     builder->emitIndent();
     table->emitLookupDefault(builder, control->program->zeroKey, valueName);
+    table->emitStatsIncrement(builder, "default_actions",
+                              Util::printf_format("%s != NULL", valueName));
     builder->blockEnd(false);
     builder->append(" else ");
     builder->blockStart();
     builder->emitIndent();
     builder->appendFormat("%s = 1", control->hitVariable.c_str());
     builder->endOfStatement(true);
+    table->emitStatsIncrement(builder, "hits");
     builder->blockEnd(true);
 
     builder->emitIndent();
@@ -377,6 +384,7 @@ void ControlBodyTranslator::processApply(const P4::ApplyMethod* method) {
     builder->blockStart();
     if (table->dropOnNoMatchingEntryFound()) {
         builder->target->emitTraceMessage(builder, "Control: Entry not found, aborting");
+        control->program->emitDropCount(builder, "TABLE_MISS");
         builder->emitIndent();
         builder->appendFormat("return %s", builder->target->abortReturnCode().c_str());
         builder->endOfStatement(true);
@@ -420,20 +428,28 @@ bool ControlBodyTranslator::preorder(const IR::IfStatement* statement) {
     else
         visit(statement->condition);
     builder->append(") ");
-    if (!statement->ifTrue->is<IR::BlockStatement>())
+    if (!statement->ifTrue->is<IR::BlockStatement>()) {
         builder->blockStart();
+        builder->emitIndent();
+    }
     visit(statement->ifTrue);
-    if (!statement->ifTrue->is<IR::BlockStatement>())
+    if (!statement->ifTrue->is<IR::BlockStatement>()) {
+        builder->newline();
         builder->blockEnd(true);
+    }
     if (statement->ifFalse != nullptr) {
         builder->newline();
         builder->emitIndent();
         builder->append("else ");
-        if (!statement->ifFalse->is<IR::BlockStatement>())
+        if (!statement->ifFalse->is<IR::BlockStatement>()) {
             builder->blockStart();
+            builder->emitIndent();
+        }
         visit(statement->ifFalse);
-        if (!statement->ifFalse->is<IR::BlockStatement>())
+        if (!statement->ifFalse->is<IR::BlockStatement>()) {
+            builder->newline();
             builder->blockEnd(true);
+        }
     }
     return false;
 }
@@ -575,13 +591,30 @@ void EBPFControl::emitDeclaration(CodeBuilder* builder, const IR::Declaration* d
     BUG("%1%: not yet handled", decl);
 }
 
-void EBPFControl::emit(CodeBuilder* builder) {
+void EBPFControl::emitDeclarations(CodeBuilder* builder) {
     auto hitType = EBPFTypeFactory::instance->create(IR::Type_Boolean::get());
     builder->emitIndent();
     hitType->declare(builder, hitVariable, false);
     builder->endOfStatement(true);
     for (auto a : controlBlock->container->controlLocals)
         emitDeclaration(builder, a);
+}
+
+void EBPFControl::emitStatements(CodeBuilder* builder, size_t first, size_t last) {
+    auto body = controlBlock->container->body;
+    BUG_CHECK(first <= last && last <= body->components.size(),
+              "%1%: invalid range of statements [%2%, %3%)", body, first, last);
+    IR::IndexedVector<IR::StatOrDecl> components;
+    for (size_t i = first; i < last; i++)
+        components.push_back(body->components.at(i));
+    builder->emitIndent();
+    codeGen->setBuilder(builder);
+    (new IR::BlockStatement(body->srcInfo, components))->apply(*codeGen);
+    builder->newline();
+}
+
+void EBPFControl::emit(CodeBuilder* builder) {
+    emitDeclarations(builder);
     builder->emitIndent();
     codeGen->setBuilder(builder);
     controlBlock->container->body->apply(*codeGen);
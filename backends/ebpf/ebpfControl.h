@@ -74,6 +74,10 @@ class EBPFControl : public EBPFObject {
                 const IR::Parameter* parserHeaders);
     virtual void emit(CodeBuilder* builder);
     virtual void emitDeclaration(CodeBuilder* builder, const IR::Declaration* decl);
+    // Emits the hit variable and the local variables of the control block.
+    void emitDeclarations(CodeBuilder* builder);
+    // Emits the top-level statements [first, last) of the control block body.
+    void emitStatements(CodeBuilder* builder, size_t first, size_t last);
     virtual void emitTableTypes(CodeBuilder* builder);
     virtual void emitTableInitializers(CodeBuilder* builder);
     virtual void emitTableInstances(CodeBuilder* builder);
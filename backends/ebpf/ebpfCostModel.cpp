@@ -0,0 +1,164 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ebpfCostModel.h"
+#include "frontends/p4/coreLibrary.h"
+#include "frontends/p4/methodInstance.h"
+
+namespace EBPF {
+
+unsigned InstructionEstimator::estimate(const IR::Node* node) {
+    count = 0;
+    node->apply(*this);
+    return count;
+}
+
+unsigned InstructionEstimator::words(const IR::Type* type) const {
+    if (type == nullptr)
+        return 1;
+    int width = type->width_bits();
+    return width <= 64 ? 1 : (width + 63) / 64;
+}
+
+unsigned InstructionEstimator::headerCost(const IR::Type_Header* type, unsigned perByte) const {
+    // bounds check and validity bit
+    unsigned cost = 4;
+    for (auto f : type->fields) {
+        unsigned bytes = (f->type->width_bits() + 7) / 8;
+        cost += 2 + perByte * bytes;
+    }
+    return cost;
+}
+
+bool InstructionEstimator::preorder(const IR::Constant*) {
+    count++;
+    return false;
+}
+
+bool InstructionEstimator::preorder(const IR::BoolLiteral*) {
+    count++;
+    return false;
+}
+
+bool InstructionEstimator::preorder(const IR::PathExpression*) {
+    count++;
+    return false;
+}
+
+bool InstructionEstimator::preorder(const IR::Member* expression) {
+    count += words(typeMap->getType(expression));
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::Operation_Unary* expression) {
+    count += words(typeMap->getType(expression));
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::Operation_Binary* expression) {
+    count += words(typeMap->getType(expression->left));
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::Mux*) {
+    count += 3;
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::AssignmentStatement* statement) {
+    count += words(typeMap->getType(statement->left));
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::IfStatement*) {
+    count += 2;
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::SwitchStatement* statement) {
+    count += 2 * statement->cases.size();
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::ParserState*) {
+    count += 2;
+    return true;
+}
+
+bool InstructionEstimator::preorder(const IR::SelectExpression* expression) {
+    count += 3 * expression->selectCases.size();
+    visit(expression->select);
+    return false;
+}
+
+bool InstructionEstimator::preorder(const IR::MethodCallExpression* expression) {
+    auto& p4lib = P4::P4CoreLibrary::instance;
+    auto mi = P4::MethodInstance::resolve(expression, refMap, typeMap);
+
+    if (auto apply = mi->to<P4::ApplyMethod>()) {
+        if (!apply->isTableApply())
+            return false;
+        auto table = apply->object->to<IR::P4Table>();
+        // lookup, lookup of the default action and their NULL checks
+        count += 2 * helperCallCost + 6;
+        auto key = table->getKey();
+        if (key != nullptr) {
+            for (auto k : key->keyElements) {
+                count++;
+                visit(k->expression);
+            }
+        }
+        auto actionList = table->getActionList();
+        if (actionList != nullptr) {
+            for (auto ale : actionList->actionList) {
+                auto decl = refMap->getDeclaration(ale->getPath(), true);
+                auto action = decl->to<IR::P4Action>();
+                count += 2;
+                if (action != nullptr) {
+                    count += action->parameters->size();
+                    visit(action->body);
+                }
+            }
+        }
+        return false;
+    } else if (mi->is<P4::BuiltInMethod>()) {
+        count += 2;
+        return false;
+    } else if (auto ac = mi->to<P4::ActionCall>()) {
+        visit(expression->arguments);
+        visit(ac->action->body);
+        return false;
+    } else if (auto ext = mi->to<P4::ExternMethod>()) {
+        auto externName = ext->originalExternType->name.name;
+        auto methodName = ext->method->name.name;
+        if ((externName == p4lib.packetIn.name && methodName == p4lib.packetIn.extract.name) ||
+            (externName == p4lib.packetOut.name && methodName == p4lib.packetOut.emit.name)) {
+            auto type = typeMap->getType(expression->arguments->at(0)->expression);
+            if (auto header = type->to<IR::Type_Header>()) {
+                unsigned perByte = externName == p4lib.packetIn.name ? 3 : 2;
+                count += headerCost(header, perByte);
+                return false;
+            }
+        }
+    }
+
+    count += helperCallCost;
+    visit(expression->arguments);
+    return false;
+}
+
+}  // namespace EBPF
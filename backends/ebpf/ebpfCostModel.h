@@ -0,0 +1,74 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef _BACKENDS_EBPF_EBPFCOSTMODEL_H_
+#define _BACKENDS_EBPF_EBPFCOSTMODEL_H_
+
+#include "ir/ir.h"
+#include "frontends/common/resolveReferences/referenceMap.h"
+#include "frontends/p4/typeMap.h"
+
+namespace EBPF {
+
+/*
+ * Estimates the number of eBPF instructions generated for a piece of P4 code
+ * (a statement, an action, a parser or a control block).
+ * The estimate counts loads, stores, ALU operations, branches and helper calls
+ * of the straight-line code, it is only meant to compare sizes of program parts.
+ */
+class InstructionEstimator : public Inspector {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    unsigned count;
+
+    // number of 64-bit words needed to process a value of the given type
+    unsigned words(const IR::Type* type) const;
+    unsigned headerCost(const IR::Type_Header* type, unsigned perByte) const;
+
+ public:
+    // cost of a call to a BPF helper (e.g. map lookup), including argument setup
+    static const unsigned helperCallCost = 8;
+
+    InstructionEstimator(P4::ReferenceMap* refMap, P4::TypeMap* typeMap) :
+            refMap(refMap), typeMap(typeMap), count(0) {
+        setName("InstructionEstimator");
+        // actions used by many tables have to be counted for each of them
+        visitDagOnce = false;
+    }
+
+    unsigned estimate(const IR::Node* node);
+
+    bool preorder(const IR::Constant*) override;
+    bool preorder(const IR::BoolLiteral*) override;
+    bool preorder(const IR::PathExpression*) override;
+    bool preorder(const IR::Member* expression) override;
+    bool preorder(const IR::Operation_Unary* expression) override;
+    bool preorder(const IR::Operation_Binary* expression) override;
+    bool preorder(const IR::Mux* expression) override;
+    bool preorder(const IR::AssignmentStatement* statement) override;
+    bool preorder(const IR::IfStatement* statement) override;
+    bool preorder(const IR::SwitchStatement* statement) override;
+    bool preorder(const IR::MethodCallExpression* expression) override;
+    bool preorder(const IR::ParserState* state) override;
+    bool preorder(const IR::SelectExpression* expression) override;
+    bool preorder(const IR::Declaration_Instance*) override { return false; }
+    bool preorder(const IR::P4Action*) override { return false; }
+    bool preorder(const IR::P4Table*) override { return false; }
+};
+
+}  // namespace EBPF
+
+#endif /* _BACKENDS_EBPF_EBPFCOSTMODEL_H_ */
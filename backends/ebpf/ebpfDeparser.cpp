@@ -15,10 +15,55 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <algorithm>
+#include <sstream>
+
 #include "ebpfDeparser.h"
+#include "ebpfParser.h"
 
 namespace EBPF {
 
+// Returns the name of the header referenced by expr if it is a header member
+// of the headers parameter (e.g. hdr.ethernet), or a null cstring otherwise.
+static cstring headerMemberName(const IR::Expression* expr, const IR::Parameter* headers,
+                                P4::ReferenceMap* refMap, P4::TypeMap* typeMap) {
+    auto member = expr->to<IR::Member>();
+    if (member == nullptr || !member->expr->is<IR::PathExpression>())
+        return cstring();
+    auto decl = refMap->getDeclaration(member->expr->to<IR::PathExpression>()->path);
+    if (decl != headers)
+        return cstring();
+    auto type = typeMap->getType(member);
+    if (type == nullptr || !type->is<IR::Type_Header>())
+        return cstring();
+    return member->member.name;
+}
+
+enum class TunnelHeaderKind { Other, Ethernet, IPv4, IPv6, UDP, GRE };
+
+// The deparser has no notion of protocols, so guess the protocol a header carries
+// from its type name (e.g. ipv4_t, outer_ipv4_h) and check that the width matches.
+static TunnelHeaderKind tunnelHeaderKind(const IR::Type_Header* type) {
+    unsigned width = type->width_bits();
+    std::string name = type->name.name.c_str();
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    std::stringstream tokens(name);
+    std::string token;
+    while (std::getline(tokens, token, '_')) {
+        if ((token == "ethernet" || token == "eth") && width == 112)
+            return TunnelHeaderKind::Ethernet;
+        if (token == "ipv4" && width == 160)
+            return TunnelHeaderKind::IPv4;
+        if (token == "ipv6" && width == 320)
+            return TunnelHeaderKind::IPv6;
+        if (token == "udp" && width == 64)
+            return TunnelHeaderKind::UDP;
+        if (token == "gre" && width >= 32)
+            return TunnelHeaderKind::GRE;
+    }
+    return TunnelHeaderKind::Other;
+}
+
 DeparserBodyTranslator::DeparserBodyTranslator(const EBPFDeparser *deparser) :
         CodeGenInspector(deparser->program->refMap, deparser->program->typeMap),
         ControlBodyTranslator(deparser), deparser(deparser) {
@@ -130,6 +175,25 @@ void DeparserHdrEmitTranslator::processMethod(const P4::ExternMethod *method) {
                                          expr->toString().c_str());
             builder->target->emitTraceMessage(builder, msgStr.c_str());
 
+            // Header is already in place if the packet was not resized.
+            cstring hdrName = headerMemberName(expr, deparser->headers,
+                                               program->refMap, program->typeMap);
+            bool unmodified = !hdrName.isNullOrEmpty() &&
+                              deparser->unmodifiedHeaders.count(hdrName) != 0;
+            if (unmodified) {
+                builder->emitIndent();
+                builder->appendFormat("if (%s == 0) ", deparser->outerHdrOffsetVar.c_str());
+                builder->blockStart();
+                builder->target->emitTraceMessage(builder,
+                                                  "Deparser: header not modified, skipping");
+                builder->emitIndent();
+                builder->appendFormat("%s += %d", program->offsetVar.c_str(), width);
+                builder->endOfStatement(true);
+                builder->blockEnd(false);
+                builder->append(" else ");
+                builder->blockStart();
+            }
+
             builder->emitIndent();
             builder->appendFormat("if (%s < %s + BYTES(%s + %d)) ",
                                   program->packetEndVar.c_str(),
@@ -138,6 +202,7 @@ void DeparserHdrEmitTranslator::processMethod(const P4::ExternMethod *method) {
             builder->blockStart();
             builder->target->emitTraceMessage(builder,
                                               "Deparser: invalid packet (packet too short)");
+            program->emitDropCount(builder, "DEPARSER_PACKET_TOO_SHORT");
             builder->emitIndent();
             // We immediately return instead of jumping to reject state.
             // It avoids reaching BPF_COMPLEXITY_LIMIT_JMP_SEQ.
@@ -160,6 +225,8 @@ void DeparserHdrEmitTranslator::processMethod(const P4::ExternMethod *method) {
                 alignment += et->widthInBits();
                 alignment %= 8;
             }
+            if (unmodified)
+                builder->blockEnd(true);
             builder->blockEnd(true);
         } else {
             BUG("emit() should only be invoked for packet_out");
@@ -185,8 +252,13 @@ void DeparserHdrEmitTranslator::emitField(CodeBuilder* builder, cstring field,
     cstring swap = "", msgStr;
 
     if (widthToEmit <= 64) {
+        // the header may be a pointer or named after the parser parameter
+        CodeBuilder hdrBuilder(builder->target);
+        setBuilder(&hdrBuilder);
+        visit(hdrExpr);
+        setBuilder(builder);
         cstring tmp = Util::printf_format("(unsigned long long) %s.%s",
-                                          hdrExpr->toString(), field);
+                                          hdrBuilder.toString().c_str(), field);
         msgStr = Util::printf_format("Deparser: emitting field %s=0x%%llx (%u bits)",
                                      field, widthToEmit);
         builder->target->emitTraceMessage(builder, msgStr.c_str(), 1, tmp.c_str());
@@ -195,6 +267,12 @@ void DeparserHdrEmitTranslator::emitField(CodeBuilder* builder, cstring field,
         builder->target->emitTraceMessage(builder, msgStr.c_str());
     }
 
+    // Byte-aligned fields are written with word-sized stores instead of byte by byte.
+    if (alignment == 0 && widthToEmit % 8 == 0 && widthToEmit <= 64) {
+        emitAlignedField(builder, field, hdrExpr, widthToEmit);
+        return;
+    }
+
     if (widthToEmit <= 8) {
         emitSize = 8;
     } else if (widthToEmit <= 16) {
@@ -295,6 +373,453 @@ void DeparserHdrEmitTranslator::emitField(CodeBuilder* builder, cstring field,
     builder->newline();
 }
 
+void DeparserHdrEmitTranslator::emitAlignedField(CodeBuilder* builder, cstring field,
+                                                 const IR::Expression* hdrExpr,
+                                                 unsigned widthToEmit) {
+    auto program = deparser->program;
+
+    // Split the field into the largest possible power-of-two chunks,
+    // e.g. a 48-bit MAC address is written as a 32-bit and a 16-bit store.
+    unsigned left = widthToEmit;
+    unsigned byteOffset = 0;
+    while (left > 0) {
+        unsigned chunk = 64;
+        while (chunk > left)
+            chunk /= 2;
+        cstring writeMacro, valueType;
+        if (chunk == 8) {
+            writeMacro = "write_byte";
+            valueType = "u8";
+        } else if (chunk == 16) {
+            writeMacro = "write_half";
+            valueType = "u16";
+        } else if (chunk == 32) {
+            writeMacro = "write_word";
+            valueType = "u32";
+        } else {
+            writeMacro = "write_dword";
+            valueType = "u64";
+        }
+
+        builder->emitIndent();
+        builder->appendFormat("%s(%s, BYTES(%s) + %u, (%s) (",
+                              writeMacro, program->packetStartVar.c_str(),
+                              program->offsetVar.c_str(), byteOffset, valueType);
+        visit(hdrExpr);
+        builder->appendFormat(".%s", field);
+        if (left != chunk)
+            builder->appendFormat(" >> %u", left - chunk);
+        builder->append("))");
+        builder->endOfStatement(true);
+
+        left -= chunk;
+        byteOffset += chunk / 8;
+    }
+
+    builder->emitIndent();
+    builder->appendFormat("%s += %d", program->offsetVar.c_str(),
+                          widthToEmit);
+    builder->endOfStatement(true);
+    builder->newline();
+}
+
+void HeaderWriteSetInspector::markWritten(const IR::Expression* expr) {
+    bool wholeHeader = true;
+    while (true) {
+        if (auto path = expr->to<IR::PathExpression>()) {
+            if (refMap->getDeclaration(path->path) == headers)
+                allWritten = true;
+            return;
+        } else if (auto member = expr->to<IR::Member>()) {
+            auto path = member->expr->to<IR::PathExpression>();
+            if (path != nullptr && refMap->getDeclaration(path->path) == headers) {
+                written.insert(member->member.name);
+                // writing a header as a whole may change its validity as well
+                if (wholeHeader)
+                    validityChanged.insert(member->member.name);
+                return;
+            }
+            expr = member->expr;
+        } else if (auto index = expr->to<IR::ArrayIndex>()) {
+            expr = index->left;
+        } else if (auto slice = expr->to<IR::Slice>()) {
+            expr = slice->e0;
+        } else {
+            return;
+        }
+        wholeHeader = false;
+    }
+}
+
+bool HeaderWriteSetInspector::preorder(const IR::AssignmentStatement* statement) {
+    markWritten(statement->left);
+    return true;
+}
+
+bool HeaderWriteSetInspector::preorder(const IR::MethodCallExpression* expression) {
+    auto mi = P4::MethodInstance::resolve(expression, refMap, typeMap);
+    if (auto bim = mi->to<P4::BuiltInMethod>()) {
+        if (bim->name.name != IR::Type_Header::isValid)
+            markWritten(bim->appliedTo);
+        return true;
+    }
+    if (auto ext = mi->to<P4::ExternMethod>()) {
+        if (ext->originalExternType->name.name ==
+            P4::P4CoreLibrary::instance.packetIn.name)
+            return false;
+    }
+    for (auto param : *mi->substitution.getParametersInArgumentOrder()) {
+        if (param->direction == IR::Direction::Out ||
+            param->direction == IR::Direction::InOut)
+            markWritten(mi->substitution.lookup(param)->expression);
+    }
+    return true;
+}
+
+/*
+ * A header does not need to be written by the deparser if it is not modified after
+ * being extracted and it is emitted at the same offset as it was extracted from. The latter
+ * holds if all headers that may be extracted before it are emitted before it and
+ * all headers emitted before it keep their validity and can not be extracted after it.
+ * The analysis is conservative: parsers with advance(), varbit extracts, conditional
+ * extracts or extracts into anything but a header member give up.
+ */
+void EBPFDeparser::findUnmodifiedHeaders(const EBPFParser* parser,
+                                         const EBPFControl* control) {
+    auto refMap = program->refMap;
+    auto typeMap = program->typeMap;
+    auto& p4lib = P4::P4CoreLibrary::instance;
+    unmodifiedHeaders.clear();
+
+    std::set<cstring> written, validityChanged;
+    std::vector<std::pair<const IR::Node*, const IR::Parameter*>> blocks = {
+        { parser->parserBlock->container, parser->headers },
+        { control->controlBlock->container, control->headers },
+        { controlBlock->container, headers },
+    };
+    for (auto block : blocks) {
+        HeaderWriteSetInspector writeSet(refMap, typeMap, block.second);
+        block.first->apply(writeSet);
+        if (writeSet.allWritten)
+            return;
+        written.insert(writeSet.written.begin(), writeSet.written.end());
+        validityChanged.insert(writeSet.validityChanged.begin(),
+                               writeSet.validityChanged.end());
+    }
+
+    // For each extracted header: headers that may be extracted before it.
+    std::map<cstring, std::set<cstring>> extractedBefore;
+    // For each parser state: headers that may be extracted before entering it.
+    std::map<const IR::ParserState*, std::set<cstring>> reaching;
+    std::vector<const IR::ParserState*> worklist;
+    for (auto state : parser->parserBlock->container->states) {
+        if (state->name.name == IR::ParserState::start) {
+            reaching[state] = {};
+            worklist.push_back(state);
+        }
+    }
+
+    while (!worklist.empty()) {
+        auto state = worklist.back();
+        worklist.pop_back();
+        auto extracted = reaching[state];
+
+        for (auto c : state->components) {
+            if (c->is<IR::AssignmentStatement>() || c->is<IR::Declaration>() ||
+                c->is<IR::EmptyStatement>())
+                continue;
+            auto mcs = c->to<IR::MethodCallStatement>();
+            if (mcs == nullptr)
+                return;
+            auto mi = P4::MethodInstance::resolve(mcs->methodCall, refMap, typeMap);
+            auto ext = mi->to<P4::ExternMethod>();
+            if (ext == nullptr || ext->originalExternType->name.name != p4lib.packetIn.name ||
+                ext->method->name.name == p4lib.packetIn.lookahead.name)
+                continue;
+            if (ext->method->name.name != p4lib.packetIn.extract.name ||
+                mcs->methodCall->arguments->size() != 1)
+                return;
+            cstring name = headerMemberName(mcs->methodCall->arguments->at(0)->expression,
+                                            parser->headers, refMap, typeMap);
+            if (name.isNullOrEmpty() || extracted.count(name) != 0)
+                return;
+            extractedBefore[name].insert(extracted.begin(), extracted.end());
+            extracted.insert(name);
+        }
+
+        std::vector<const IR::PathExpression*> next;
+        if (state->selectExpression == nullptr) {
+            continue;
+        } else if (auto path = state->selectExpression->to<IR::PathExpression>()) {
+            next.push_back(path);
+        } else if (auto select = state->selectExpression->to<IR::SelectExpression>()) {
+            for (auto selectCase : select->selectCases)
+                next.push_back(selectCase->state);
+        }
+        for (auto path : next) {
+            auto nextState = refMap->getDeclaration(path->path, true)->to<IR::ParserState>();
+            if (nextState == nullptr)
+                continue;
+            bool visited = reaching.count(nextState) != 0;
+            auto& in = reaching[nextState];
+            size_t size = in.size();
+            in.insert(extracted.begin(), extracted.end());
+            if (!visited || in.size() != size)
+                worklist.push_back(nextState);
+        }
+    }
+
+    // Headers in the order they are emitted, null for anything else than a header member.
+    std::vector<cstring> emitted;
+    for (auto expr : getEmittedHeaders())
+        emitted.push_back(headerMemberName(expr, headers, refMap, typeMap));
+
+    for (size_t i = 0; i < emitted.size(); i++) {
+        cstring hdr = emitted[i];
+        if (hdr.isNullOrEmpty() || written.count(hdr) != 0 || extractedBefore.count(hdr) == 0)
+            continue;
+        bool sameOffset = true;
+        std::set<cstring> emittedBefore;
+        for (size_t j = 0; j < i && sameOffset; j++) {
+            cstring prev = emitted[j];
+            if (prev.isNullOrEmpty() || prev == hdr || emittedBefore.count(prev) != 0 ||
+                validityChanged.count(prev) != 0 ||
+                (extractedBefore.count(prev) != 0 && extractedBefore[prev].count(hdr) != 0))
+                sameOffset = false;
+            emittedBefore.insert(prev);
+        }
+        for (auto prev : extractedBefore[hdr]) {
+            if (emittedBefore.count(prev) == 0)
+                sameOffset = false;
+        }
+        for (size_t j = i + 1; j < emitted.size(); j++) {
+            if (emitted[j] == hdr)
+                sameOffset = false;
+        }
+        if (sameOffset)
+            unmodifiedHeaders.insert(hdr);
+    }
+}
+
+bool HeaderReadSetInspector::preorder(const IR::PathExpression* expression) {
+    // reached only if the headers structure is not accessed through a member
+    if (refMap->getDeclaration(expression->path) == headers)
+        allRead = true;
+    return false;
+}
+
+bool HeaderReadSetInspector::preorder(const IR::Member* expression) {
+    if (auto path = expression->expr->to<IR::PathExpression>()) {
+        if (refMap->getDeclaration(path->path) != headers)
+            return false;
+        readHeaders.insert(expression->member.name);
+        return false;
+    }
+    auto member = expression->expr->to<IR::Member>();
+    if (member == nullptr || !member->expr->is<IR::PathExpression>())
+        return true;
+    if (refMap->getDeclaration(member->expr->to<IR::PathExpression>()->path) != headers)
+        return true;
+    readFields[member->member.name].insert(expression->member.name);
+    return false;
+}
+
+bool HeaderReadSetInspector::preorder(const IR::MethodCallExpression* expression) {
+    auto mi = P4::MethodInstance::resolve(expression, refMap, typeMap);
+    if (auto ext = mi->to<P4::ExternMethod>()) {
+        auto& p4lib = P4::P4CoreLibrary::instance;
+        if ((ext->originalExternType->name.name == p4lib.packetIn.name &&
+             ext->method->name.name == p4lib.packetIn.extract.name) ||
+            (ext->originalExternType->name.name == p4lib.packetOut.name &&
+             ext->method->name.name == p4lib.packetOut.emit.name))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Fields of a header are not needed if the header is not modified and written by
+ * the deparser only if the packet is resized, and none of its fields is read.
+ */
+void EBPFDeparser::findDeferredFields(EBPFParser* parser, const EBPFControl* control) const {
+    auto refMap = program->refMap;
+    auto typeMap = program->typeMap;
+    auto& p4lib = P4::P4CoreLibrary::instance;
+    parser->deferredFields.clear();
+    parser->deferredExtracts.clear();
+
+    std::map<cstring, std::set<cstring>> readFields;
+    std::set<cstring> readHeaders;
+    std::vector<std::pair<const IR::Node*, const IR::Parameter*>> blocks = {
+        { parser->parserBlock->container, parser->headers },
+        { control->controlBlock->container, control->headers },
+        { controlBlock->container, headers },
+    };
+    for (auto block : blocks) {
+        HeaderReadSetInspector readSet(refMap, typeMap, block.second);
+        block.first->apply(readSet);
+        if (readSet.allRead)
+            return;
+        for (auto& hdr : readSet.readFields)
+            readFields[hdr.first].insert(hdr.second.begin(), hdr.second.end());
+        readHeaders.insert(readSet.readHeaders.begin(), readSet.readHeaders.end());
+    }
+
+    for (auto state : parser->parserBlock->container->states) {
+        for (auto c : state->components) {
+            auto mcs = c->to<IR::MethodCallStatement>();
+            if (mcs == nullptr)
+                continue;
+            auto mi = P4::MethodInstance::resolve(mcs->methodCall, refMap, typeMap);
+            auto ext = mi->to<P4::ExternMethod>();
+            if (ext == nullptr || ext->originalExternType->name.name != p4lib.packetIn.name ||
+                ext->method->name.name != p4lib.packetIn.extract.name ||
+                mcs->methodCall->arguments->size() != 1)
+                continue;
+            auto dest = mcs->methodCall->arguments->at(0)->expression;
+            cstring name = headerMemberName(dest, parser->headers, refMap, typeMap);
+            if (name.isNullOrEmpty() || unmodifiedHeaders.count(name) == 0 ||
+                readHeaders.count(name) != 0 || parser->deferredExtracts.count(name) != 0)
+                continue;
+            std::set<cstring> deferred;
+            for (auto f : typeMap->getType(dest)->to<IR::Type_Header>()->fields) {
+                if (readFields[name].count(f->name.name) == 0)
+                    deferred.insert(f->name.name);
+            }
+            if (deferred.empty())
+                continue;
+            parser->deferredFields.emplace(name, deferred);
+            parser->deferredExtracts.emplace(name, dest);
+        }
+    }
+}
+
+/*
+ * An unmodified header is emitted at the offset it was extracted from, so the deferred fields
+ * are loaded from that offset, before the packet is resized.
+ */
+void EBPFDeparser::emitDeferredExtracts(CodeBuilder* builder) const {
+    auto parser = program->parser;
+    if (parser == nullptr || parser->deferredFields.empty())
+        return;
+
+    cstring offsetVar = "deferredOffset";
+    builder->newline();
+    builder->emitIndent();
+    builder->appendFormat("if (BYTES(%s) != BYTES(%s)) ",
+                          outerHdrLengthVar.c_str(), program->offsetVar.c_str());
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder, "Deparser: loading deferred fields");
+    builder->emitIndent();
+    builder->appendFormat("unsigned %s = 0", offsetVar.c_str());
+    builder->endOfStatement(true);
+
+    // headers emitted after the last header with deferred fields don't matter
+    size_t remaining = parser->deferredFields.size();
+    for (auto expr : getEmittedHeaders()) {
+        if (remaining == 0)
+            break;
+        cstring name = headerMemberName(expr, headers, program->refMap, program->typeMap);
+        BUG_CHECK(!name.isNullOrEmpty(), "%1%: unexpected header before deferred fields", expr);
+        bool deferred = parser->deferredFields.count(name) != 0;
+        builder->emitIndent();
+        builder->append("if (");
+        expr->apply(*codeGen);
+        builder->append(".ebpf_valid) ");
+        builder->blockStart();
+        if (deferred) {
+            parser->emitDeferredExtract(builder, name, offsetVar);
+            remaining--;
+        } else {
+            builder->emitIndent();
+            builder->appendFormat("%s += %u", offsetVar.c_str(),
+                                  program->typeMap->getType(expr)->width_bits());
+            builder->endOfStatement(true);
+        }
+        builder->blockEnd(true);
+    }
+    builder->blockEnd(true);
+}
+
+std::vector<const IR::Expression*> EBPFDeparser::getEmittedHeaders() const {
+    std::vector<const IR::Expression*> emitted;
+    for (auto c : controlBlock->container->body->components) {
+        auto mcs = c->to<IR::MethodCallStatement>();
+        if (mcs == nullptr)
+            continue;
+        auto mi = P4::MethodInstance::resolve(mcs->methodCall, program->refMap,
+                                              program->typeMap);
+        auto ext = mi->to<P4::ExternMethod>();
+        if (ext == nullptr || ext->object != packet_out ||
+            ext->method->name.name != P4::P4CoreLibrary::instance.packetOut.emit.name ||
+            mcs->methodCall->arguments->size() != 1)
+            continue;
+        emitted.push_back(mcs->methodCall->arguments->at(0)->expression);
+    }
+    return emitted;
+}
+
+/*
+ * Looks for a tunnel pushed by the deparser: an IP header followed by another IP header,
+ * optionally with UDP or GRE and an inner Ethernet header in between. If the packet
+ * grows by exactly the size of the outer headers, the buffer is resized with the
+ * BPF_F_ADJ_ROOM_ENCAP_* flags, so that the kernel sets the inner header offsets and
+ * the tunnel GSO type and encapsulated TSO/GSO packets can still be segmented
+ * by the NIC.
+ */
+void EBPFDeparser::findTunnelEncapsulation() {
+    encapOuterHeader = nullptr;
+    encapInnerHeader = nullptr;
+    encapOverhead = 0;
+    encapFlags = cstring();
+
+    auto emitted = getEmittedHeaders();
+    std::vector<TunnelHeaderKind> kinds;
+    for (auto expr : emitted) {
+        auto type = program->typeMap->getType(expr);
+        if (type == nullptr || !type->is<IR::Type_Header>())
+            return;
+        kinds.push_back(tunnelHeaderKind(type->to<IR::Type_Header>()));
+    }
+
+    auto isL3 = [](TunnelHeaderKind kind) {
+        return kind == TunnelHeaderKind::IPv4 || kind == TunnelHeaderKind::IPv6;
+    };
+    size_t outer = 0;
+    while (outer < kinds.size() && !isL3(kinds[outer]))
+        outer++;
+    // MAC mode reserves room just after the L2 header, so the outer IP header
+    // has to follow an Ethernet header.
+    if (outer == 0 || outer >= kinds.size() || kinds[outer - 1] != TunnelHeaderKind::Ethernet)
+        return;
+    size_t inner = outer + 1;
+    while (inner < kinds.size() && !isL3(kinds[inner]))
+        inner++;
+    if (inner >= kinds.size())
+        return;
+
+    unsigned overhead = 0;
+    for (size_t i = outer; i < inner; i++) {
+        auto type = program->typeMap->getType(emitted[i])->to<IR::Type_Header>();
+        overhead += type->width_bits();
+    }
+
+    std::vector<cstring> flags;
+    flags.push_back(kinds[outer] == TunnelHeaderKind::IPv4 ? "BPF_F_ADJ_ROOM_ENCAP_L3_IPV4" :
+                                                             "BPF_F_ADJ_ROOM_ENCAP_L3_IPV6");
+    if (kinds[outer + 1] == TunnelHeaderKind::UDP)
+        flags.push_back("BPF_F_ADJ_ROOM_ENCAP_L4_UDP");
+    else if (kinds[outer + 1] == TunnelHeaderKind::GRE)
+        flags.push_back("BPF_F_ADJ_ROOM_ENCAP_L4_GRE");
+    if (kinds[inner - 1] == TunnelHeaderKind::Ethernet)
+        flags.push_back("BPF_F_ADJ_ROOM_ENCAP_L2(14)");
+
+    encapOuterHeader = emitted[outer];
+    encapInnerHeader = emitted[inner];
+    encapOverhead = overhead;
+    encapFlags = cstring::join(flags.begin(), flags.end(), " | ");
+}
+
 void EBPFDeparser::emitBufferAdjusts(CodeBuilder *builder) const {
     builder->newline();
     builder->emitIndent();
@@ -313,16 +838,51 @@ void EBPFDeparser::emitBufferAdjusts(CodeBuilder *builder) const {
     builder->emitIndent();
     builder->appendFormat("int %s = 0", returnCode.c_str());
     builder->endOfStatement(true);
+    if (encapOuterHeader != nullptr) {
+        builder->emitIndent();
+        builder->appendFormat("if (%s == %u && ", outerHdrOffsetVar.c_str(),
+                              encapOverhead / 8);
+        encapOuterHeader->apply(*codeGen);
+        builder->append(".ebpf_valid && ");
+        encapInnerHeader->apply(*codeGen);
+        builder->append(".ebpf_valid) ");
+        builder->blockStart();
+        builder->target->emitTraceMessage(builder, "Deparser: pushing tunnel headers");
+        builder->emitIndent();
+        builder->appendFormat("%s = ", returnCode.c_str());
+        builder->target->emitResizeBuffer(builder, program->model.CPacketName.str(),
+                                          outerHdrOffsetVar, encapFlags);
+        builder->endOfStatement(true);
+        // The kernel tracks inner headers of one tunnel only, so the flags are refused
+        // if the packet is already encapsulated. The outer tunnel is pushed without them.
+        builder->emitIndent();
+        builder->appendFormat("if (%s == -EALREADY) ", returnCode.c_str());
+        builder->blockStart();
+        builder->target->emitTraceMessage(builder,
+                "Deparser: packet already encapsulated, pushing tunnel headers without flags");
+        builder->emitIndent();
+        builder->appendFormat("%s = ", returnCode.c_str());
+        builder->target->emitResizeBuffer(builder, program->model.CPacketName.str(),
+                                          outerHdrOffsetVar);
+        builder->endOfStatement(true);
+        builder->blockEnd(true);
+        builder->blockEnd(false);
+        builder->append(" else ");
+        builder->blockStart();
+    }
     builder->emitIndent();
     builder->appendFormat("%s = ", returnCode.c_str());
     builder->target->emitResizeBuffer(builder, program->model.CPacketName.str(),
                                       outerHdrOffsetVar);
     builder->endOfStatement(true);
+    if (encapOuterHeader != nullptr)
+        builder->blockEnd(true);
 
     builder->emitIndent();
     builder->appendFormat("if (%s) ", returnCode.c_str());
     builder->blockStart();
     builder->target->emitTraceMessage(builder, "Deparser: pkt_len adjust failed");
+    program->emitDropCount(builder, "DEPARSER_ADJUST_FAILED");
     builder->emitIndent();
     // We immediately return instead of jumping to reject state.
     // It avoids reaching BPF_COMPLEXITY_LIMIT_JMP_SEQ.
@@ -351,8 +911,10 @@ void EBPFDeparser::emit(CodeBuilder* builder) {
     auto prepareBufferTranslator = new DeparserPrepareBufferTranslator(this);
     prepareBufferTranslator->setBuilder(builder);
     prepareBufferTranslator->copyPointerVariables(codeGen);
-    prepareBufferTranslator->substitute(this->headers, this->parserHeaders);
+    prepareBufferTranslator->copySubstitutions(codeGen);
     controlBlock->container->body->apply(*prepareBufferTranslator);
+    emitPrependedDataLength(builder);
+    emitDeferredExtracts(builder);
 
     emitBufferAdjusts(builder);
 
@@ -370,12 +932,13 @@ void EBPFDeparser::emit(CodeBuilder* builder) {
     builder->emitIndent();
     builder->appendFormat("%s = 0", program->offsetVar.c_str());
     builder->endOfStatement(true);
+    emitPrependedData(builder);
 
     // emit headers
     auto hdrEmitTranslator = new DeparserHdrEmitTranslator(this);
     hdrEmitTranslator->setBuilder(builder);
     hdrEmitTranslator->copyPointerVariables(codeGen);
-    hdrEmitTranslator->substitute(this->headers, this->parserHeaders);
+    hdrEmitTranslator->copySubstitutions(codeGen);
     controlBlock->container->body->apply(*hdrEmitTranslator);
 
     builder->newline();
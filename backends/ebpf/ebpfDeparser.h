@@ -22,6 +22,7 @@ limitations under the License.
 namespace EBPF {
 
 class EBPFDeparser;
+class EBPFParser;
 
 // this translator emits deparser externs
 class DeparserBodyTranslator : public ControlBodyTranslator {
@@ -58,6 +59,60 @@ class DeparserHdrEmitTranslator : public DeparserPrepareBufferTranslator {
     void processMethod(const P4::ExternMethod* method) override;
     void emitField(CodeBuilder* builder, cstring field, const IR::Expression* hdrExpr,
                    unsigned alignment, EBPF::EBPFType* type);
+    // Emits a byte-aligned field (up to 64 bits) using 8/16/32/64-bit stores.
+    void emitAlignedField(CodeBuilder* builder, cstring field, const IR::Expression* hdrExpr,
+                          unsigned widthToEmit);
+};
+
+// Collects headers (members of the headers parameter) that may be written
+// or whose validity may change in a parser or control block.
+// Extracts are not considered writes; parser states are analyzed separately.
+class HeaderWriteSetInspector : public Inspector {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    const IR::Parameter* headers;
+
+    void markWritten(const IR::Expression* expr);
+
+ public:
+    std::set<cstring> written;
+    std::set<cstring> validityChanged;
+    // The whole headers structure may be written, e.g. when passed as inout argument.
+    bool allWritten = false;
+
+    HeaderWriteSetInspector(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+                            const IR::Parameter* headers) :
+            refMap(refMap), typeMap(typeMap), headers(headers) {
+        setName("HeaderWriteSetInspector");
+    }
+
+    bool preorder(const IR::AssignmentStatement* statement) override;
+    bool preorder(const IR::MethodCallExpression* expression) override;
+};
+
+// Collects fields of headers (members of the headers parameter) that may be read.
+// Extracting and emitting a header does not read its fields.
+class HeaderReadSetInspector : public Inspector {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    const IR::Parameter* headers;
+
+ public:
+    std::map<cstring, std::set<cstring>> readFields;
+    // Headers used as a whole, e.g. passed to an extern.
+    std::set<cstring> readHeaders;
+    // The whole headers structure may be read.
+    bool allRead = false;
+
+    HeaderReadSetInspector(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+                           const IR::Parameter* headers) :
+            refMap(refMap), typeMap(typeMap), headers(headers) {
+        setName("HeaderReadSetInspector");
+    }
+
+    bool preorder(const IR::PathExpression* expression) override;
+    bool preorder(const IR::Member* expression) override;
+    bool preorder(const IR::MethodCallExpression* expression) override;
 };
 
 class EBPFDeparser : public EBPFControl {
@@ -67,6 +122,16 @@ class EBPFDeparser : public EBPFControl {
     EBPFType* headerType;
     cstring outerHdrOffsetVar, outerHdrLengthVar;
     cstring returnCode;
+    // Headers that are never modified between the parser and the deparser and are
+    // emitted at the offset they were extracted from, so they don't have to be
+    // written again as long as the packet is not resized.
+    std::set<cstring> unmodifiedHeaders;
+    // Set if the deparser may push a tunnel (outer IP header up to the inner one),
+    // see findTunnelEncapsulation().
+    const IR::Expression* encapOuterHeader = nullptr;
+    const IR::Expression* encapInnerHeader = nullptr;
+    unsigned encapOverhead = 0;
+    cstring encapFlags;
 
     EBPFDeparser(const EBPFProgram* program, const IR::ControlBlock* control,
                  const IR::Parameter* parserHeaders) :
@@ -85,12 +150,34 @@ class EBPFDeparser : public EBPFControl {
         (void) builder;
     }
 
+    // Data emitted in front of the headers, e.g. metadata bridged to the next pipeline.
+    // The first function adds its length to the output header length,
+    // the second one writes it at the current offset and advances the offset.
+    virtual void emitPrependedDataLength(CodeBuilder* builder) {
+        (void) builder;
+    }
+    virtual void emitPrependedData(CodeBuilder* builder) {
+        (void) builder;
+    }
+
     virtual void emitDeparserExternCalls(CodeBuilder* builder) {
+        builder->emitIndent();
         controlBlock->container->body->apply(*codeGen);
         builder->newline();
     }
 
     void emitBufferAdjusts(CodeBuilder *builder) const;
+    void findUnmodifiedHeaders(const EBPFParser* parser, const EBPFControl* control);
+    // Sets EBPFParser::deferredFields to fields of unmodified headers that are never read.
+    // Must be called after findUnmodifiedHeaders().
+    void findDeferredFields(EBPFParser* parser, const EBPFControl* control) const;
+    // Loads the deferred fields of valid headers if the packet is resized.
+    void emitDeferredExtracts(CodeBuilder* builder) const;
+    void findTunnelEncapsulation();
+
+ protected:
+    // Arguments of the emit() calls in the deparser body, in order.
+    std::vector<const IR::Expression*> getEmittedHeaders() const;
 };
 
 }  // namespace EBPF
@@ -1,3 +1,5 @@
+#include <cctype>
+
 #include "ebpfOptions.h"
 #include "midend.h"
 
@@ -26,4 +28,94 @@ EbpfOptions::EbpfOptions() {
         registerOption("--trace", nullptr,
                 [this](const char*) { emitTraceMessages = true; return true; },
                 "Generate tracing messages of packet processing");
+        registerOption("--trace-ringbuf", "file",
+                [this](const char* arg) {
+                    emitTraceMessages = true;
+                    traceFormatsFile = arg;
+                    return true; },
+                "[ebpf back-end] Generate tracing messages as binary records written to the "
+                "trace_ringbuf BPF ring buffer instead of the kernel trace pipe, and write "
+                "formats of trace points to a file read by runtime/ebpf_trace_decoder");
+        registerOption("--emit-stats", nullptr,
+                [this](const char*) { emitStats = true; return true; },
+                "[ebpf back-end] Count hits, misses, default actions and executed actions "
+                "of PSA tables in the per-CPU table_stats map, dropped packets by reason "
+                "in the drop_stats map and Traffic Manager packet paths, replications and "
+                "clone failures in the tm_stats map");
+        registerOption("--latency-histograms", "n",
+                [this](const char* arg) {
+                    char* end;
+                    latencySampling = strtoul(arg, &end, 10);
+                    if (*arg == '\0' || *end != '\0' || latencySampling == 0) {
+                        ::error(ErrorType::ERR_INVALID,
+                                "--latency-histograms: invalid sampling rate %1%", arg);
+                        return false;
+                    }
+                    return true; },
+                "[ebpf back-end] Record the time spent in the parser, control block, deparser "
+                "and Traffic Manager of PSA pipelines in per-CPU log2 histograms, for 1 in n "
+                "packets (1: every packet)");
+        registerOption("--max-prog-insns", "n",
+                [this](const char* arg) {
+                    char* end;
+                    maxProgramInstructions = strtoul(arg, &end, 10);
+                    if (*arg == '\0' || *end != '\0') {
+                        ::error(ErrorType::ERR_INVALID,
+                                "--max-prog-insns: invalid number of instructions %1%", arg);
+                        return false;
+                    }
+                    return true; },
+                "[ebpf back-end] Split PSA pipelines whose estimated size exceeds n eBPF "
+                "instructions into programs chained by tail calls (default: 0, do not split)");
+        registerOption("--flow-cache", "n",
+                [this](const char* arg) {
+                    char* end;
+                    flowCacheSize = strtoul(arg, &end, 10);
+                    if (*arg == '\0' || *end != '\0') {
+                        ::error(ErrorType::ERR_INVALID,
+                                "--flow-cache: invalid number of entries %1%", arg);
+                        return false;
+                    }
+                    return true; },
+                "[ebpf back-end] Cache decisions of the PSA ingress control block for up to n "
+                "flows (default: 0, no cache)");
+        registerOption("--map-init-manifest", "file",
+                [this](const char* arg) { mapInitManifest = arg; return true; },
+                "[ebpf back-end] Write initial entries of PSA tables (default actions and const "
+                "entries) to a JSON file to be loaded by the control plane, instead of "
+                "generating the map initializer program");
+        registerOption("--map-layout-manifest", "file",
+                [this](const char* arg) { mapLayoutManifest = arg; return true; },
+                "[ebpf back-end] Write names, sizes and hashes of key and value layouts of "
+                "maps of PSA tables and counters to a JSON file, so that a loader upgrading "
+                "the program can reuse pinned maps whose layout did not change");
+        registerOption("--control-plane-lib", "file",
+                [this](const char* arg) { controlPlaneLibrary = arg; return true; },
+                "[ebpf back-end] Write a C library with typed functions managing PSA tables, "
+                "clone sessions and multicast groups to a .c file and a .h file of the same name");
+        registerOption("--cpu-port-perf-buffer", nullptr,
+                [this](const char*) { cpuPortPerfBuffer = true; return true; },
+                "[ebpf back-end] Send packets unicast to PSA_PORT_CPU by the PSA ingress "
+                "pipeline to user space through the cpu_port_packets perf event array, "
+                "instead of redirecting them to the CPU interface");
+        registerOption("--recirculate-tail-call", nullptr,
+                [this](const char*) { recirculateTailCall = true; return true; },
+                "[ebpf back-end] Recirculate packets sent to PSA_PORT_RECIRCULATE by tail calls "
+                "between the PSA pipelines, instead of redirecting them to the recirculation "
+                "interface given by -DPSA_PORT_RECIRCULATE. A packet is recirculated at most "
+                "4 times, less if the pipelines are split by --max-prog-insns");
+        registerOption("--map-prefix", "prefix",
+                [this](const char* arg) {
+                    mapPrefix = arg;
+                    bool valid = isalpha(*arg) || *arg == '_';
+                    for (const char* c = arg; valid && *c != '\0'; c++)
+                        valid = isalnum(*c) || *c == '_';
+                    if (!valid) {
+                        ::error(ErrorType::ERR_INVALID,
+                                "--map-prefix: %1% is not a valid C identifier", arg);
+                        return false;
+                    }
+                    return true; },
+                "[ebpf back-end] Prepend prefix to the names of all maps, so that maps of "
+                "several programs can be pinned in the same directory");
 }
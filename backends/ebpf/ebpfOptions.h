@@ -31,6 +31,32 @@ class EbpfOptions : public CompilerOptions {
     bool emitExterns = false;
     // tracing eBPF code execution
     bool emitTraceMessages = false;
+    // trace into a ring buffer, formats of trace points are written to this file
+    cstring traceFormatsFile = nullptr;
+    // count PSA table hits and actions (table_stats), drops by reason (drop_stats)
+    // and Traffic Manager events (tm_stats)
+    bool emitStats = false;
+    // record latency of PSA pipeline blocks for 1 in n packets, 0 disables histograms
+    unsigned latencySampling = 0;
+    // split pipelines estimated to be larger than this number of instructions
+    // into programs chained by tail calls, 0 disables splitting
+    unsigned maxProgramInstructions = 0;
+    // number of entries of the PSA ingress flow cache, 0 disables the cache
+    unsigned flowCacheSize = 0;
+    // file to write initial entries of PSA tables to, instead of the map initializer program
+    cstring mapInitManifest = nullptr;
+    // file to write layouts of maps of PSA tables and counters to, to reuse them
+    // across program upgrades
+    cstring mapLayoutManifest = nullptr;
+    // file of the generated control-plane library, the header is written next to it
+    cstring controlPlaneLibrary = nullptr;
+    // send packets for PSA_PORT_CPU to the cpu_port_packets perf event array
+    bool cpuPortPerfBuffer = false;
+    // recirculate packets by tail calls between the PSA pipelines instead of
+    // redirecting them to the PSA_PORT_RECIRCULATE interface
+    bool recirculateTailCall = false;
+    // prepended to the names of all maps
+    cstring mapPrefix = "";
     EbpfOptions();
 };
 
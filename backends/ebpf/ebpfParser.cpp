@@ -199,7 +199,8 @@ bool StateTranslationVisitor::preorder(const IR::SelectCase* selectCase) {
 
 void
 StateTranslationVisitor::compileExtractField(
-    const IR::Expression* expr, cstring field, unsigned alignment, EBPFType* type) {
+    const IR::Expression* expr, cstring field, unsigned alignment, EBPFType* type,
+    cstring offsetVar) {
     unsigned widthToExtract = dynamic_cast<IHasWidth*>(type)->widthInBits();
     auto program = state->parser->program;
     cstring msgStr;
@@ -238,7 +239,7 @@ StateTranslationVisitor::compileExtractField(
         builder->appendFormat(")((%s(%s, BYTES(%s))",
                               helper,
                               program->packetStartVar.c_str(),
-                              program->offsetVar.c_str());
+                              offsetVar.c_str());
         if (shift != 0)
             builder->appendFormat(" >> %d", shift);
         builder->append(")");
@@ -274,7 +275,7 @@ StateTranslationVisitor::compileExtractField(
             builder->appendFormat(")((%s(%s, BYTES(%s) + %d) >> %d)",
                                   helper,
                                   program->packetStartVar.c_str(),
-                                  program->offsetVar.c_str(), i, shift);
+                                  offsetVar.c_str(), i, shift);
 
             if ((i == bytes - 1) && (widthToExtract % 8 != 0)) {
                 builder->append(" & EBPF_MASK(");
@@ -288,7 +289,7 @@ StateTranslationVisitor::compileExtractField(
     }
 
     builder->emitIndent();
-    builder->appendFormat("%s += %d", program->offsetVar.c_str(), widthToExtract);
+    builder->appendFormat("%s += %d", offsetVar.c_str(), widthToExtract);
     builder->endOfStatement(true);
 
     // eBPF can pass 64 bits of data as one argument passed in 64 bit register,
@@ -335,24 +336,7 @@ StateTranslationVisitor::compileExtract(const IR::Expression* destination) {
     builder->target->emitTraceMessage(builder, "Parser: check pkt_len=%d >= last_read_byte=%d",
                                       2, program->lengthVar.c_str(), offsetStr.c_str());
 
-    // to load some fields the compiler will use larger words
-    // than actual width of a field (e.g. 48-bit field loaded using load_dword())
-    // we must ensure that the larger word is not outside of packet buffer.
-    // FIXME: this can fail if a packet does not contain additional payload after header.
-    //  However, we don't have better solution in case of using load_X functions to parse packet.
-    // TODO: consider using a collection of smaller widths.
-    unsigned curr_padding = 0;
-    for (auto f : ht->fields) {
-        auto ftype = state->parser->typeMap->getType(f);
-        auto etype = EBPFTypeFactory::instance->create(ftype);
-        if (etype->is<EBPFScalarType>()) {
-            auto scalarType = etype->to<EBPFScalarType>();
-            unsigned padding = scalarType->alignment() * 8 - scalarType->widthInBits();
-            if (scalarType->widthInBits() + padding >= curr_padding) {
-                curr_padding = padding;
-            }
-        }
-    }
+    unsigned curr_padding = extractPadding(ht);
 
     builder->emitIndent();
     builder->appendFormat("if (%s < %s + BYTES(%s + %d + %u)) ",
@@ -377,7 +361,17 @@ StateTranslationVisitor::compileExtract(const IR::Expression* destination) {
     builder->target->emitTraceMessage(builder, msgStr.c_str());
     builder->newline();
 
+    // fields that are never read are skipped, see EBPFParser::deferredFields
+    std::set<cstring> deferred;
+    auto member = destination->to<IR::Member>();
+    if (member != nullptr && member->expr->is<IR::PathExpression>() &&
+        program->refMap->getDeclaration(member->expr->to<IR::PathExpression>()->path) ==
+            state->parser->headers &&
+        state->parser->deferredFields.count(member->member.name) != 0)
+        deferred = state->parser->deferredFields.at(member->member.name);
+
     unsigned alignment = 0;
+    unsigned skipped = 0;
     for (auto f : ht->fields) {
         auto ftype = state->parser->typeMap->getType(f);
         auto etype = EBPFTypeFactory::instance->create(ftype);
@@ -387,10 +381,17 @@ StateTranslationVisitor::compileExtract(const IR::Expression* destination) {
                     "Only headers with fixed widths supported %1%", f);
             return;
         }
-        compileExtractField(destination, f->name, alignment, etype);
+        if (deferred.count(f->name.name) != 0) {
+            skipped += et->widthInBits();
+        } else {
+            skipBits(program->offsetVar, skipped);
+            skipped = 0;
+            compileExtractField(destination, f->name, alignment, etype, program->offsetVar);
+        }
         alignment += et->widthInBits();
         alignment %= 8;
     }
+    skipBits(program->offsetVar, skipped);
 
     if (ht->is<IR::Type_Header>()) {
         builder->emitIndent();
@@ -404,6 +405,80 @@ StateTranslationVisitor::compileExtract(const IR::Expression* destination) {
     builder->newline();
 }
 
+unsigned StateTranslationVisitor::extractPadding(const IR::Type_StructLike* type) const {
+    // to load some fields the compiler will use larger words
+    // than actual width of a field (e.g. 48-bit field loaded using load_dword())
+    // we must ensure that the larger word is not outside of packet buffer.
+    // FIXME: this can fail if a packet does not contain additional payload after header.
+    //  However, we don't have better solution in case of using load_X functions to parse packet.
+    // TODO: consider using a collection of smaller widths.
+    unsigned curr_padding = 0;
+    for (auto f : type->fields) {
+        auto ftype = state->parser->typeMap->getType(f);
+        auto etype = EBPFTypeFactory::instance->create(ftype);
+        if (etype->is<EBPFScalarType>()) {
+            auto scalarType = etype->to<EBPFScalarType>();
+            unsigned padding = scalarType->alignment() * 8 - scalarType->widthInBits();
+            if (scalarType->widthInBits() + padding >= curr_padding) {
+                curr_padding = padding;
+            }
+        }
+    }
+    return curr_padding;
+}
+
+void
+StateTranslationVisitor::compileDeferredExtract(const IR::Expression* destination,
+                                                cstring offsetVar) {
+    auto ht = state->parser->typeMap->getType(destination)->to<IR::Type_StructLike>();
+    CHECK_NULL(ht);
+    auto member = destination->to<IR::Member>();
+    CHECK_NULL(member);
+    auto& deferred = state->parser->deferredFields.at(member->member.name);
+    auto program = state->parser->program;
+
+    builder->emitIndent();
+    builder->appendFormat("if (%s < %s + BYTES(%s + %d + %u)) ",
+                          program->packetEndVar.c_str(),
+                          program->packetStartVar.c_str(),
+                          offsetVar.c_str(), ht->width_bits(), extractPadding(ht));
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder, "Parser: invalid packet (packet too short)");
+    program->emitDropCount(builder, "PARSER_PACKET_TOO_SHORT");
+    builder->emitIndent();
+    builder->appendFormat("return %s;", builder->target->abortReturnCode().c_str());
+    builder->newline();
+    builder->blockEnd(true);
+
+    unsigned alignment = 0;
+    unsigned skipped = 0;
+    for (auto f : ht->fields) {
+        auto etype = EBPFTypeFactory::instance->create(state->parser->typeMap->getType(f));
+        auto et = dynamic_cast<IHasWidth*>(etype);
+        if (deferred.count(f->name.name) != 0) {
+            skipBits(offsetVar, skipped);
+            skipped = 0;
+            // emitted outside of parser traversal, but compileExtractField() visits destination
+            auto profile = init_apply(destination);
+            compileExtractField(destination, f->name, alignment, etype, offsetVar);
+            end_apply(destination);
+        } else {
+            skipped += et->widthInBits();
+        }
+        alignment += et->widthInBits();
+        alignment %= 8;
+    }
+    skipBits(offsetVar, skipped);
+}
+
+void StateTranslationVisitor::skipBits(cstring offsetVar, unsigned bits) {
+    if (bits == 0)
+        return;
+    builder->emitIndent();
+    builder->appendFormat("%s += %u", offsetVar.c_str(), bits);
+    builder->endOfStatement(true);
+}
+
 void StateTranslationVisitor::processFunction(const P4::ExternFunction* function) {
     ::error(ErrorType::ERR_UNEXPECTED,
             "Unexpected extern function call in parser %1%", function->expr);
@@ -535,6 +610,13 @@ void EBPFParser::emitDeclaration(CodeBuilder* builder, const IR::Declaration* de
 }
 
 
+void EBPFParser::emitDeferredExtract(CodeBuilder* builder, cstring header,
+                                     cstring offsetVar) const {
+    visitor->setBuilder(builder);
+    visitor->setState(states.front());
+    visitor->compileDeferredExtract(deferredExtracts.at(header), offsetVar);
+}
+
 void EBPFParser::emit(CodeBuilder* builder) {
     for (auto l : parserBlock->container->parserLocals)
         emitDeclaration(builder, l);
@@ -590,9 +672,11 @@ bool EBPFParser::build() {
 }
 
 void EBPFParser::emitRejectState(CodeBuilder* builder) {
+    program->emitDropCount(builder, "PARSER_REJECT");
     builder->emitIndent();
     builder->appendFormat("return %s;", builder->target->abortReturnCode().c_str());
     builder->newline();
 }
 
 }  // namespace EBPF
+
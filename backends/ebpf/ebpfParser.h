@@ -36,8 +36,12 @@ class StateTranslationVisitor : public CodeGenInspector {
     const EBPFParserState* state;
 
     void compileExtractField(const IR::Expression* expr, cstring name,
-                             unsigned alignment, EBPFType* type);
+                             unsigned alignment, EBPFType* type, cstring offsetVar);
     virtual void compileExtract(const IR::Expression* destination);
+    // Bytes that may be read after the header by loads wider than its last field.
+    unsigned extractPadding(const IR::Type_StructLike* type) const;
+    // Advances offsetVar over fields which are not loaded.
+    void skipBits(cstring offsetVar, unsigned bits);
     void compileLookahead(const IR::Expression* destination);
     void compileAdvance(const P4::ExternMethod *ext);
 
@@ -53,6 +57,9 @@ class StateTranslationVisitor : public CodeGenInspector {
     void setState(const EBPFParserState* state) {
         this->state = state;
     }
+    // Loads the deferred fields of a header extracted to destination, starting at offsetVar.
+    // offsetVar is advanced past the header.
+    void compileDeferredExtract(const IR::Expression* destination, cstring offsetVar);
     bool preorder(const IR::ParserState* state) override;
     bool preorder(const IR::SelectCase* selectCase) override;
     bool preorder(const IR::SelectExpression* expression) override;
@@ -86,6 +93,12 @@ class EBPFParser : public EBPFObject {
 
     StateTranslationVisitor*      visitor;
 
+    // Fields of extracted headers (by header name) that are skipped instead of loaded,
+    // because they are never read. The deparser loads them if it has to write the header.
+    std::map<cstring, std::set<cstring>> deferredFields;
+    // Expressions the headers with deferred fields are extracted to.
+    std::map<cstring, const IR::Expression*> deferredExtracts;
+
     explicit EBPFParser(const EBPFProgram* program, const IR::ParserBlock* block,
                         const P4::TypeMap* typeMap);
     virtual void emitDeclaration(CodeBuilder* builder, const IR::Declaration* decl);
@@ -95,6 +108,8 @@ class EBPFParser : public EBPFObject {
     virtual void emitTypes(CodeBuilder* builder) { (void) builder; }
     virtual void emitValueSetInstances(CodeBuilder* builder) { (void) builder; }
     virtual void emitRejectState(CodeBuilder* builder);
+    /* Generates loads of the deferred fields of a header, see deferredFields. */
+    void emitDeferredExtract(CodeBuilder* builder, cstring header, cstring offsetVar) const;
 };
 
 }  // namespace EBPF
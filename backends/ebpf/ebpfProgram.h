@@ -81,6 +81,11 @@ class EBPFProgram : public EBPFObject {
 
  public:
     virtual void emitGeneratedComment(CodeBuilder* builder);
+    /// Emits code counting a packet dropped for a reason such as "PARSER_REJECT",
+    /// nothing by default.
+    virtual void emitDropCount(CodeBuilder* builder, cstring reason) const {
+        (void) builder; (void) reason;
+    }
     virtual void emitH(CodeBuilder* builder, cstring headerFile);  // emits C headers
     virtual void emitC(CodeBuilder* builder, cstring headerFile);  // emits C program
 };
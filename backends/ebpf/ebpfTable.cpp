@@ -28,6 +28,15 @@ bool ActionTranslationVisitor::preorder(const IR::PathExpression* expression) {
         builder->append(paramStr.c_str());
         return false;
     }
+    // parameters of the control block may be named after the parameters of the parser
+    auto decl = program->refMap->getDeclaration(expression->path, true);
+    if (auto param = decl->to<IR::Parameter>()) {
+        auto subst = ::get(substitution, param);
+        if (subst != nullptr) {
+            builder->append(subst->name);
+            return false;
+        }
+    }
     visit(expression->path);
     return false;
 }
@@ -459,6 +468,7 @@ void EBPFTable::emitAction(CodeBuilder* builder, cstring valueName, cstring acti
 
         msgStr = Util::printf_format("Control: executing action %s", name);
         builder->target->emitTraceMessage(builder, msgStr.c_str());
+        emitStatsIncrement(builder, Util::printf_format("actions[%s]", actionName));
         for (auto param : *(action->parameters)) {
             auto etype = EBPFTypeFactory::instance->create(param->type);
             unsigned width = dynamic_cast<IHasWidth*>(etype)->widthInBits();
@@ -494,6 +504,7 @@ void EBPFTable::emitAction(CodeBuilder* builder, cstring valueName, cstring acti
     builder->appendLine("default:");
     builder->increaseIndent();
     builder->target->emitTraceMessage(builder, "Control: Invalid action type, aborting");
+    program->emitDropCount(builder, "INVALID_ACTION");
 
     builder->emitIndent();
     builder->appendFormat("return %s", builder->target->abortReturnCode().c_str());
@@ -524,7 +535,7 @@ void EBPFTable::emitInitializer(CodeBuilder* builder) {
     auto action = ac->action;
     cstring name = EBPFObject::externalName(action);
     cstring fd = "tableFileDescriptor";
-    cstring defaultTable = defaultActionMapName;
+    cstring defaultTable = builder->target->mapName(defaultActionMapName);
     cstring value = "value";
     cstring key = "key";
 
@@ -582,12 +593,13 @@ void EBPFTable::emitInitializer(CodeBuilder* builder) {
     builder->emitIndent();
     builder->blockStart();
     builder->emitIndent();
+    cstring dataMap = builder->target->mapName(dataMapName);
     builder->appendFormat("int %s = BPF_OBJ_GET(MAP_PATH \"/%s\")",
-                          fd.c_str(), dataMapName.c_str());
+                          fd.c_str(), dataMap.c_str());
     builder->endOfStatement(true);
     builder->emitIndent();
     builder->appendFormat("if (%s < 0) { fprintf(stderr, \"map %s not loaded\\n\"); exit(1); }",
-                          fd.c_str(), dataMapName.c_str());
+                          fd.c_str(), dataMap.c_str());
     builder->newline();
 
     for (auto e : entries->entries) {
@@ -106,6 +106,8 @@ class EBPFTable : public EBPFTableBase {
     virtual void emitValueStructStructure(CodeBuilder* builder);
     virtual void emitAction(CodeBuilder* builder, cstring valueName, cstring actionRunVariable);
     virtual void emitInitializer(CodeBuilder* builder);
+    // Declares variables used by emitLookup and emitLookupDefault in the scope of table apply.
+    virtual void emitLookupDeclarations(CodeBuilder*, cstring) {}
     virtual void emitLookup(CodeBuilder* builder, cstring key, cstring value) {
         builder->target->emitTableLookup(builder, dataMapName, key, value);
         builder->endOfStatement(true);
@@ -121,6 +123,10 @@ class EBPFTable : public EBPFTableBase {
     // Whether to drop packet if no match entry found.
     // Some table implementations may want to continue processing.
     virtual bool dropOnNoMatchingEntryFound() const { return true; }
+    // Declares variables used by emitStatsIncrement in the scope of table apply.
+    virtual void emitStatsDeclarations(CodeBuilder*) {}
+    // Increments a counter of the table statistics, if the condition holds.
+    virtual void emitStatsIncrement(CodeBuilder*, cstring, cstring = nullptr) {}
 };
 
 class EBPFCounterTable : public EBPFTableBase {
@@ -42,6 +42,21 @@ class PSASwitchBackend {
     }
 
     void convert(const IR::ToplevelBlock *tlb);
+    void emitMapInitManifest(std::ostream &manifest) const {
+        ebpf_program->emitMapInitManifest(manifest);
+    }
+    void emitMapLayoutManifest(std::ostream &manifest) const {
+        ebpf_program->emitMapLayoutManifest(manifest);
+    }
+    void emitControlPlaneLibrary(std::ostream &cstream, std::ostream &hstream,
+                                 cstring hfile) const {
+        CodeBuilder c(target);
+        CodeBuilder h(target);
+        ebpf_program->emitControlPlaneHeader(&h);
+        ebpf_program->emitControlPlaneSource(&c, hfile);
+        cstream << c.toString();
+        hstream << h.toString();
+    }
     void codegen(std::ostream &cstream) const {
         CodeBuilder c(target);
         // instead of generating two files, put all the code in a single file
@@ -14,8 +14,11 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <algorithm>
+
 #include "ebpfPipeline.h"
 #include "backends/ebpf/ebpfParser.h"
+#include "backends/ebpf/ebpfCostModel.h"
 
 namespace EBPF {
 
@@ -57,10 +60,122 @@ void EBPFPipeline::emitLocalVariables(CodeBuilder* builder) {
 
     if (shouldEmitTimestamp()) {
         builder->emitIndent();
-        builder->appendFormat("u64 %s = ", timestampVar.c_str());
-        emitTimestamp(builder);
+        if (currentStage > 0) {
+            // restored from the stage state
+            builder->appendFormat("u64 %s", timestampVar.c_str());
+        } else {
+            builder->appendFormat("u64 %s = ", timestampVar.c_str());
+            emitTimestamp(builder);
+        }
         builder->endOfStatement(true);
     }
+
+    if (shouldEmitLatency()) {
+        if (currentStage > 0) {
+            // restored from the stage state
+            builder->emitIndent();
+            builder->appendFormat("u64 %s", latencyVar.c_str());
+            builder->endOfStatement(true);
+        } else {
+            emitLatencyStart(builder);
+        }
+    }
+}
+
+void EBPFPipeline::emitLatencyStart(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendFormat("u64 %s = 0", latencyVar.c_str());
+    builder->endOfStatement(true);
+    if (options.latencySampling > 1) {
+        builder->emitIndent();
+        builder->appendFormat("if (bpf_get_prandom_u32() %% %u == 0)", options.latencySampling);
+        builder->newline();
+        builder->increaseIndent();
+    }
+    builder->emitIndent();
+    builder->appendFormat("%s = ", latencyVar.c_str());
+    emitTimestamp(builder);
+    builder->endOfStatement(true);
+    if (options.latencySampling > 1)
+        builder->decreaseIndent();
+}
+
+void EBPFPipeline::emitLatencyRecord(CodeBuilder *builder, cstring block) {
+    if (!shouldEmitLatency())
+        return;
+    builder->emitIndent();
+    builder->appendFormat("if (%s != 0)", latencyVar.c_str());
+    builder->newline();
+    builder->increaseIndent();
+    builder->emitIndent();
+    builder->appendFormat("%s = latency_record(LATENCY_%s_%s, %s)", latencyVar.c_str(),
+                          is<EBPFIngressPipeline>() ? "INGRESS" : "EGRESS", block,
+                          latencyVar.c_str());
+    builder->endOfStatement(true);
+    builder->decreaseIndent();
+}
+
+const std::vector<cstring>& EBPFPipeline::dropReasons() {
+    static const std::vector<cstring> reasons = {
+        "PARSER_REJECT",
+        "PARSER_PACKET_TOO_SHORT",
+        "BRIDGED_METADATA_MISSING",
+        "TABLE_MISS",
+        "INVALID_ACTION",
+        "INGRESS_DROP",
+        "RESUBMIT_LIMIT",
+        "DEPARSER_PACKET_TOO_SHORT",
+        "DEPARSER_ADJUST_FAILED",
+        "EGRESS_DROP",
+        "INTERNAL_ERROR",
+        "CPU_PORT_BUFFER_FULL",
+        "RECIRCULATE_LIMIT",
+    };
+    return reasons;
+}
+
+void EBPFPipeline::emitDropCount(CodeBuilder *builder, cstring reason) const {
+    if (!options.emitStats)
+        return;
+    auto& reasons = dropReasons();
+    BUG_CHECK(std::find(reasons.begin(), reasons.end(), reason) != reasons.end(),
+              "%1%: unknown drop reason", reason);
+    builder->emitIndent();
+    builder->appendFormat("count_drop(DROP_REASON_%s)", reason);
+    builder->endOfStatement(true);
+}
+
+const std::vector<cstring>& EBPFPipeline::trafficManagerCounters() {
+    static const std::vector<cstring> counters = {
+        // packets sent on each packet path, indexed by the PSA_PacketPath_t values;
+        // NORMAL only reserves index 0 and is never incremented
+        "NORMAL",
+        "NORMAL_UNICAST",
+        "NORMAL_MULTICAST",
+        "CLONE_I2E",
+        "CLONE_E2E",
+        "RESUBMIT",
+        "RECIRCULATE",
+        // clone sessions and multicast groups which have been found
+        "REPLICATIONS",
+        "CLONES",
+        "CLONE_FAILURES",
+        "MISSING_SESSIONS",
+        // packets written to the cpu_port_packets perf event array
+        "CPU_PORT",
+    };
+    return counters;
+}
+
+void EBPFPipeline::emitTrafficManagerCount(CodeBuilder *builder, cstring counter) const {
+    if (!options.emitStats)
+        return;
+    auto& counters = trafficManagerCounters();
+    BUG_CHECK(std::find(counters.begin(), counters.end(), counter) != counters.end(),
+              "%1%: unknown Traffic Manager counter", counter);
+    builder->emitIndent();
+    builder->appendFormat("count_tm(TM_STATS_%s)", counter);
+    builder->endOfStatement(true);
 }
 
 void EBPFPipeline::emitUserMetadataInstance(CodeBuilder *builder) {
@@ -103,12 +218,13 @@ void EBPFPipeline::emitCPUMAPLookup(CodeBuilder *builder) {
 void EBPFPipeline::emitCPUMAPInitializers(CodeBuilder *builder) {
     emitCPUMAPLookup(builder);
     builder->emitIndent();
-    builder->append("if (!hdrMd)");
-    builder->newline();
-    builder->emitIndent();
+    builder->append("if (!hdrMd) ");
+    builder->blockStart();
+    emitDropCount(builder, "INTERNAL_ERROR");
     builder->emitIndent();
     builder->appendFormat("return %s;", dropReturnCode());
     builder->newline();
+    builder->blockEnd(true);
     builder->emitIndent();
     builder->appendLine("__builtin_memset(hdrMd, 0, sizeof(struct hdr_md));");
 }
@@ -136,10 +252,371 @@ void EBPFPipeline::emitPacketLength(CodeBuilder *builder) {
     builder->appendFormat("%s->len", this->contextVar.c_str());
 }
 
+void EBPFPipeline::emitInputMetadataField(CodeBuilder *builder, cstring field,
+                                          cstring value) const {
+    if (!isInputMetadataUsed(field))
+        return;
+    builder->appendFormat("            .%s = %s,\n", field.c_str(), value.c_str());
+}
+
+void EBPFPipeline::emitParserAccept(CodeBuilder *builder) const {
+    builder->emitIndent();
+    builder->append(IR::ParserState::accept);
+    builder->append(":");
+    builder->newline();
+    // The label is always followed by a statement (the control or deparser block,
+    // or the state saved for the next stage), so it does not need an empty one.
+    if (!isInputMetadataUsed("parser_error"))
+        return;
+    builder->emitIndent();
+    builder->appendFormat("%s.parser_error = %s",
+                          control->inputStandardMetadata->name.name, errorVar.c_str());
+    builder->endOfStatement(true);
+}
+
 void EBPFPipeline::emitTimestamp(CodeBuilder *builder) {
     builder->appendFormat("bpf_ktime_get_ns()");
 }
 
+void EBPFPipeline::splitIntoStages(unsigned maxInstructions) {
+    stages.clear();
+    if (maxInstructions == 0)
+        return;
+
+    InstructionEstimator estimator(refMap, typeMap);
+    auto body = control->controlBlock->container->body;
+    size_t statements = body->components.size();
+    unsigned parserCost = estimator.estimate(parser->parserBlock->container);
+    std::vector<unsigned> statementCosts;
+    unsigned total = parserCost;
+    for (auto component : body->components) {
+        statementCosts.push_back(estimator.estimate(component));
+        total += statementCosts.back();
+    }
+    unsigned deparserCost = estimator.estimate(deparser->controlBlock->container->body);
+    total += deparserCost;
+    LOG2(name << ": estimated size " << total << " instructions");
+    if (total <= maxInstructions)
+        return;
+
+    // Greedily fill stages, a single statement bigger than the limit gets a stage on its own.
+    std::vector<unsigned> stageCosts;
+    PipelineStage current;
+    current.withParser = true;
+    unsigned cost = parserCost;
+    for (size_t i = 0; i < statements; i++) {
+        bool empty = !current.withParser && current.firstStatement == i;
+        if (!empty && cost + statementCosts[i] > maxInstructions) {
+            current.lastStatement = i;
+            stages.push_back(current);
+            stageCosts.push_back(cost);
+            current = PipelineStage();
+            current.firstStatement = i;
+            cost = 0;
+        }
+        cost += statementCosts[i];
+    }
+    current.lastStatement = statements;
+    bool empty = !current.withParser && current.firstStatement == statements;
+    if (!empty && cost + deparserCost > maxInstructions) {
+        stages.push_back(current);
+        stageCosts.push_back(cost);
+        current = PipelineStage();
+        current.firstStatement = current.lastStatement = statements;
+        cost = 0;
+    }
+    current.withDeparser = true;
+    stages.push_back(current);
+    stageCosts.push_back(cost + deparserCost);
+
+    if (stages.size() > maxStages) {
+        ::warning(ErrorType::WARN_UNSUPPORTED,
+                  "%1%: pipeline requires %2% programs of at most %3% instructions, "
+                  "but at most %4% programs can be chained; some programs will be larger",
+                  name, stages.size(), maxInstructions, maxStages);
+        // merge the pair of neighbouring stages with the smallest total size
+        while (stages.size() > maxStages) {
+            size_t best = 0;
+            for (size_t i = 1; i + 1 < stages.size(); i++) {
+                if (stageCosts[i] + stageCosts[i + 1] < stageCosts[best] + stageCosts[best + 1])
+                    best = i;
+            }
+            stages[best].lastStatement = stages[best + 1].lastStatement;
+            stages[best].withDeparser = stages[best + 1].withDeparser;
+            stageCosts[best] += stageCosts[best + 1];
+            stages.erase(stages.begin() + best + 1);
+            stageCosts.erase(stageCosts.begin() + best + 1);
+        }
+    }
+
+    if (stages.size() == 1) {
+        stages.clear();
+        return;
+    }
+    for (size_t i = 0; i < stages.size(); i++) {
+        LOG2(name << ": stage " << i << " parser=" << stages[i].withParser
+             << " statements=[" << stages[i].firstStatement << ", "
+             << stages[i].lastStatement << ") deparser=" << stages[i].withDeparser
+             << " estimated size " << stageCosts[i]);
+    }
+}
+
+bool EBPFPipeline::isStageLocal(const IR::Declaration* decl) const {
+    // Pointers (to standard metadata) are always initialized before use
+    // and cannot be stored in a map, the verifier would reject leaking them.
+    return decl->is<IR::Declaration_Variable>() &&
+           !control->codeGen->isPointerVariable(decl->name.name);
+}
+
+cstring EBPFPipeline::stageSectionName(unsigned stage) const {
+    if (stage == 0)
+        return sectionName;
+    return sectionName + Util::printf_format("-stage%d", stage);
+}
+
+cstring EBPFPipeline::stageFunctionName(unsigned stage) const {
+    if (stage == 0)
+        return functionName;
+    return name.replace("-", "_") + Util::printf_format("_stage%d_func", stage);
+}
+
+void EBPFPipeline::emitStageStateType(CodeBuilder *builder) {
+    builder->appendFormat("struct %s ", stageStateName());
+    builder->blockStart();
+    emitStageStateFields(builder);
+    builder->emitIndent();
+    builder->appendFormat("unsigned %s", offsetVar.c_str());
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("%s %s", errorEnum.c_str(), errorVar.c_str());
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("u64 %s", timestampVar.c_str());
+    builder->endOfStatement(true);
+    if (shouldEmitLatency()) {
+        builder->emitIndent();
+        builder->appendFormat("u64 %s", latencyVar.c_str());
+        builder->endOfStatement(true);
+    }
+
+    // local variables of the control block live across stages
+    builder->emitIndent();
+    builder->append("struct ");
+    builder->blockStart();
+    for (auto decl : control->controlBlock->container->controlLocals) {
+        if (!isStageLocal(decl))
+            continue;
+        auto vd = decl->to<IR::Declaration_Variable>();
+        auto etype = EBPFTypeFactory::instance->create(vd->type);
+        builder->emitIndent();
+        etype->declare(builder, vd->name, false);
+        builder->endOfStatement(true);
+    }
+    // additional field to avoid compiler errors when there are no local variables
+    builder->emitIndent();
+    builder->append("__u8 __hook");
+    builder->endOfStatement(true);
+    builder->blockEnd(false);
+    builder->append(" locals");
+    builder->endOfStatement(true);
+
+    builder->blockEnd(false);
+    builder->endOfStatement(true);
+    builder->newline();
+}
+
+void EBPFPipeline::emitProgArray(CodeBuilder *builder) {
+    std::vector<cstring> programs;
+    for (unsigned i = 0; i < stages.size(); i++)
+        programs.push_back(stageFunctionName(i));
+    builder->target->emitProgArrayDecl(builder, progArrayName(), programs);
+}
+
+void EBPFPipeline::emitTailCall(CodeBuilder *builder, unsigned stage) const {
+    builder->emitIndent();
+    builder->appendFormat("bpf_tail_call(%s, &%s, %d);", contextVar.c_str(),
+                          builder->target->mapName(progArrayName()).c_str(), stage);
+    builder->newline();
+    cstring msgStr = Util::printf_format("%s: tail call to stage %d failed, dropping packet",
+                                         sectionName, stage);
+    builder->target->emitTraceMessage(builder, msgStr.c_str());
+}
+
+void EBPFPipeline::emitRecirculateTailCall(CodeBuilder *builder, unsigned index) const {
+    builder->emitIndent();
+    builder->appendFormat("bpf_tail_call(%s, &%s, %d);", contextVar.c_str(),
+                          builder->target->mapName("recirculate_progs").c_str(), index);
+    builder->newline();
+    cstring msgStr = Util::printf_format("%s: tail call for recirculation failed, "
+                                         "dropping packet", sectionName);
+    builder->target->emitTraceMessage(builder, msgStr.c_str());
+    emitDropCount(builder, "INTERNAL_ERROR");
+    builder->emitIndent();
+    builder->appendFormat("return %s;", builder->target->abortReturnCode().c_str());
+    builder->newline();
+}
+
+void EBPFPipeline::emitStages(CodeBuilder *builder) {
+    for (unsigned i = 0; i < stages.size(); i++)
+        emitStage(builder, i);
+    currentStage = 0;
+}
+
+void EBPFPipeline::emitStage(CodeBuilder *builder, unsigned stage) {
+    cstring msgStr, varStr;
+    auto& st = stages.at(stage);
+    size_t statements = control->controlBlock->container->body->components.size();
+    currentStage = stage;
+
+    builder->newline();
+    builder->target->emitCodeSection(builder, stageSectionName(stage));
+    builder->emitIndent();
+    builder->target->emitMain(builder, stageFunctionName(stage), model.CPacketName.str());
+    builder->spc();
+    builder->blockStart();
+
+    // hook-specific initialization is done only once, by the first stage
+    if (stage == 0)
+        emitGlobalMetadataInitializer(builder);
+    else
+        EBPFPipeline::emitGlobalMetadataInitializer(builder);
+    emitLocalVariables(builder);
+    emitUserMetadataInstance(builder);
+    emitHeaderInstances(builder);
+    builder->newline();
+
+    emitCPUMAPLookup(builder);
+    builder->emitIndent();
+    builder->append("if (!hdrMd) ");
+    builder->blockStart();
+    emitDropCount(builder, "INTERNAL_ERROR");
+    builder->emitIndent();
+    builder->appendFormat("return %s;", dropReturnCode());
+    builder->newline();
+    builder->blockEnd(true);
+    if (stage == 0)
+        emitStageCPUMAPInitializer(builder);
+    builder->newline();
+    emitHeadersFromCPUMAP(builder);
+    builder->newline();
+    emitMetadataFromCPUMAP(builder);
+    builder->newline();
+    builder->emitIndent();
+    builder->appendFormat("struct %s *%s = &hdrMd->%s;",
+                          stageStateName(), stageStateVar, stageStateName());
+    builder->newline();
+
+    if (stage > 0) {
+        builder->emitIndent();
+        builder->appendFormat("%s = %s->%s;", offsetVar, stageStateVar, offsetVar);
+        builder->newline();
+        builder->emitIndent();
+        builder->appendFormat("%s = %s->%s;", errorVar, stageStateVar, errorVar);
+        builder->newline();
+        if (shouldEmitTimestamp()) {
+            builder->emitIndent();
+            builder->appendFormat("%s = %s->%s;", timestampVar, stageStateVar, timestampVar);
+            builder->newline();
+        }
+        if (shouldEmitLatency()) {
+            builder->emitIndent();
+            builder->appendFormat("%s = %s->%s;", latencyVar, stageStateVar, latencyVar);
+            builder->newline();
+        }
+    }
+    emitStageMetadata(builder);
+
+    // PARSER
+    if (st.withParser) {
+        msgStr = Util::printf_format("%s parser: parsing new packet, path=%%d, pkt_len=%%d",
+                                     sectionName);
+        varStr = Util::printf_format("%s->packet_path", compilerGlobalMetadata);
+        builder->target->emitTraceMessage(builder, msgStr.c_str(), 2,
+                                          varStr, lengthVar.c_str());
+        parser->emit(builder);
+        emitParserAccept(builder);
+        emitLatencyRecord(builder, "PARSER");
+    }
+
+    // CONTROL
+    if (st.firstStatement < st.lastStatement) {
+        builder->emitIndent();
+        builder->blockStart();
+        if (st.firstStatement == 0) {
+            msgStr = Util::printf_format("%s control: packet processing started", sectionName);
+            builder->target->emitTraceMessage(builder, msgStr.c_str());
+        }
+        control->emitDeclarations(builder);
+        for (auto decl : control->controlBlock->container->controlLocals) {
+            if (st.firstStatement == 0 || !isStageLocal(decl))
+                continue;
+            builder->emitIndent();
+            builder->appendFormat("%s = %s->locals.%s;",
+                                  decl->name.name, stageStateVar, decl->name.name);
+            builder->newline();
+        }
+        control->emitStatements(builder, st.firstStatement, st.lastStatement);
+        for (auto decl : control->controlBlock->container->controlLocals) {
+            if (st.lastStatement == statements || !isStageLocal(decl))
+                continue;
+            builder->emitIndent();
+            builder->appendFormat("%s->locals.%s = %s;",
+                                  stageStateVar, decl->name.name, decl->name.name);
+            builder->newline();
+        }
+        builder->blockEnd(true);
+        if (st.lastStatement == statements) {
+            msgStr = Util::printf_format("%s control: packet processing finished", sectionName);
+            builder->target->emitTraceMessage(builder, msgStr.c_str());
+        }
+    }
+    // the control block is finished before the deparser even if it is empty
+    if (st.withDeparser)
+        emitLatencyRecord(builder, "CONTROL");
+
+    if (!st.withDeparser) {
+        builder->emitIndent();
+        builder->appendFormat("%s->%s = %s;", stageStateVar, offsetVar, offsetVar);
+        builder->newline();
+        builder->emitIndent();
+        builder->appendFormat("%s->%s = %s;", stageStateVar, errorVar, errorVar);
+        builder->newline();
+        if (shouldEmitTimestamp()) {
+            builder->emitIndent();
+            builder->appendFormat("%s->%s = %s;", stageStateVar, timestampVar, timestampVar);
+            builder->newline();
+        }
+        if (shouldEmitLatency()) {
+            builder->emitIndent();
+            builder->appendFormat("%s->%s = %s;", stageStateVar, latencyVar, latencyVar);
+            builder->newline();
+        }
+        emitStageMetadataSave(builder);
+        emitTailCall(builder, stage + 1);
+        // only reached if the tail call failed
+        emitDropCount(builder, "INTERNAL_ERROR");
+        builder->emitIndent();
+        builder->appendFormat("return %s;", dropReturnCode());
+        builder->newline();
+        builder->blockEnd(true);
+        return;
+    }
+
+    // DEPARSER
+    builder->emitIndent();
+    builder->blockStart();
+    msgStr = Util::printf_format("%s deparser: packet deparsing started", sectionName);
+    builder->target->emitTraceMessage(builder, msgStr.c_str());
+    deparser->emit(builder);
+    msgStr = Util::printf_format("%s deparser: packet deparsing finished", sectionName);
+    builder->target->emitTraceMessage(builder, msgStr.c_str());
+    builder->blockEnd(true);
+    emitLatencyRecord(builder, "DEPARSER");
+
+    emitStageTrafficManager(builder);
+    builder->blockEnd(true);
+}
+
 // =====================EBPFIngressPipeline===========================
 void EBPFIngressPipeline::emitSharedMetadataInitializer(CodeBuilder *builder) {
     auto type = EBPFTypeFactory::instance->create(this->deparser->resubmit_meta->type);
@@ -149,13 +626,18 @@ void EBPFIngressPipeline::emitSharedMetadataInitializer(CodeBuilder *builder) {
 
 void EBPFIngressPipeline::emitPSAControlInputMetadata(CodeBuilder *builder) {
         builder->emitIndent();
-        builder->appendFormat("struct psa_ingress_input_metadata_t %s = {\n"
-                              "            .ingress_port = %s,\n"
-                              "            .packet_path = %s,\n"
-                              "            .parser_error = %s,\n"
-                              "    };",
-                              control->inputStandardMetadata->name.name,
-                              ifindexVar.c_str(), packetPathVar.c_str(), errorVar.c_str());
+        builder->appendFormat("struct psa_ingress_input_metadata_t %s = {\n",
+                              control->inputStandardMetadata->name.name);
+        cstring ingressPort = ifindexVar;
+        if (options.recirculateTailCall) {
+            // recirculated packets are tail called by the Egress pipeline of an output port
+            ingressPort = Util::printf_format("%s == RECIRCULATE ? P4C_PSA_PORT_RECIRCULATE : %s",
+                                              packetPathVar, ifindexVar);
+        }
+        emitInputMetadataField(builder, "ingress_port", ingressPort);
+        emitInputMetadataField(builder, "packet_path", packetPathVar);
+        emitInputMetadataField(builder, "parser_error", errorVar);
+        builder->append("    };");
         builder->newline();
         if (shouldEmitTimestamp()) {
             builder->emitIndent();
@@ -176,9 +658,87 @@ void EBPFIngressPipeline::emitPSAControlOutputMetadata(CodeBuilder *builder) {
     builder->newline();
 }
 
+void EBPFIngressPipeline::emitStageStateFields(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendFormat("struct psa_ingress_output_metadata_t %s",
+                          control->outputStandardMetadata->name.name);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    auto type = EBPFTypeFactory::instance->create(deparser->resubmit_meta->type);
+    type->declare(builder, deparser->resubmit_meta->name.name, false);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->append("u32 resubmit_depth");
+    builder->endOfStatement(true);
+}
+
+void EBPFIngressPipeline::emitStageCPUMAPInitializer(CodeBuilder *builder) {
+    // Output metadata, resubmit metadata and the resubmit depth
+    // are kept in the stage state if the packet is resubmitted.
+    builder->emitIndent();
+    builder->appendFormat("if (%s != RESUBMIT) ", packetPathVar.c_str());
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendLine("__builtin_memset(hdrMd, 0, sizeof(struct hdr_md));");
+    builder->emitIndent();
+    builder->appendFormat("hdrMd->%s.%s.drop = true;",
+                          stageStateName(), control->outputStandardMetadata->name.name);
+    builder->newline();
+    builder->blockEnd(false);
+    builder->append(" else ");
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendLine("__builtin_memset(&hdrMd->cpumap_hdr, 0, sizeof(hdrMd->cpumap_hdr));");
+    builder->emitIndent();
+    builder->appendLine("__builtin_memset(&hdrMd->cpumap_usermeta, 0, "
+                        "sizeof(hdrMd->cpumap_usermeta));");
+    builder->blockEnd(true);
+    builder->emitIndent();
+    builder->appendFormat("hdrMd->%s.%s.resubmit = 0;",
+                          stageStateName(), control->outputStandardMetadata->name.name);
+    builder->newline();
+}
+
+void EBPFIngressPipeline::emitStageMetadata(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendFormat("struct psa_ingress_output_metadata_t *%s = &%s->%s;",
+                          control->outputStandardMetadata->name.name, stageStateVar,
+                          control->outputStandardMetadata->name.name);
+    builder->newline();
+    builder->emitIndent();
+    auto type = EBPFTypeFactory::instance->create(deparser->resubmit_meta->type);
+    type->declare(builder, deparser->resubmit_meta->name.name, true);
+    builder->appendFormat(" = &%s->%s", stageStateVar, deparser->resubmit_meta->name.name);
+    builder->endOfStatement(true);
+    emitPSAControlInputMetadata(builder);
+}
+
+void EBPFIngressPipeline::emitStageMetadataSave(CodeBuilder *builder) {
+    // output metadata is accessed in place
+    (void) builder;
+}
+
+void EBPFIngressPipeline::emitStageTrafficManager(CodeBuilder *builder) {
+    // The Traffic Manager uses output metadata as a value, shadow the pointer.
+    builder->emitIndent();
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendFormat("struct psa_ingress_output_metadata_t %s = %s->%s;",
+                          control->outputStandardMetadata->name.name, stageStateVar,
+                          control->outputStandardMetadata->name.name);
+    builder->newline();
+    this->emitTrafficManager(builder);
+    builder->blockEnd(true);
+}
+
 void EBPFIngressPipeline::emit(CodeBuilder *builder) {
     cstring msgStr, varStr;
 
+    if (isSplit()) {
+        emitStages(builder);
+        return;
+    }
+
     // firstly emit process() in-lined function and then the actual BPF section.
     builder->append("static __always_inline");
     builder->spc();
@@ -230,13 +790,24 @@ void EBPFIngressPipeline::emit(CodeBuilder *builder) {
     builder->append(":");
     builder->spc();
     builder->blockStart();
+    emitLatencyRecord(builder, "PARSER");
     emitPSAControlInputMetadata(builder);
     msgStr = Util::printf_format("%s control: packet processing started", sectionName);
     builder->target->emitTraceMessage(builder, msgStr.c_str());
-    control->emit(builder);
+    if (flowCache != nullptr) {
+        flowCache->emitLookup(builder);
+        builder->append(" else ");
+        builder->blockStart();
+        control->emit(builder);
+        flowCache->emitUpdate(builder);
+        builder->blockEnd(true);
+    } else {
+        control->emit(builder);
+    }
     builder->blockEnd(true);
     msgStr = Util::printf_format("%s control: packet processing finished", sectionName);
     builder->target->emitTraceMessage(builder, msgStr.c_str());
+    emitLatencyRecord(builder, "CONTROL");
 
     // DEPARSER
     builder->emitIndent();
@@ -247,6 +818,7 @@ void EBPFIngressPipeline::emit(CodeBuilder *builder) {
     msgStr = Util::printf_format("%s deparser: packet deparsing finished", sectionName);
     builder->target->emitTraceMessage(builder, msgStr.c_str());
     builder->blockEnd(true);
+    emitLatencyRecord(builder, "DEPARSER");
 
     builder->emitIndent();
     builder->appendFormat("return %d;", actUnspecCode);
@@ -309,6 +881,8 @@ void EBPFIngressPipeline::emit(CodeBuilder *builder) {
                         "    }", actUnspecCode);
     builder->newline();
 
+    if (shouldEmitLatency())
+        emitLatencyStart(builder);
     this->emitTrafficManager(builder);
 
     builder->blockEnd(true);
@@ -317,16 +891,21 @@ void EBPFIngressPipeline::emit(CodeBuilder *builder) {
 // =====================EBPFEgressPipeline============================
 void EBPFEgressPipeline::emitPSAControlInputMetadata(CodeBuilder *builder) {
     builder->emitIndent();
-    builder->appendFormat("struct psa_egress_input_metadata_t %s = {\n"
-                          "            .class_of_service = %s,\n"
-                          "            .egress_port = %s,\n"
-                          "            .packet_path = %s,\n"
-                          "            .instance = %s,\n"
-                          "            .parser_error = %s,\n"
-                          "        };",
-                          control->inputStandardMetadata->name.name,
-                          priorityVar.c_str(), ifindexVar.c_str(),
-                          packetPathVar.c_str(), pktInstanceVar.c_str(), errorVar.c_str());
+    builder->appendFormat("struct psa_egress_input_metadata_t %s = {\n",
+                          control->inputStandardMetadata->name.name);
+    emitInputMetadataField(builder, "class_of_service", priorityVar);
+    // egress port is always needed to detect recirculation
+    if (options.recirculateTailCall) {
+        builder->appendFormat("            .egress_port = %s->recirculating ? "
+                              "P4C_PSA_PORT_RECIRCULATE : %s,\n",
+                              compilerGlobalMetadata, ifindexVar.c_str());
+    } else {
+        builder->appendFormat("            .egress_port = %s,\n", ifindexVar.c_str());
+    }
+    emitInputMetadataField(builder, "packet_path", packetPathVar);
+    emitInputMetadataField(builder, "instance", pktInstanceVar);
+    emitInputMetadataField(builder, "parser_error", errorVar);
+    builder->append("        };");
     builder->newline();
     if (shouldEmitTimestamp()) {
         builder->emitIndent();
@@ -335,6 +914,8 @@ void EBPFEgressPipeline::emitPSAControlInputMetadata(CodeBuilder *builder) {
                               timestampVar.c_str());
         builder->endOfStatement(true);
     }
+    if (options.recirculateTailCall)
+        return;
     builder->emitIndent();
     builder->appendFormat("if (%s.egress_port == PSA_PORT_RECIRCULATE) ",
                           control->inputStandardMetadata->name.name);
@@ -364,9 +945,179 @@ void EBPFEgressPipeline::emitCPUMAPLookup(CodeBuilder *builder) {
     builder->endOfStatement(true);
 }
 
+void EBPFEgressPipeline::emitStageStateFields(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendFormat("struct psa_egress_output_metadata_t %s",
+                          control->outputStandardMetadata->name.name);
+    builder->endOfStatement(true);
+}
+
+void EBPFEgressPipeline::emitStageCPUMAPInitializer(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendLine("__builtin_memset(hdrMd, 0, sizeof(struct hdr_md));");
+}
+
+void EBPFEgressPipeline::emitStageMetadata(CodeBuilder *builder) {
+    emitPSAControlOutputMetadata(builder);
+    if (currentStage > 0) {
+        builder->emitIndent();
+        builder->appendFormat("%s = %s->%s;",
+                              control->outputStandardMetadata->name.name, stageStateVar,
+                              control->outputStandardMetadata->name.name);
+        builder->newline();
+    }
+    emitPSAControlInputMetadata(builder);
+    // bridged metadata is read only by the parser, which runs in the first stage
+    if (currentStage == 0 && bridgedMetadata != nullptr)
+        bridgedMetadata->emitLoad(builder);
+}
+
+void EBPFEgressPipeline::emitStageMetadataSave(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendFormat("%s->%s = %s;",
+                          stageStateVar, control->outputStandardMetadata->name.name,
+                          control->outputStandardMetadata->name.name);
+    builder->newline();
+}
+
+void EBPFEgressPipeline::emitStageTrafficManager(CodeBuilder *builder) {
+    this->emitTrafficManager(builder);
+}
+
+// Returns whether the statement only emits headers (packet_out.emit() calls).
+static bool onlyEmitsHeaders(const IR::StatOrDecl* s, P4::ReferenceMap* refMap,
+                             P4::TypeMap* typeMap) {
+    if (auto block = s->to<IR::BlockStatement>()) {
+        for (auto c : block->components) {
+            if (!onlyEmitsHeaders(c, refMap, typeMap))
+                return false;
+        }
+        return true;
+    }
+    auto mcs = s->to<IR::MethodCallStatement>();
+    if (mcs == nullptr)
+        return false;
+    auto mi = P4::MethodInstance::resolve(mcs, refMap, typeMap);
+    auto em = mi->to<P4::ExternMethod>();
+    return em != nullptr &&
+           em->method->name.name == P4::P4CoreLibrary::instance.packetOut.emit.name;
+}
+
+bool EBPFEgressPipeline::hasEmptyBlocks() const {
+    // headers are never valid if the parser extracts nothing, so emitting them does nothing
+    if (!control->controlBlock->container->body->components.empty() ||
+        !onlyEmitsHeaders(deparser->controlBlock->container->body, refMap, typeMap))
+        return false;
+    for (auto state : parser->parserBlock->container->states) {
+        if (state->name.name == IR::ParserState::accept ||
+            state->name.name == IR::ParserState::reject)
+            continue;
+        if (state->name.name != IR::ParserState::start || !state->components.empty())
+            return false;
+        auto next = state->selectExpression->to<IR::PathExpression>();
+        if (next == nullptr || next->path->name.name != IR::ParserState::accept)
+            return false;
+    }
+    return true;
+}
+
+void EBPFEgressPipeline::emitPassThrough(CodeBuilder *builder) {
+    builder->newline();
+    builder->target->emitCodeSection(builder, sectionName);
+    builder->emitIndent();
+    builder->target->emitMain(builder, functionName, model.CPacketName.str());
+    builder->spc();
+    builder->blockStart();
+    emitGlobalMetadataInitializer(builder);
+    builder->emitIndent();
+    if (options.recirculateTailCall) {
+        builder->appendFormat("if (%s->recirculating) ", compilerGlobalMetadata);
+        builder->blockStart();
+        builder->target->emitTraceMessage(builder, "EgressTM: recirculating packet");
+        emitRecirculateByTailCall(builder);
+        builder->blockEnd(true);
+        builder->emitIndent();
+        builder->appendFormat("return %s", forwardReturnCode());
+        builder->endOfStatement(true);
+        builder->blockEnd(true);
+        return;
+    }
+    builder->appendFormat("if (%s == PSA_PORT_RECIRCULATE) ", ifindexVar.c_str());
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder, "EgressTM: recirculating packet");
+    emitTrafficManagerCount(builder, "RECIRCULATE");
+    builder->emitIndent();
+    builder->appendFormat("%s->packet_path = RECIRCULATE", compilerGlobalMetadata);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->append("return bpf_redirect(PSA_PORT_RECIRCULATE, BPF_F_INGRESS)");
+    builder->endOfStatement(true);
+    builder->blockEnd(true);
+    builder->emitIndent();
+    builder->appendFormat("return %s", forwardReturnCode());
+    builder->endOfStatement(true);
+    builder->blockEnd(true);
+}
+
+/*
+ * A packet recirculated by tail calls is processed in a single run of programs: the stages
+ * of the Ingress pipeline, then for each recirculation a tail call to the Egress pipeline,
+ * its stages and a tail call back to the Ingress pipeline and its stages. After the last
+ * recirculation the Egress pipeline is tail called once more to drop the packet.
+ */
+void EBPFEgressPipeline::limitRecirculateDepth(const EBPFPipeline* ingress) {
+    unsigned ingressPrograms = std::max(ingress->stages.size(), size_t(1));
+    unsigned egressPrograms = std::max(stages.size(), size_t(1));
+    unsigned depth = (maxTailCalls - (ingressPrograms - 1) - egressPrograms) /
+                     (ingressPrograms + egressPrograms);
+    if (depth >= maxRecirculateDepth)
+        return;
+    ::warning(ErrorType::WARN_UNSUPPORTED,
+              "%1%: packets are recirculated at most %2% times, since the pipelines are split "
+              "into %3% and %4% programs chained by tail calls",
+              name, depth, ingressPrograms, egressPrograms);
+    maxRecirculateDepth = depth;
+}
+
+/*
+ * The number of recirculations is stored in skb->cb, which is preserved by tail calls.
+ * It is reset by the Ingress pipeline for packets which are not recirculated.
+ */
+void EBPFEgressPipeline::emitRecirculateByTailCall(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendFormat("if (%s->recirculate_depth >= %u) ",
+                          compilerGlobalMetadata, maxRecirculateDepth);
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder,
+        "EgressTM: maximum recirculation depth reached, dropping packet");
+    emitDropCount(builder, "RECIRCULATE_LIMIT");
+    builder->emitIndent();
+    builder->appendFormat("return %s;", dropReturnCode());
+    builder->newline();
+    builder->blockEnd(true);
+    builder->emitIndent();
+    builder->appendFormat("%s->recirculate_depth++;", compilerGlobalMetadata);
+    builder->newline();
+    builder->emitIndent();
+    builder->appendFormat("%s->packet_path = RECIRCULATE", compilerGlobalMetadata);
+    builder->endOfStatement(true);
+    emitTrafficManagerCount(builder, "RECIRCULATE");
+    emitRecirculateTailCall(builder, 0);
+}
+
 void EBPFEgressPipeline::emit(CodeBuilder *builder) {
     cstring msgStr, varStr;
 
+    if (passThrough) {
+        emitPassThrough(builder);
+        return;
+    }
+
+    if (isSplit()) {
+        emitStages(builder);
+        return;
+    }
+
     builder->newline();
     builder->target->emitCodeSection(builder, sectionName);
     builder->emitIndent();
@@ -391,6 +1142,8 @@ void EBPFEgressPipeline::emit(CodeBuilder *builder) {
 
     emitPSAControlOutputMetadata(builder);
     emitPSAControlInputMetadata(builder);
+    if (bridgedMetadata != nullptr)
+        bridgedMetadata->emitLoad(builder);
 
     msgStr = Util::printf_format("%s parser: parsing new packet, path=%%d, pkt_len=%%d",
                                  sectionName);
@@ -400,16 +1153,10 @@ void EBPFEgressPipeline::emit(CodeBuilder *builder) {
 
     // PARSER
     parser->emit(builder);
-    builder->emitIndent();
+    emitParserAccept(builder);
 
     // CONTROL
-    builder->append(IR::ParserState::accept);
-    builder->append(":");
-    builder->newline();
-    builder->emitIndent();
-    builder->appendFormat("%s.parser_error = %s",
-                          control->inputStandardMetadata->name.name, errorVar.c_str());
-    builder->endOfStatement(true);
+    emitLatencyRecord(builder, "PARSER");
     builder->newline();
     builder->emitIndent();
     builder->blockStart();
@@ -422,6 +1169,7 @@ void EBPFEgressPipeline::emit(CodeBuilder *builder) {
     msgStr = Util::printf_format("%s control: packet processing finished",
                                  sectionName);
     builder->target->emitTraceMessage(builder, msgStr.c_str());
+    emitLatencyRecord(builder, "CONTROL");
 
     // DEPARSER
     builder->emitIndent();
@@ -434,6 +1182,7 @@ void EBPFEgressPipeline::emit(CodeBuilder *builder) {
                                  sectionName);
     builder->target->emitTraceMessage(builder, msgStr.c_str());
     builder->blockEnd(true);
+    emitLatencyRecord(builder, "DEPARSER");
 
     this->emitTrafficManager(builder);
     builder->blockEnd(true);
@@ -452,6 +1201,19 @@ void TCIngressPipeline::emitGlobalMetadataInitializer(CodeBuilder *builder) {
     builder->emitIndent();
     emitTCWorkaroundUsingMeta(builder);
     builder->blockEnd(true);
+
+    if (options.recirculateTailCall) {
+        builder->emitIndent();
+        builder->appendFormat("if (%s->packet_path != RECIRCULATE) ", compilerGlobalMetadata);
+        builder->blockStart();
+        builder->emitIndent();
+        builder->appendFormat("%s->recirculate_depth = 0;", compilerGlobalMetadata);
+        builder->newline();
+        builder->blockEnd(true);
+        builder->emitIndent();
+        builder->appendFormat("%s->recirculating = 0;", compilerGlobalMetadata);
+        builder->newline();
+    }
 }
 
 void TCIngressPipeline::emitTCWorkaroundUsingMeta(CodeBuilder *builder) {
@@ -517,16 +1279,24 @@ void TCIngressPipeline::emitTrafficManager(CodeBuilder *builder) {
     builder->target->emitTraceMessage(builder,
         "IngressTM: Performing multicast, multicast_group=%u", 1, mcast_grp.c_str());
     builder->emitIndent();
-    builder->appendFormat("do_packet_clones(%s, &multicast_grp_tbl, %s, NORMAL_MULTICAST, 2)",
-                          contextVar.c_str(), mcast_grp.c_str());
+    builder->appendFormat("do_packet_clones(%s, &%s, %s, NORMAL_MULTICAST, 2)",
+                          contextVar.c_str(),
+                          builder->target->mapName("multicast_grp_tbl").c_str(),
+                          mcast_grp.c_str());
     builder->endOfStatement(true);
     // In multicast mode, unicast packet is not send
     builder->target->emitTraceMessage(builder, "IngressTM: Multicast done, dropping source packet");
+    emitLatencyRecord(builder, "TM");
     builder->emitIndent();
     builder->appendFormat("return %s", dropReturnCode());
     builder->endOfStatement(true);
     builder->blockEnd(true);
 
+    if (options.cpuPortPerfBuffer)
+        emitSendToCPUPort(builder);
+    if (options.recirculateTailCall)
+        emitSendToRecirculation(builder);
+
     builder->emitIndent();
     builder->appendFormat("skb->priority = %s.class_of_service;",
                           control->outputStandardMetadata->name.name);
@@ -538,24 +1308,92 @@ void TCIngressPipeline::emitTrafficManager(CodeBuilder *builder) {
                                       control->outputStandardMetadata->name.name);
     builder->target->emitTraceMessage(builder,
             "IngressTM: Sending packet out of port %d with priority %d", 2, eg_port, cos);
+    emitTrafficManagerCount(builder, "NORMAL_UNICAST");
+    emitLatencyRecord(builder, "TM");
     builder->emitIndent();
     builder->appendFormat("return bpf_redirect(%s.egress_port, 0)",
                           control->outputStandardMetadata->name.name);
     builder->endOfStatement(true);
 }
 
+/*
+ * Packets unicast to PSA_PORT_CPU are written to the cpu_port_packets perf event array,
+ * prepended with a struct cpu_port_packet, and dropped. They do not go through
+ * the Egress pipeline.
+ */
+void TCIngressPipeline::emitSendToCPUPort(CodeBuilder *builder) {
+    cstring ostd = control->outputStandardMetadata->name.name;
+    builder->emitIndent();
+    builder->appendFormat("if (%s.egress_port == P4C_PSA_PORT_CPU) ", ostd.c_str());
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendFormat("struct cpu_port_packet cpu_pkt = {\n"
+                          "            .ingress_port = %s,\n"
+                          "            .packet_length = %s->len,\n"
+                          "        };", ifindexVar.c_str(), contextVar.c_str());
+    builder->newline();
+    builder->emitIndent();
+    builder->appendFormat("if (bpf_perf_event_output(%s, &%s, "
+                          "BPF_F_CURRENT_CPU | ((u64) cpu_pkt.packet_length << 32), "
+                          "&cpu_pkt, sizeof(cpu_pkt)) < 0) ", contextVar.c_str(),
+                          builder->target->mapName("cpu_port_packets").c_str());
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder,
+        "IngressTM: CPU port buffer full, dropping packet");
+    emitDropCount(builder, "CPU_PORT_BUFFER_FULL");
+    builder->blockEnd(false);
+    builder->append(" else ");
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder, "IngressTM: Packet sent to the CPU port buffer");
+    emitTrafficManagerCount(builder, "CPU_PORT");
+    builder->blockEnd(true);
+    emitLatencyRecord(builder, "TM");
+    builder->emitIndent();
+    builder->appendFormat("return %s", dropReturnCode());
+    builder->endOfStatement(true);
+    builder->blockEnd(true);
+}
+
+/*
+ * There is no recirculation interface with --recirculate-tail-call, packets unicast
+ * to PSA_PORT_RECIRCULATE are passed to the Egress pipeline by a tail call.
+ * The Egress pipeline recirculates them back to the Ingress pipeline the same way.
+ */
+void TCIngressPipeline::emitSendToRecirculation(CodeBuilder *builder) {
+    builder->emitIndent();
+    builder->appendFormat("if (%s.egress_port == P4C_PSA_PORT_RECIRCULATE) ",
+                          control->outputStandardMetadata->name.name);
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder,
+        "IngressTM: Sending packet to the Egress pipeline for recirculation");
+    emitTrafficManagerCount(builder, "NORMAL_UNICAST");
+    emitLatencyRecord(builder, "TM");
+    builder->emitIndent();
+    builder->appendFormat("%s->recirculating = 1;", compilerGlobalMetadata);
+    builder->newline();
+    emitRecirculateTailCall(builder, 1);
+    builder->blockEnd(true);
+}
+
 // =====================TCEgressPipeline=============================
 void TCEgressPipeline::emitTrafficManager(CodeBuilder *builder) {
     cstring varStr;
+    if (options.recirculateTailCall) {
+        // copies created by clones are sent to ports, not recirculated
+        builder->emitIndent();
+        builder->appendFormat("%s->recirculating = 0;", compilerGlobalMetadata);
+        builder->newline();
+    }
     // clone support
     builder->emitIndent();
     builder->appendFormat("if (%s.clone) ", control->outputStandardMetadata->name.name);
     builder->blockStart();
 
     builder->emitIndent();
-    builder->appendFormat("do_packet_clones(%s, &clone_session_tbl, %s.clone_session_id, "
-                          "CLONE_E2E, 3)",
-                          contextVar.c_str(), control->outputStandardMetadata->name.name);
+    builder->appendFormat("do_packet_clones(%s, &%s, %s.clone_session_id, "
+                          "CLONE_E2E, 3)", contextVar.c_str(),
+                          builder->target->mapName("clone_session_tbl").c_str(),
+                          control->outputStandardMetadata->name.name);
     builder->endOfStatement(true);
     builder->blockEnd(true);
 
@@ -566,6 +1404,8 @@ void TCEgressPipeline::emitTrafficManager(CodeBuilder *builder) {
     builder->appendFormat("if (%s.drop) ", control->outputStandardMetadata->name.name);
     builder->blockStart();
     builder->target->emitTraceMessage(builder, "EgressTM: Packet dropped due to metadata");
+    emitDropCount(builder, "EGRESS_DROP");
+    emitLatencyRecord(builder, "TM");
     builder->emitIndent();
     builder->appendFormat("return %s;", dropReturnCode());
     builder->endOfStatement(true);
@@ -582,13 +1422,20 @@ void TCEgressPipeline::emitTrafficManager(CodeBuilder *builder) {
                           control->inputStandardMetadata->name.name);
     builder->blockStart();
     builder->target->emitTraceMessage(builder, "EgressTM: recirculating packet");
-    builder->emitIndent();
-    builder->appendFormat("%s->packet_path = RECIRCULATE", compilerGlobalMetadata);
-    builder->endOfStatement(true);
-    builder->emitIndent();
-    builder->appendFormat("return bpf_redirect(PSA_PORT_RECIRCULATE, BPF_F_INGRESS)",
-                          contextVar.c_str());
-    builder->endOfStatement(true);
+    if (options.recirculateTailCall) {
+        emitLatencyRecord(builder, "TM");
+        emitRecirculateByTailCall(builder);
+    } else {
+        emitTrafficManagerCount(builder, "RECIRCULATE");
+        emitLatencyRecord(builder, "TM");
+        builder->emitIndent();
+        builder->appendFormat("%s->packet_path = RECIRCULATE", compilerGlobalMetadata);
+        builder->endOfStatement(true);
+        builder->emitIndent();
+        builder->appendFormat("return bpf_redirect(PSA_PORT_RECIRCULATE, BPF_F_INGRESS)",
+                              contextVar.c_str());
+        builder->endOfStatement(true);
+    }
     builder->blockEnd(true);
 
     builder->newline();
@@ -597,6 +1444,7 @@ void TCEgressPipeline::emitTrafficManager(CodeBuilder *builder) {
     varStr = Util::printf_format("%s->ifindex", contextVar);
     builder->target->emitTraceMessage(builder, "EgressTM: output packet to port %d",
                                       1, varStr.c_str());
+    emitLatencyRecord(builder, "TM");
     builder->emitIndent();
 
     builder->newline();
@@ -20,10 +20,24 @@ limitations under the License.
 #include "ebpfPsaControl.h"
 #include "backends/ebpf/ebpfProgram.h"
 #include "ebpfPsaDeparser.h"
+#include "ebpfPsaFlowCache.h"
 #include "backends/ebpf/target.h"
 
 namespace EBPF {
 
+/*
+ * PipelineStage is a part of a pipeline emitted as a separate eBPF program,
+ * if the pipeline is too big to be verified as a single program.
+ * Stages are chained by tail calls and keep their state in the per-CPU map hdr_md_cpumap.
+ */
+struct PipelineStage {
+    bool withParser = false;
+    // range [firstStatement, lastStatement) of the top-level statements of the control block
+    size_t firstStatement = 0;
+    size_t lastStatement = 0;
+    bool withDeparser = false;
+};
+
 /*
  * EBPFPipeline represents a single eBPF program in the TC/XDP hook.
  */
@@ -37,12 +51,18 @@ class EBPFPipeline : public EBPFProgram {
     cstring contextVar;
     // Variable name storing current timestamp retrieved from bpf_ktime_get_ns().
     cstring timestampVar;
+    // Variable storing the time a sampled packet entered the current block, 0 if the
+    // packet is not sampled (--latency-histograms).
+    cstring latencyVar;
     // Variable storing ingress interface index.
     cstring ifindexVar;
     // Variable storing skb->priority value (TC only).
     cstring priorityVar;
     // Variables storing global metadata (packet_path & instance).
     cstring packetPathVar, pktInstanceVar;
+    // Fields of the input standard metadata read by the parser or the control block;
+    // other fields are not initialized.
+    std::set<cstring> usedInputMetadata;
     // A name of an internal variable storing global metadata.
     cstring compilerGlobalMetadata;
     // A variable name storing "1" value. Used to access BPF array map index.
@@ -50,11 +70,23 @@ class EBPFPipeline : public EBPFProgram {
 
     EBPFControlPSA* control;
     EBPFDeparserPSA* deparser;
+    // Metadata bridged from the Ingress deparser to the Egress parser, nullptr if none.
+    EBPFBridgedMetadataPSA* bridgedMetadata = nullptr;
+
+    // Stages (programs) the pipeline is split into, empty if the pipeline is a single program.
+    std::vector<PipelineStage> stages;
+    // Maximum number of tail calls in a single run of programs (MAX_TAIL_CALL_CNT).
+    static const unsigned maxTailCalls = 33;
+    // Upper bound on the number of stages, keeps the number of tail calls
+    // of a resubmitted packet below the kernel limit.
+    static const unsigned maxStages = 8;
+    // A variable name storing pointer to the state of a split pipeline.
+    cstring stageStateVar;
 
     EBPFPipeline(cstring name, const EbpfOptions& options, P4::ReferenceMap* refMap,
                  P4::TypeMap* typeMap)
                  : EBPFProgram(options, nullptr, refMap, typeMap, nullptr),
-                 name(name), control(nullptr), deparser(nullptr) {
+                 name(name), control(nullptr), deparser(nullptr), currentStage(0) {
         sectionName = "classifier/" + name;
         functionName = name.replace("-", "_") + "_func";
         errorEnum = "ParserError_t";
@@ -63,12 +95,14 @@ class EBPFPipeline : public EBPFProgram {
         lengthVar = cstring("pkt_len");
         endLabel = cstring("deparser");
         timestampVar = cstring("tstamp");
+        latencyVar = cstring("latency_tstamp");
         ifindexVar = cstring("skb->ifindex");
         compilerGlobalMetadata = cstring("compiler_meta__");
         packetPathVar = compilerGlobalMetadata + cstring("->packet_path");
         pktInstanceVar = compilerGlobalMetadata + cstring("->instance");
         priorityVar = cstring("skb->priority");
         oneKey = EBPFModel::reserved("one");
+        stageStateVar = cstring("stage_state");
     }
 
     virtual cstring dropReturnCode() {
@@ -107,6 +141,15 @@ class EBPFPipeline : public EBPFProgram {
      * allocated in the per-CPU map. */
     void emitUserMetadataInstance(CodeBuilder *builder);
 
+    /* Reasons of drops counted in the drop_stats map (--emit-stats). The code of a reason
+     * is its index, so new reasons are only appended. */
+    static const std::vector<cstring>& dropReasons();
+    void emitDropCount(CodeBuilder* builder, cstring reason) const override;
+    /* Counters of the Traffic Manager in the tm_stats map (--emit-stats), the first ones
+     * are indexed by PSA_PacketPath_t values. */
+    static const std::vector<cstring>& trafficManagerCounters();
+    void emitTrafficManagerCount(CodeBuilder* builder, cstring counter) const;
+
     virtual void emitCPUMAPInitializers(CodeBuilder *builder);
     virtual void emitCPUMAPLookup(CodeBuilder *builder);
     /* Generates a pointer to skb->cb and maps it to
@@ -114,10 +157,36 @@ class EBPFPipeline : public EBPFProgram {
     virtual void emitGlobalMetadataInitializer(CodeBuilder *builder);
     virtual void emitPacketLength(CodeBuilder *builder);
     virtual void emitTimestamp(CodeBuilder *builder);
+    /* Generates a designated initializer of a field of the input standard metadata, if used. */
+    void emitInputMetadataField(CodeBuilder *builder, cstring field, cstring value) const;
+    /* Generates the accept label of the parser followed by the parser_error assignment, if used. */
+    void emitParserAccept(CodeBuilder *builder) const;
 
     void emitHeadersFromCPUMAP(CodeBuilder* builder);
     void emitMetadataFromCPUMAP(CodeBuilder *builder);
 
+    /*
+     * Splits the pipeline into stages if its estimated size exceeds maxInstructions.
+     * Cut points are placed between the parser, the top-level statements of the control block
+     * and the deparser.
+     */
+    void splitIntoStages(unsigned maxInstructions);
+    bool isSplit() const { return !stages.empty(); }
+    cstring stageStateName() const { return name.replace("-", "_") + "_state"; }
+    cstring progArrayName() const { return name.replace("-", "_") + "_progs"; }
+    cstring stageSectionName(unsigned stage) const;
+    cstring stageFunctionName(unsigned stage) const;
+    /* Generates a type of the state passed between stages, stored in struct hdr_md. */
+    void emitStageStateType(CodeBuilder *builder);
+    /* Generates a program array used to tail call stages. */
+    void emitProgArray(CodeBuilder *builder);
+    /* Generates a tail call to the given stage. */
+    void emitTailCall(CodeBuilder *builder, unsigned stage) const;
+    /* Generates a tail call to the first program of the Ingress (index 0) or Egress (index 1)
+     * pipeline through the recirculate_progs array (--recirculate-tail-call),
+     * the packet is dropped if the tail call fails. */
+    void emitRecirculateTailCall(CodeBuilder *builder, unsigned index) const;
+
     /*
      * Returns whether the compiler should generate
      * timestamp retrieved by bpf_ktime_get_ns().
@@ -126,8 +195,36 @@ class EBPFPipeline : public EBPFProgram {
      * if the timestamp field is not used within a pipeline.
      */
     bool shouldEmitTimestamp() const {
-        return control->timestampIsUsed;
+        return isInputMetadataUsed("ingress_timestamp") ||
+               isInputMetadataUsed("egress_timestamp");
     }
+    bool isInputMetadataUsed(cstring field) const {
+        return usedInputMetadata.count(field) != 0;
+    }
+    bool shouldEmitLatency() const { return options.latencySampling > 0; }
+    /* Starts measuring the latency of a sampled packet. */
+    void emitLatencyStart(CodeBuilder *builder);
+    /* Records the time spent in a block (PARSER, CONTROL, DEPARSER or TM) in its histogram. */
+    void emitLatencyRecord(CodeBuilder *builder, cstring block);
+
+ protected:
+    // stage being generated, 0 if the pipeline is not split
+    unsigned currentStage;
+
+    /* Returns whether a local variable of the control block is kept in the stage state. */
+    bool isStageLocal(const IR::Declaration* decl) const;
+    /* Generates all stages of a split pipeline. */
+    void emitStages(CodeBuilder *builder);
+    void emitStage(CodeBuilder *builder, unsigned stage);
+    /* Generates fields of the stage state specific to the pipeline. */
+    virtual void emitStageStateFields(CodeBuilder *builder) = 0;
+    /* Initializes the per-CPU map at the beginning of the first stage. */
+    virtual void emitStageCPUMAPInitializer(CodeBuilder *builder) = 0;
+    /* Generates the standard metadata of the control block for a stage. */
+    virtual void emitStageMetadata(CodeBuilder *builder) = 0;
+    /* Saves the standard metadata before tail calling the next stage. */
+    virtual void emitStageMetadataSave(CodeBuilder *builder) = 0;
+    virtual void emitStageTrafficManager(CodeBuilder *builder) = 0;
 };
 
 /*
@@ -140,6 +237,8 @@ class EBPFIngressPipeline : public EBPFPipeline {
     // actUnspecCode stores the "undefined action" value.
     // It's returned from eBPF program is PSA-eBPF doesn't make any forwarding/drop decision.
     int actUnspecCode;
+    // Cache of decisions of the control block, nullptr if disabled.
+    EBPFFlowCachePSA* flowCache = nullptr;
 
     EBPFIngressPipeline(cstring name, const EbpfOptions& options, P4::ReferenceMap* refMap,
                         P4::TypeMap* typeMap) : EBPFPipeline(name, options, refMap, typeMap) {
@@ -155,6 +254,13 @@ class EBPFIngressPipeline : public EBPFPipeline {
     void emit(CodeBuilder *builder) override;
     void emitPSAControlInputMetadata(CodeBuilder* builder) override;
     void emitPSAControlOutputMetadata(CodeBuilder* builder) override;
+
+ protected:
+    void emitStageStateFields(CodeBuilder *builder) override;
+    void emitStageCPUMAPInitializer(CodeBuilder *builder) override;
+    void emitStageMetadata(CodeBuilder *builder) override;
+    void emitStageMetadataSave(CodeBuilder *builder) override;
+    void emitStageTrafficManager(CodeBuilder *builder) override;
 };
 
 /*
@@ -163,13 +269,41 @@ class EBPFIngressPipeline : public EBPFPipeline {
  */
 class EBPFEgressPipeline : public EBPFPipeline {
  public:
+    // Set if the Egress pipeline cannot modify packets, see hasEmptyBlocks().
+    // Only recirculation is handled then, other packets are sent out unchanged.
+    bool passThrough = false;
+    // Maximum number of recirculations of a packet (--recirculate-tail-call),
+    // lowered for split pipelines by limitRecirculateDepth().
+    static const unsigned defaultRecirculateDepth = 4;
+    unsigned int maxRecirculateDepth = defaultRecirculateDepth;
+
     EBPFEgressPipeline(cstring name, const EbpfOptions& options, P4::ReferenceMap* refMap,
-                       P4::TypeMap* typeMap) : EBPFPipeline(name, options, refMap, typeMap) { }
+                       P4::TypeMap* typeMap) : EBPFPipeline(name, options, refMap, typeMap) {}
+
+    /* Lowers maxRecirculateDepth, so that tail calls of a packet recirculated through
+     * the stages of both pipelines stay below the kernel limit. */
+    void limitRecirculateDepth(const EBPFPipeline* ingress);
+
+    /* Returns whether the parser only accepts the packet, the control block
+     * has no statements and the deparser only emits headers. */
+    bool hasEmptyBlocks() const;
 
     void emit(CodeBuilder* builder) override;
     void emitPSAControlInputMetadata(CodeBuilder* builder) override;
     void emitPSAControlOutputMetadata(CodeBuilder* builder) override;
     void emitCPUMAPLookup(CodeBuilder *builder) override;
+
+ protected:
+    void emitStageStateFields(CodeBuilder *builder) override;
+    void emitStageCPUMAPInitializer(CodeBuilder *builder) override;
+    void emitStageMetadata(CodeBuilder *builder) override;
+    void emitStageMetadataSave(CodeBuilder *builder) override;
+    void emitStageTrafficManager(CodeBuilder *builder) override;
+    /* Generates a program which only redirects recirculated packets to the Ingress pipeline. */
+    virtual void emitPassThrough(CodeBuilder *builder);
+    /* Recirculates a packet by a tail call to the Ingress pipeline, unless it has already
+     * been recirculated maxRecirculateDepth times. */
+    void emitRecirculateByTailCall(CodeBuilder *builder);
 };
 
 class TCIngressPipeline : public EBPFIngressPipeline {
@@ -181,6 +315,8 @@ class TCIngressPipeline : public EBPFIngressPipeline {
     void emitGlobalMetadataInitializer(CodeBuilder *builder) override;
     void emitTrafficManager(CodeBuilder *builder) override;
  private:
+    void emitSendToCPUPort(CodeBuilder *builder);
+    void emitSendToRecirculation(CodeBuilder *builder);
     void emitTCWorkaroundUsingMeta(CodeBuilder *builder);
     void emitTCWorkaroundUsingHead(CodeBuilder *builder);
     void emitTCWorkaroundUsingCPUMAP(CodeBuilder *builder);
@@ -0,0 +1,334 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ebpfPsaControl.h"
+#include "backends/ebpf/ebpfCostModel.h"
+#include "frontends/p4/methodInstance.h"
+
+namespace EBPF {
+
+namespace {
+
+/* Collects apply() calls of each table. */
+class TableApplyCollector : public Inspector {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+
+ public:
+    std::map<cstring, std::vector<const P4::ApplyMethod*>> applies;
+
+    TableApplyCollector(P4::ReferenceMap* refMap, P4::TypeMap* typeMap) :
+            refMap(refMap), typeMap(typeMap) { setName("TableApplyCollector"); }
+
+    bool preorder(const IR::MethodCallExpression* expression) override {
+        auto mi = P4::MethodInstance::resolve(expression, refMap, typeMap);
+        auto apply = mi->to<P4::ApplyMethod>();
+        if (apply != nullptr && apply->isTableApply())
+            applies[apply->object->getName().name].push_back(apply);
+        return true;
+    }
+};
+
+/*
+ * Checks whether code can be moved to a table subprogram: it may only refer to parameters
+ * (of the control block or of actions) and local variables. Local variables of the control
+ * block are collected, they can be used only if no other code refers to them.
+ */
+class TableSubprogramChecker : public Inspector {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    const IR::P4Control* control;
+
+ public:
+    bool supported = true;
+    std::set<const IR::IDeclaration*> controlLocals;
+
+    TableSubprogramChecker(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+                           const IR::P4Control* control) :
+            refMap(refMap), typeMap(typeMap), control(control) {
+        setName("TableSubprogramChecker");
+    }
+
+    bool preorder(const IR::PathExpression* expression) override {
+        auto decl = refMap->getDeclaration(expression->path, true);
+        if (decl->is<IR::Parameter>())
+            return false;
+        if (decl->is<IR::Declaration_Variable>()) {
+            for (auto local : control->controlLocals) {
+                if (local == decl)
+                    controlLocals.insert(decl);
+            }
+            return false;
+        }
+        LOG3("Unsupported reference to " << decl);
+        supported = false;
+        return false;
+    }
+
+    bool preorder(const IR::MethodCallExpression* expression) override {
+        auto mi = P4::MethodInstance::resolve(expression, refMap, typeMap);
+        if (mi->is<P4::BuiltInMethod>())
+            return true;
+        if (auto ac = mi->to<P4::ActionCall>()) {
+            visit(expression->arguments);
+            visit(ac->action->body);
+            return false;
+        }
+        // externs may use variables of the BPF program (e.g. packet length)
+        LOG3("Unsupported call " << expression);
+        supported = false;
+        return false;
+    }
+
+    bool preorder(const IR::ExitStatement*) override {
+        supported = false;
+        return false;
+    }
+
+    bool preorder(const IR::ReturnStatement*) override {
+        supported = false;
+        return false;
+    }
+};
+
+cstring structName(P4::TypeMap* typeMap, const IR::Parameter* param) {
+    auto type = typeMap->getTypeType(param->type, true)->to<IR::Type_StructLike>();
+    BUG_CHECK(type != nullptr, "%1%: expected a struct type", param);
+    return type->name.name;
+}
+
+}  // namespace
+
+ControlBodyTranslatorPSA::ControlBodyTranslatorPSA(const EBPFControlPSA* control) :
+        CodeGenInspector(control->program->refMap, control->program->typeMap),
+        ControlBodyTranslator(control) {
+    setName("ControlBodyTranslatorPSA");
+}
+
+void ControlBodyTranslatorPSA::processApply(const P4::ApplyMethod* method) {
+    auto psaControl = dynamic_cast<const EBPFControlPSA*>(control);
+    CHECK_NULL(psaControl);
+    cstring tableName = method->object->getName().name;
+    if (inTableSubprogram || !psaControl->isTableSubprogram(tableName)) {
+        ControlBodyTranslator::processApply(method);
+        return;
+    }
+
+    cstring actionVariableName;
+    if (!saveAction.empty())
+        actionVariableName = saveAction.at(saveAction.size() - 1);
+
+    builder->emitIndent();
+    if (!actionVariableName.isNullOrEmpty()) {
+        builder->appendFormat("unsigned int %s = 0;\n", actionVariableName.c_str());
+        builder->emitIndent();
+    }
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendLine("struct table_apply_result apply_result;");
+    builder->emitIndent();
+    builder->appendFormat("int apply_ret = %s(", psaControl->tableSubprogramName(tableName));
+    builder->append(control->parserHeaders->name.name);
+    for (auto param : {psaControl->user_metadata, psaControl->inputStandardMetadata,
+                       psaControl->outputStandardMetadata}) {
+        builder->append(", ");
+        if (!isPointerVariable(param->name.name))
+            builder->append("&");
+        builder->append(param->name.name);
+    }
+    builder->append(", &apply_result)");
+    builder->endOfStatement(true);
+    // a return code of the program is returned if the packet should be dropped
+    builder->emitIndent();
+    builder->append("if (apply_ret >= 0)");
+    builder->newline();
+    builder->increaseIndent();
+    builder->emitIndent();
+    builder->append("return apply_ret");
+    builder->endOfStatement(true);
+    builder->decreaseIndent();
+    builder->emitIndent();
+    builder->appendFormat("%s = apply_result.hit", control->hitVariable.c_str());
+    builder->endOfStatement(true);
+    if (!actionVariableName.isNullOrEmpty()) {
+        builder->emitIndent();
+        builder->appendFormat("%s = apply_result.action_run", actionVariableName.c_str());
+        builder->endOfStatement(true);
+    }
+    builder->blockEnd(true);
+}
+
+void ControlBodyTranslatorPSA::processMethod(const P4::ExternMethod* method) {
+    auto declType = method->originalExternType;
+    if (declType->name.name == PacketSampler_Model::instance.name) {
+        auto psaControl = dynamic_cast<const EBPFControlPSA*>(control);
+        CHECK_NULL(psaControl);
+        cstring name = EBPFObject::externalName(method->object);
+        psaControl->getSampler(name)->emitMethodInvocation(builder, method);
+        return;
+    }
+    ControlBodyTranslator::processMethod(method);
+}
+
+void ControlBodyTranslatorPSA::emitTableSubprogramBody(const P4::ApplyMethod* method,
+                                                       cstring actionRunVariable) {
+    inTableSubprogram = true;
+    saveAction.push_back(actionRunVariable);
+    method->expr->apply(*this);
+    saveAction.pop_back();
+    inTableSubprogram = false;
+}
+
+void EBPFControlPSA::chooseTableSubprograms() {
+    auto refMap = program->refMap;
+    auto typeMap = program->typeMap;
+    auto p4Control = controlBlock->container;
+
+    TableApplyCollector collector(refMap, typeMap);
+    p4Control->body->apply(collector);
+
+    // local variables used by the control body (outside of tables) and by each table
+    TableSubprogramChecker bodyChecker(refMap, typeMap, p4Control);
+    p4Control->body->apply(bodyChecker);
+    std::map<cstring, TableSubprogramChecker*> checkers;
+    for (auto it : collector.applies) {
+        auto table = it.second.front()->object->to<IR::P4Table>();
+        auto checker = new TableSubprogramChecker(refMap, typeMap, p4Control);
+        if (table->getKey() != nullptr) {
+            for (auto ke : table->getKey()->keyElements)
+                ke->expression->apply(*checker);
+        }
+        for (auto ale : table->getActionList()->actionList) {
+            auto action = refMap->getDeclaration(ale->getPath(), true)->to<IR::P4Action>();
+            if (action != nullptr)
+                action->body->apply(*checker);
+        }
+        checkers.emplace(it.first, checker);
+    }
+
+    InstructionEstimator estimator(refMap, typeMap);
+    for (auto it : collector.applies) {
+        auto apply = it.second.front();
+        if (it.second.size() < 2 &&
+            estimator.estimate(apply->expr) < subprogramMinInstructions)
+            continue;
+
+        auto checker = checkers.at(it.first);
+        bool supported = checker->supported;
+        for (auto local : checker->controlLocals) {
+            bool shared = bodyChecker.controlLocals.count(local) > 0;
+            for (auto other : checkers) {
+                if (other.first != it.first && other.second->controlLocals.count(local) > 0)
+                    shared = true;
+            }
+            if (shared) {
+                LOG2("Local variable " << local->getName() << " used outside of table "
+                     << it.first);
+                supported = false;
+            }
+        }
+        if (!supported) {
+            LOG2("Table " << it.first << " cannot be applied in a subprogram");
+            continue;
+        }
+        LOG2("Table " << it.first << " will be applied in a subprogram");
+        tableSubprograms.emplace(it.first, apply);
+        // keep the order of declarations
+        auto& locals = tableSubprogramLocals[it.first];
+        for (auto local : p4Control->controlLocals) {
+            if (checker->controlLocals.count(local) > 0)
+                locals.push_back(local);
+        }
+    }
+}
+
+void EBPFControlPSA::emitTableInstances(CodeBuilder* builder) {
+    EBPFControl::emitTableInstances(builder);
+    for (auto it : samplers)
+        it.second->emitInstance(builder);
+}
+
+cstring EBPFControlPSA::tableSubprogramName(cstring table) const {
+    return getTable(table)->instanceName + "_apply";
+}
+
+void EBPFControlPSA::emitTableSubprograms(CodeBuilder* builder) {
+    auto translator = dynamic_cast<ControlBodyTranslatorPSA*>(codeGen);
+    CHECK_NULL(translator);
+    auto typeMap = program->typeMap;
+
+    for (auto it : tableSubprograms) {
+        builder->appendLine("static __noinline");
+        builder->appendFormat("int %s(", tableSubprogramName(it.first));
+        builder->appendFormat("struct %s *%s", structName(typeMap, headers),
+                              parserHeaders->name.name);
+        // standard metadata passed by value to the control block are passed by pointer
+        std::vector<const IR::Parameter*> copied;
+        for (auto param : {user_metadata, inputStandardMetadata, outputStandardMetadata}) {
+            builder->appendFormat(", struct %s *%s", structName(typeMap, param),
+                                  param->name.name);
+            if (!codeGen->isPointerVariable(param->name.name)) {
+                builder->append("_ptr");
+                copied.push_back(param);
+            }
+        }
+        builder->append(", struct table_apply_result *apply_result)");
+        builder->newline();
+        builder->blockStart();
+
+        builder->emitIndent();
+        builder->appendFormat("u32 %s = 0", program->zeroKey.c_str());
+        builder->endOfStatement(true);
+        for (auto param : copied) {
+            builder->emitIndent();
+            builder->appendFormat("struct %s %s = *%s_ptr", structName(typeMap, param),
+                                  param->name.name, param->name.name);
+            builder->endOfStatement(true);
+        }
+        auto hitType = EBPFTypeFactory::instance->create(IR::Type_Boolean::get());
+        builder->emitIndent();
+        hitType->declare(builder, hitVariable, false);
+        builder->append(" = 0");
+        builder->endOfStatement(true);
+        for (auto local : tableSubprogramLocals[it.first])
+            emitDeclaration(builder, local);
+
+        cstring actionRunVariable = program->refMap->newName("action_run");
+        codeGen->setBuilder(builder);
+        translator->emitTableSubprogramBody(it.second, actionRunVariable);
+
+        builder->emitIndent();
+        builder->appendFormat("apply_result->hit = %s", hitVariable.c_str());
+        builder->endOfStatement(true);
+        builder->emitIndent();
+        builder->appendFormat("apply_result->action_run = %s", actionRunVariable.c_str());
+        builder->endOfStatement(true);
+        if (!codeGen->isPointerVariable(outputStandardMetadata->name.name)) {
+            builder->emitIndent();
+            builder->appendFormat("*%s_ptr = %s", outputStandardMetadata->name.name,
+                                  outputStandardMetadata->name.name);
+            builder->endOfStatement(true);
+        }
+        builder->emitIndent();
+        builder->append("return -1");
+        builder->endOfStatement(true);
+        builder->blockEnd(true);
+        builder->newline();
+    }
+}
+
+}  // namespace EBPF
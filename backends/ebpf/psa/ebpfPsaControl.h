@@ -18,24 +18,60 @@ limitations under the License.
 #define BACKENDS_EBPF_PSA_EBPFPSACONTROL_H_
 
 #include "ebpfPsaTable.h"
+#include "ebpfPsaPacketSampler.h"
 #include "backends/ebpf/ebpfControl.h"
 
 namespace EBPF {
 
 class EBPFControlPSA;
 
-class EBPFControlPSA : public EBPFControl {
+class ControlBodyTranslatorPSA : public ControlBodyTranslator {
+    // set while generating the body of a table subprogram
+    bool inTableSubprogram = false;
+
  public:
-    // Keeps track if ingress_timestamp or egress_timestamp is used within a control block.
-    bool timestampIsUsed = false;
+    explicit ControlBodyTranslatorPSA(const EBPFControlPSA* control);
 
+    void processApply(const P4::ApplyMethod* method) override;
+    void processMethod(const P4::ExternMethod* method) override;
+    void emitTableSubprogramBody(const P4::ApplyMethod* method, cstring actionRunVariable);
+};
+
+class EBPFControlPSA : public EBPFControl {
+ public:
     const IR::Parameter* user_metadata;
     const IR::Parameter* inputStandardMetadata;
     const IR::Parameter* outputStandardMetadata;
 
+    // Tables applied by a call to a __noinline BPF subprogram instead of inlined code,
+    // mapped to an apply() call used to generate the subprogram.
+    std::map<cstring, const P4::ApplyMethod*> tableSubprograms;
+    // Local variables of the control block used only by actions of a table subprogram,
+    // they are declared within the subprogram.
+    std::map<cstring, std::vector<const IR::Declaration*>> tableSubprogramLocals;
+    std::map<cstring, EBPFPacketSamplerPSA*> samplers;
+    // Minimal estimated size of a table applied once to generate it as a subprogram.
+    static const unsigned subprogramMinInstructions = 128;
+
     EBPFControlPSA(const EBPFProgram* program, const IR::ControlBlock* control,
                    const IR::Parameter* parserHeaders) :
         EBPFControl(program, control, parserHeaders) {}
+
+    /*
+     * Selects tables that are generated as subprograms: tables applied more than once
+     * or big enough, whose key and actions only use headers, metadata, standard metadata
+     * and local variables not used outside of the table.
+     */
+    void chooseTableSubprograms();
+    bool isTableSubprogram(cstring table) const { return tableSubprograms.count(table) > 0; }
+    cstring tableSubprogramName(cstring table) const;
+    void emitTableSubprograms(CodeBuilder* builder);
+
+    void emitTableInstances(CodeBuilder* builder) override;
+    EBPFPacketSamplerPSA* getSampler(cstring name) const {
+        auto result = ::get(samplers, name);
+        BUG_CHECK(result != nullptr, "No packet sampler named %1%", name);
+        return result; }
 };
 
 }  // namespace EBPF
@@ -19,6 +19,135 @@ limitations under the License.
 
 namespace EBPF {
 
+// =====================EBPFBridgedMetadataPSA=============================
+EBPFBridgedMetadataPSA::EBPFBridgedMetadataPSA(const EBPFProgram* program,
+                                               const IR::Parameter* parameter) :
+        program(program), parameter(parameter) {
+    auto type = program->typeMap->getType(parameter, true)->to<IR::Type_Struct>();
+    if (type == nullptr) {
+        ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                "%1%: bridged metadata must be a structure", parameter);
+        return;
+    }
+    for (auto f : type->fields) {
+        auto ftype = program->typeMap->getType(f, true);
+        auto etype = EBPFTypeFactory::instance->create(ftype);
+        if (!etype->is<EBPFScalarType>() && !etype->is<EBPFBoolType>()) {
+            ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                    "%1%: only bit<> and bool fields of bridged metadata are supported", f);
+            return;
+        }
+        unsigned fieldSize = etype->to<IHasWidth>()->implementationWidthInBits() / 8;
+        fields.push_back({f->name.name, size, fieldSize});
+        size += fieldSize;
+    }
+    // the length is stored in a single byte of psa_global_metadata
+    if (size > 255) {
+        ::error(ErrorType::ERR_UNSUPPORTED_ON_TARGET,
+                "%1%: bridged metadata larger than 255 bytes", parameter);
+    }
+}
+
+void EBPFBridgedMetadataPSA::emitDeclaration(CodeBuilder* builder) const {
+    auto type = EBPFTypeFactory::instance->create(parameter->type);
+    builder->emitIndent();
+    type->declare(builder, parameter->name.name, false);
+    builder->append(" = {}");
+    builder->endOfStatement(true);
+}
+
+void EBPFBridgedMetadataPSA::emitStore(CodeBuilder* builder) const {
+    auto pipeline = dynamic_cast<const EBPFPipeline*>(program);
+    CHECK_NULL(pipeline);
+    for (auto& f : fields) {
+        builder->emitIndent();
+        builder->appendFormat("__builtin_memcpy(&%s->bridged_metadata[%u], &%s.%s, %u)",
+                              pipeline->compilerGlobalMetadata, f.offset,
+                              parameter->name.name, f.name, f.size);
+        builder->endOfStatement(true);
+    }
+    builder->emitIndent();
+    builder->appendFormat("%s->bridged_metadata_len = %u",
+                          pipeline->compilerGlobalMetadata, size);
+    builder->endOfStatement(true);
+}
+
+void EBPFBridgedMetadataPSA::emitStoreInPacket(CodeBuilder* builder) const {
+    auto pipeline = dynamic_cast<const EBPFPipeline*>(program);
+    CHECK_NULL(pipeline);
+    builder->emitIndent();
+    builder->appendFormat("if (%s < %s + BYTES(%s + %u)) ",
+                          program->packetEndVar, program->packetStartVar,
+                          program->offsetVar, size * 8);
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder, "Deparser: invalid packet (packet too short)");
+    program->emitDropCount(builder, "DEPARSER_PACKET_TOO_SHORT");
+    builder->emitIndent();
+    builder->appendFormat("return %s;", builder->target->abortReturnCode());
+    builder->newline();
+    builder->blockEnd(true);
+    for (auto& f : fields) {
+        builder->emitIndent();
+        builder->appendFormat("__builtin_memcpy(%s + BYTES(%s) + %u, &%s.%s, %u)",
+                              program->packetStartVar, program->offsetVar, f.offset,
+                              parameter->name.name, f.name, f.size);
+        builder->endOfStatement(true);
+    }
+    builder->emitIndent();
+    builder->appendFormat("%s += %u", program->offsetVar, size * 8);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("%s->bridged_metadata_len = %u",
+                          pipeline->compilerGlobalMetadata, size);
+    builder->endOfStatement(true);
+}
+
+void EBPFBridgedMetadataPSA::emitLoad(CodeBuilder* builder) const {
+    auto pipeline = dynamic_cast<const EBPFPipeline*>(program);
+    CHECK_NULL(pipeline);
+    emitDeclaration(builder);
+    builder->emitIndent();
+    builder->appendFormat("if (%s->bridged_metadata_len == %u) ",
+                          pipeline->compilerGlobalMetadata, size);
+    builder->blockStart();
+    if (isInPacket()) {
+        builder->emitIndent();
+        builder->appendFormat("if (%s < %s + %u) ",
+                              program->packetEndVar, program->packetStartVar, size);
+        builder->blockStart();
+        builder->target->emitTraceMessage(builder,
+                                          "EgressParser: bridged metadata missing, dropping");
+        program->emitDropCount(builder, "BRIDGED_METADATA_MISSING");
+        builder->emitIndent();
+        builder->appendFormat("return %s;", builder->target->abortReturnCode());
+        builder->newline();
+        builder->blockEnd(true);
+    }
+    for (auto& f : fields) {
+        builder->emitIndent();
+        if (isInPacket()) {
+            builder->appendFormat("__builtin_memcpy(&%s.%s, %s + %u, %u)",
+                                  parameter->name.name, f.name,
+                                  program->packetStartVar, f.offset, f.size);
+        } else {
+            builder->appendFormat("__builtin_memcpy(&%s.%s, &%s->bridged_metadata[%u], %u)",
+                                  parameter->name.name, f.name,
+                                  pipeline->compilerGlobalMetadata, f.offset, f.size);
+        }
+        builder->endOfStatement(true);
+    }
+    if (isInPacket()) {
+        // the parser starts after the bridged metadata, the deparser removes it
+        builder->emitIndent();
+        builder->appendFormat("%s = %u", program->offsetVar, size * 8);
+        builder->endOfStatement(true);
+    }
+    builder->emitIndent();
+    builder->appendFormat("%s->bridged_metadata_len = 0", pipeline->compilerGlobalMetadata);
+    builder->endOfStatement(true);
+    builder->blockEnd(true);
+}
+
 DeparserBodyTranslatorPSA::DeparserBodyTranslatorPSA(const EBPFDeparserPSA *deparser) :
         CodeGenInspector(deparser->program->refMap, deparser->program->typeMap),
         DeparserBodyTranslator(deparser) {
@@ -53,6 +182,7 @@ bool IngressDeparserPSA::build() {
     headers = *(it + 4);
     user_metadata = *(it + 5);
     resubmit_meta = *(it + 2);
+    normal_meta = *(it + 3);
 
     auto ht = program->typeMap->getType(headers);
     if (ht == nullptr) {
@@ -63,12 +193,49 @@ bool IngressDeparserPSA::build() {
     return true;
 }
 
+void IngressDeparserPSA::emit(CodeBuilder* builder) {
+    auto pipeline = dynamic_cast<const EBPFPipeline*>(program);
+    CHECK_NULL(pipeline);
+    auto bridged = pipeline->bridgedMetadata;
+    if (bridged == nullptr) {
+        EBPFDeparserPSA::emit(builder);
+        return;
+    }
+
+    bridged->emitDeclaration(builder);
+    // clones made before deparsing don't carry bridged metadata
+    builder->emitIndent();
+    builder->appendFormat("%s->bridged_metadata_len = 0", pipeline->compilerGlobalMetadata);
+    builder->endOfStatement(true);
+    EBPFDeparserPSA::emit(builder);
+    if (!bridged->isInPacket())
+        bridged->emitStore(builder);
+}
+
+void IngressDeparserPSA::emitPrependedDataLength(CodeBuilder* builder) {
+    auto bridged = dynamic_cast<const EBPFPipeline*>(program)->bridgedMetadata;
+    if (bridged == nullptr || !bridged->isInPacket())
+        return;
+    builder->newline();
+    builder->emitIndent();
+    builder->appendFormat("%s += %u", outerHdrLengthVar, bridged->size * 8);
+    builder->endOfStatement(true);
+}
+
+void IngressDeparserPSA::emitPrependedData(CodeBuilder* builder) {
+    auto bridged = dynamic_cast<const EBPFPipeline*>(program)->bridgedMetadata;
+    if (bridged == nullptr || !bridged->isInPacket())
+        return;
+    bridged->emitStoreInPacket(builder);
+}
+
 // =====================EgressDeparserPSA=============================
 bool EgressDeparserPSA::build() {
     auto pl = controlBlock->container->type->applyParams;
     auto it = pl->parameters.begin();
     packet_out = *it;
     headers = *(it + 3);
+    user_metadata = *(it + 4);
 
     auto ht = program->typeMap->getType(headers);
     if (ht == nullptr) {
@@ -96,8 +263,10 @@ void TCIngressDeparserPSA::emitPreDeparser(CodeBuilder *builder) {
     builder->appendFormat("if (%s->clone) ", istd->name.name);
     builder->blockStart();
     builder->emitIndent();
-    builder->appendFormat("do_packet_clones(%s, &clone_session_tbl, %s->clone_session_id,"
-                          " CLONE_I2E, 1);", program->model.CPacketName.str(), istd->name.name);
+    builder->appendFormat("do_packet_clones(%s, &%s, %s->clone_session_id,"
+                          " CLONE_I2E, 1);", program->model.CPacketName.str(),
+                          builder->target->mapName("clone_session_tbl").c_str(),
+                          istd->name.name);
     builder->newline();
     builder->blockEnd(true);
 
@@ -106,6 +275,7 @@ void TCIngressDeparserPSA::emitPreDeparser(CodeBuilder *builder) {
     builder->appendFormat("if (%s->drop) ", istd->name.name);
     builder->blockStart();
     builder->target->emitTraceMessage(builder, "PreDeparser: dropping packet..");
+    program->emitDropCount(builder, "INGRESS_DROP");
     builder->emitIndent();
     builder->appendFormat("return %s;\n", builder->target->abortReturnCode().c_str());
     builder->blockEnd(true);
@@ -122,8 +292,31 @@ void TCIngressDeparserPSA::emitPreDeparser(CodeBuilder *builder) {
     builder->appendFormat("%s->packet_path = RESUBMIT;",
                           pipeline->compilerGlobalMetadata);
     builder->newline();
-    builder->emitIndent();
-    builder->appendLine("return TC_ACT_UNSPEC;");
+    if (pipeline->isSplit()) {
+        // the ingress pipeline is restarted by a tail call to the first stage
+        auto ingress = dynamic_cast<const EBPFIngressPipeline*>(pipeline);
+        CHECK_NULL(ingress);
+        builder->emitIndent();
+        builder->appendFormat("if (%s->resubmit_depth < %d) ",
+                              pipeline->stageStateVar, ingress->maxResubmitDepth - 1);
+        builder->blockStart();
+        builder->emitIndent();
+        builder->appendFormat("%s->resubmit_depth++;", pipeline->stageStateVar);
+        builder->newline();
+        pipeline->emitTrafficManagerCount(builder, "RESUBMIT");
+        pipeline->emitTailCall(builder, 0);
+        builder->blockEnd(true);
+        builder->target->emitTraceMessage(builder, "PreDeparser: maximum resubmit depth reached, "
+                                                   "dropping packet..");
+        pipeline->emitDropCount(builder, "RESUBMIT_LIMIT");
+        builder->emitIndent();
+        builder->appendFormat("return %s;", builder->target->abortReturnCode().c_str());
+        builder->newline();
+    } else {
+        pipeline->emitTrafficManagerCount(builder, "RESUBMIT");
+        builder->emitIndent();
+        builder->appendLine("return TC_ACT_UNSPEC;");
+    }
     builder->blockEnd(true);
 }
 }  // namespace EBPF
@@ -25,6 +25,46 @@ namespace EBPF {
 
 class EBPFDeparserPSA;
 
+/*
+ * Metadata passed from the Ingress deparser to the Egress parser (normal_meta).
+ * Fields are packed into the spare space of psa_global_metadata (skb->cb) if they fit,
+ * otherwise into a header prepended to the packet by the Ingress deparser
+ * and stripped by the Egress parser. The length stored in psa_global_metadata
+ * marks packets carrying bridged metadata.
+ */
+class EBPFBridgedMetadataPSA {
+ public:
+    struct Field {
+        cstring name;
+        // offset and size in bytes
+        unsigned offset;
+        unsigned size;
+    };
+
+    // size of psa_global_metadata.bridged_metadata
+    static const unsigned maxSizeInGlobalMetadata = 4;
+
+    const EBPFProgram* program;
+    const IR::Parameter* parameter;
+    std::vector<Field> fields;
+    // total size in bytes
+    unsigned size = 0;
+
+    EBPFBridgedMetadataPSA(const EBPFProgram* program, const IR::Parameter* parameter);
+
+    bool isEmpty() const { return size == 0; }
+    bool isInPacket() const { return size > maxSizeInGlobalMetadata; }
+
+    /* Generates a zero-initialized local instance of the metadata. */
+    void emitDeclaration(CodeBuilder* builder) const;
+    /* Copies the metadata into psa_global_metadata, used if it is not carried in the packet. */
+    void emitStore(CodeBuilder* builder) const;
+    /* Copies the metadata to the packet at the current offset. */
+    void emitStoreInPacket(CodeBuilder* builder) const;
+    /* Restores the metadata in the Egress pipeline and skips it in the packet, if present. */
+    void emitLoad(CodeBuilder* builder) const;
+};
+
 class DeparserBodyTranslatorPSA : public DeparserBodyTranslator {
  public:
     explicit DeparserBodyTranslatorPSA(const EBPFDeparserPSA* deparser);
@@ -37,6 +77,7 @@ class EBPFDeparserPSA : public EBPFDeparser {
     const IR::Parameter* user_metadata;
     const IR::Parameter* istd;
     const IR::Parameter* resubmit_meta;
+    const IR::Parameter* normal_meta = nullptr;
 
     EBPFDeparserPSA(const EBPFProgram* program, const IR::ControlBlock* control,
                     const IR::Parameter* parserHeaders, const IR::Parameter *istd) :
@@ -54,6 +95,9 @@ class IngressDeparserPSA : public EBPFDeparserPSA {
             EBPFDeparserPSA(program, control, parserHeaders, istd) {}
 
     bool build() override;
+    void emit(CodeBuilder* builder) override;
+    void emitPrependedDataLength(CodeBuilder* builder) override;
+    void emitPrependedData(CodeBuilder* builder) override;
 };
 
 class EgressDeparserPSA : public EBPFDeparserPSA {
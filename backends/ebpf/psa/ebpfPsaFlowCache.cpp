@@ -0,0 +1,505 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ebpfPsaFlowCache.h"
+#include "ebpfPipeline.h"
+#include "frontends/p4/methodInstance.h"
+
+namespace EBPF {
+
+namespace {
+
+/*
+ * Collects fields of headers, user metadata and input standard metadata read and written
+ * by a control block, including keys and actions of applied tables.
+ * Output standard metadata is always cached as a whole.
+ */
+class FlowCacheFieldsCollector : public Inspector {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    const EBPFControlPSA* control;
+    std::set<cstring> readNames;
+    std::set<cstring> writtenNames;
+    bool writing = false;
+
+    void unsupported(const IR::Node* node, const char* reason) {
+        if (supported)
+            LOG2("Flow cache disabled: " << reason << ": " << node);
+        supported = false;
+    }
+
+    void add(const IR::Expression* expression, cstring member, const IR::Type* type,
+             bool write) {
+        auto& names = write ? writtenNames : readNames;
+        auto& fields = write ? written : read;
+        cstring name = expression->toString() + member;
+        if (names.count(name) > 0)
+            return;
+        names.emplace(name);
+        fields.push_back({expression, member, type});
+    }
+
+    void addField(const IR::Expression* expression, cstring member, const IR::Type* type,
+                  bool write) {
+        if (type->is<IR::Type_Boolean>()) {
+            add(expression, member, type, write);
+        } else if (auto tb = type->to<IR::Type_Bits>()) {
+            if (tb->size > 64) {
+                unsupported(expression, "fields wider than 64 bits");
+                return;
+            }
+            add(expression, member, type, write);
+        } else if (auto st = type->to<IR::Type_StructLike>()) {
+            if (!st->is<IR::Type_Header>() && !st->is<IR::Type_Struct>()) {
+                unsupported(expression, "unsupported type");
+                return;
+            }
+            for (auto f : st->fields) {
+                auto ftype = typeMap->getTypeType(f->type, true);
+                addField(expression, member + "." + f->name.name, ftype, write);
+            }
+            if (st->is<IR::Type_Header>())
+                add(expression, member + ".ebpf_valid", nullptr, write);
+        } else {
+            unsupported(expression, "unsupported type");
+        }
+    }
+
+ public:
+    bool supported = true;
+    std::vector<EBPFFlowCachePSA::Field> read;
+    std::vector<EBPFFlowCachePSA::Field> written;
+
+    FlowCacheFieldsCollector(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+                             const EBPFControlPSA* control) :
+            refMap(refMap), typeMap(typeMap), control(control) {
+        setName("FlowCacheFieldsCollector");
+        visitDagOnce = false;
+    }
+
+    bool preorder(const IR::AssignmentStatement* statement) override {
+        writing = true;
+        visit(statement->left);
+        writing = false;
+        // a part of the field is written, so the result depends on the rest of it
+        if (statement->left->is<IR::Slice>())
+            visit(statement->left);
+        visit(statement->right);
+        return false;
+    }
+
+    // Returns a parameter of the control block an expression refers to, or nullptr.
+    const IR::IDeclaration* parameterOf(const IR::Expression* expression) {
+        while (auto member = expression->to<IR::Member>())
+            expression = member->expr;
+        if (expression->is<IR::ArrayIndex>())
+            unsupported(expression, "header stacks");
+        auto path = expression->to<IR::PathExpression>();
+        if (path == nullptr)
+            return nullptr;
+        auto decl = refMap->getDeclaration(path->path, true);
+        if (decl == control->headers || decl == control->user_metadata ||
+            decl == control->inputStandardMetadata || decl == control->outputStandardMetadata)
+            return decl;
+        return nullptr;
+    }
+
+    bool preorder(const IR::Member* expression) override {
+        auto decl = parameterOf(expression);
+        if (decl == nullptr)
+            // e.g. table.apply().hit
+            return true;
+        if (decl == control->outputStandardMetadata)
+            return false;
+        if (decl == control->inputStandardMetadata) {
+            if (writing)
+                unsupported(expression, "write to input metadata");
+            if (expression->member.name == "ingress_timestamp")
+                unsupported(expression, "timestamp");
+        }
+        addField(expression, "", typeMap->getType(expression, true), writing);
+        return false;
+    }
+
+    bool preorder(const IR::PathExpression* expression) override {
+        auto decl = refMap->getDeclaration(expression->path, true);
+        if (decl == control->headers || decl == control->user_metadata ||
+            decl == control->inputStandardMetadata)
+            unsupported(expression, "access to the whole structure");
+        return false;
+    }
+
+    bool preorder(const IR::MethodCallExpression* expression) override {
+        auto mi = P4::MethodInstance::resolve(expression, refMap, typeMap);
+        if (auto bim = mi->to<P4::BuiltInMethod>()) {
+            auto header = bim->appliedTo;
+            if (bim->name.name == IR::Type_Header::isValid ||
+                bim->name.name == IR::Type_Header::setValid ||
+                bim->name.name == IR::Type_Header::setInvalid) {
+                bool write = bim->name.name != IR::Type_Header::isValid;
+                if (parameterOf(header) != nullptr)
+                    add(header, ".ebpf_valid", nullptr, write);
+                else
+                    visit(header);
+            } else {
+                unsupported(expression, "unsupported method");
+            }
+            return false;
+        }
+        if (auto apply = mi->to<P4::ApplyMethod>()) {
+            if (!apply->isTableApply()) {
+                unsupported(expression, "unsupported method");
+                return false;
+            }
+            auto table = apply->object->to<IR::P4Table>();
+            for (auto property : {"psa_direct_counter", "psa_direct_meter",
+                                  "psa_implementation", "psa_idle_timeout"}) {
+                if (table->properties->getProperty(property) != nullptr)
+                    unsupported(table, "table with a stateful property");
+            }
+            if (table->getKey() != nullptr) {
+                for (auto ke : table->getKey()->keyElements)
+                    visit(ke->expression);
+            }
+            for (auto ale : table->getActionList()->actionList) {
+                auto action = refMap->getDeclaration(ale->getPath(), true)->to<IR::P4Action>();
+                if (action != nullptr)
+                    visit(action->body);
+            }
+            return false;
+        }
+        if (auto ac = mi->to<P4::ActionCall>()) {
+            for (auto param : ac->action->parameters->parameters) {
+                if (param->direction == IR::Direction::Out ||
+                    param->direction == IR::Direction::InOut)
+                    unsupported(expression, "action with out parameters");
+            }
+            visit(expression->arguments);
+            visit(ac->action->body);
+            return false;
+        }
+        // externs keep a state or depend on the packet (e.g. packet length)
+        unsupported(expression, "extern");
+        return false;
+    }
+};
+
+cstring fieldName(const EBPFFlowCachePSA::Field& field) {
+    return field.expression->toString() + field.member;
+}
+
+/*
+ * Finds fields written on every path through a statement. Other fields written by
+ * the control block may keep the value of the packet, so the cached result depends on it.
+ */
+class DefinitelyWrittenFields {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    const EBPFControlPSA* control;
+
+    static std::set<cstring> intersect(const std::set<cstring>& a, const std::set<cstring>& b) {
+        std::set<cstring> result;
+        for (auto name : a) {
+            if (b.count(name) > 0)
+                result.emplace(name);
+        }
+        return result;
+    }
+
+ public:
+    // Set if a path leaves the statement by return or exit, so that the statements
+    // following it are not executed on every path.
+    bool leaves = false;
+
+    DefinitelyWrittenFields(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+                            const EBPFControlPSA* control) :
+            refMap(refMap), typeMap(typeMap), control(control) {}
+
+    std::set<cstring> methodCall(const IR::MethodCallExpression* expression) {
+        std::set<cstring> result;
+        auto mi = P4::MethodInstance::resolve(expression, refMap, typeMap);
+        if (auto bim = mi->to<P4::BuiltInMethod>()) {
+            if (bim->name.name == IR::Type_Header::setValid ||
+                bim->name.name == IR::Type_Header::setInvalid)
+                result.emplace(bim->appliedTo->toString() + ".ebpf_valid");
+        } else if (auto apply = mi->to<P4::ApplyMethod>()) {
+            if (!apply->isTableApply())
+                return result;
+            // one of the actions is executed, including the default action
+            bool first = true;
+            auto table = apply->object->to<IR::P4Table>();
+            for (auto ale : table->getActionList()->actionList) {
+                auto action = refMap->getDeclaration(ale->getPath(), true)->to<IR::P4Action>();
+                if (action == nullptr)
+                    return {};
+                auto written = statement(action->body);
+                result = first ? written : intersect(result, written);
+                first = false;
+            }
+        } else if (auto ac = mi->to<P4::ActionCall>()) {
+            result = statement(ac->action->body);
+        }
+        return result;
+    }
+
+    std::set<cstring> statement(const IR::StatOrDecl* statement) {
+        std::set<cstring> result;
+        if (auto assignment = statement->to<IR::AssignmentStatement>()) {
+            // a slice leaves the rest of the field unchanged
+            if (assignment->left->is<IR::Slice>())
+                return result;
+            FlowCacheFieldsCollector collector(refMap, typeMap, control);
+            assignment->apply(collector);
+            for (auto& field : collector.written)
+                result.emplace(fieldName(field));
+        } else if (auto block = statement->to<IR::BlockStatement>()) {
+            for (auto component : block->components) {
+                auto written = this->statement(component);
+                result.insert(written.begin(), written.end());
+                if (leaves)
+                    break;
+            }
+        } else if (auto ifStatement = statement->to<IR::IfStatement>()) {
+            auto ifTrue = this->statement(ifStatement->ifTrue);
+            if (ifStatement->ifFalse != nullptr)
+                result = intersect(ifTrue, this->statement(ifStatement->ifFalse));
+        } else if (auto switchStatement = statement->to<IR::SwitchStatement>()) {
+            // switch (table.apply().action_run)
+            auto member = switchStatement->expression->to<IR::Member>();
+            if (member != nullptr && member->expr->is<IR::MethodCallExpression>())
+                result = methodCall(member->expr->to<IR::MethodCallExpression>());
+            std::set<cstring> cases;
+            bool first = true, hasDefault = false;
+            for (auto c : switchStatement->cases) {
+                hasDefault = hasDefault || c->label->is<IR::DefaultExpression>();
+                if (c->statement == nullptr)
+                    continue;
+                auto written = this->statement(c->statement);
+                cases = first ? written : intersect(cases, written);
+                first = false;
+            }
+            if (hasDefault)
+                result.insert(cases.begin(), cases.end());
+        } else if (auto mcs = statement->to<IR::MethodCallStatement>()) {
+            result = methodCall(mcs->methodCall);
+        } else if (statement->is<IR::ReturnStatement>() || statement->is<IR::ExitStatement>()) {
+            leaves = true;
+        }
+        return result;
+    }
+};
+
+}  // namespace
+
+EBPFFlowCachePSA::EBPFFlowCachePSA(const EBPFProgram* program, const EBPFControlPSA* control,
+                                   size_t size) :
+        EBPFTableBase(program, EBPFObject::externalName(control->controlBlock->container) +
+                      "_flow_cache", control->codeGen),
+        control(control), size(size) {
+    epochMapName = instanceName + "_epoch";
+    keyVar = "flow_cache_key";
+    valueVar = "flow_cache_value";
+    epochVar = "flow_cache_epoch";
+}
+
+bool EBPFFlowCachePSA::build() {
+    FlowCacheFieldsCollector collector(program->refMap, program->typeMap, control);
+    control->controlBlock->container->body->apply(collector);
+    if (!collector.supported)
+        return false;
+    keyFields = collector.read;
+    valueFields = collector.written;
+
+    // a field which is not written on every path is also a part of the key
+    DefinitelyWrittenFields definitelyWritten(program->refMap, program->typeMap, control);
+    auto written = definitelyWritten.statement(control->controlBlock->container->body);
+    std::set<cstring> keyNames;
+    for (auto& field : keyFields)
+        keyNames.emplace(fieldName(field));
+    for (auto& field : valueFields) {
+        cstring name = fieldName(field);
+        if (written.count(name) == 0 && keyNames.count(name) == 0) {
+            LOG2("Flow cache: " << name << " is not written on every path");
+            keyFields.push_back(field);
+        }
+    }
+    return true;
+}
+
+void EBPFFlowCachePSA::emitField(CodeBuilder* builder, const Field& field) const {
+    codeGen->setBuilder(builder);
+    field.expression->apply(*codeGen);
+    builder->append(field.member);
+}
+
+void EBPFFlowCachePSA::emitFieldDeclarations(CodeBuilder* builder,
+                                             const std::vector<Field>& fields) const {
+    unsigned index = 0;
+    for (auto field : fields) {
+        builder->emitIndent();
+        cstring name = Util::printf_format("field%u", index++);
+        if (field.type == nullptr) {
+            builder->appendFormat("u8 %s", name);
+        } else {
+            auto type = EBPFTypeFactory::instance->create(field.type);
+            type->declare(builder, name, false);
+        }
+        builder->append("; /* ");
+        builder->append(field.expression->toString() + field.member);
+        builder->append(" */");
+        builder->newline();
+    }
+}
+
+void EBPFFlowCachePSA::emitTypes(CodeBuilder* builder) {
+    builder->emitIndent();
+    builder->appendFormat("struct %s ", keyTypeName);
+    builder->blockStart();
+    emitFieldDeclarations(builder, keyFields);
+    // avoids an empty key if no field is read
+    builder->emitIndent();
+    builder->append("u8 __pad");
+    builder->endOfStatement(true);
+    builder->blockEnd(false);
+    builder->endOfStatement(true);
+    builder->newline();
+
+    auto ostdType = program->typeMap->getTypeType(control->outputStandardMetadata->type, true);
+    builder->emitIndent();
+    builder->appendFormat("struct %s ", valueTypeName);
+    builder->blockStart();
+    builder->emitIndent();
+    builder->append("u32 epoch");
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("struct %s %s", ostdType->to<IR::Type_StructLike>()->name.name,
+                          control->outputStandardMetadata->name.name);
+    builder->endOfStatement(true);
+    emitFieldDeclarations(builder, valueFields);
+    builder->blockEnd(false);
+    builder->endOfStatement(true);
+    builder->newline();
+}
+
+void EBPFFlowCachePSA::emitInstance(CodeBuilder* builder) {
+    builder->target->emitTableDecl(builder, dataMapName, TableHashLRU,
+                                   "struct " + keyTypeName, "struct " + valueTypeName, size);
+    builder->target->emitTableDecl(builder, epochMapName, TableArray, "u32", "u32", 1);
+}
+
+void EBPFFlowCachePSA::emitLookup(CodeBuilder* builder) {
+    auto pipeline = program->to<EBPFPipeline>();
+    CHECK_NULL(pipeline);
+    cstring ostd = control->outputStandardMetadata->name.name;
+
+    builder->emitIndent();
+    builder->appendFormat("struct %s %s", keyTypeName, keyVar);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("struct %s *%s = NULL", valueTypeName, valueVar);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("u32 *%s = NULL", epochVar);
+    builder->endOfStatement(true);
+
+    // resubmitted packets start with the output metadata of the previous pass
+    builder->emitIndent();
+    builder->appendFormat("if (%s == NORMAL) ", pipeline->packetPathVar);
+    builder->blockStart();
+    builder->emitIndent();
+    builder->target->emitTableLookup(builder, epochMapName, program->zeroKey, epochVar);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("__builtin_memset(&%s, 0, sizeof(%s))", keyVar, keyVar);
+    builder->endOfStatement(true);
+    unsigned index = 0;
+    for (auto field : keyFields) {
+        builder->emitIndent();
+        builder->appendFormat("%s.field%u = ", keyVar, index++);
+        emitField(builder, field);
+        builder->endOfStatement(true);
+    }
+    builder->emitIndent();
+    builder->appendFormat("if (%s != NULL) ", epochVar);
+    builder->blockStart();
+    builder->emitIndent();
+    builder->target->emitTableLookup(builder, dataMapName, keyVar, valueVar);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("if (%s != NULL && %s->epoch != *%s)\n",
+                          valueVar, valueVar, epochVar);
+    builder->increaseIndent();
+    builder->emitIndent();
+    builder->appendFormat("%s = NULL", valueVar);
+    builder->endOfStatement(true);
+    builder->decreaseIndent();
+    builder->blockEnd(true);
+    builder->blockEnd(true);
+
+    builder->emitIndent();
+    builder->appendFormat("if (%s != NULL) ", valueVar);
+    builder->blockStart();
+    builder->target->emitTraceMessage(builder, "Control: flow cache hit");
+    index = 0;
+    for (auto field : valueFields) {
+        builder->emitIndent();
+        emitField(builder, field);
+        builder->appendFormat(" = %s->field%u", valueVar, index++);
+        builder->endOfStatement(true);
+    }
+    builder->emitIndent();
+    if (codeGen->isPointerVariable(ostd))
+        builder->append("*");
+    builder->appendFormat("%s = %s->%s", ostd, valueVar, ostd);
+    builder->endOfStatement(true);
+    builder->blockEnd(false);
+}
+
+void EBPFFlowCachePSA::emitUpdate(CodeBuilder* builder) {
+    cstring ostd = control->outputStandardMetadata->name.name;
+    cstring entryVar = "flow_cache_entry";
+
+    builder->emitIndent();
+    builder->appendFormat("if (%s != NULL) ", epochVar);
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendFormat("struct %s %s", valueTypeName, entryVar);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("__builtin_memset(&%s, 0, sizeof(%s))", entryVar, entryVar);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("%s.epoch = *%s", entryVar, epochVar);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("%s.%s = %s%s", entryVar, ostd,
+                          codeGen->isPointerVariable(ostd) ? "*" : "", ostd);
+    builder->endOfStatement(true);
+    unsigned index = 0;
+    for (auto field : valueFields) {
+        builder->emitIndent();
+        builder->appendFormat("%s.field%u = ", entryVar, index++);
+        emitField(builder, field);
+        builder->endOfStatement(true);
+    }
+    builder->emitIndent();
+    builder->target->emitTableUpdate(builder, dataMapName, keyVar, entryVar);
+    builder->newline();
+    builder->blockEnd(true);
+}
+
+}  // namespace EBPF
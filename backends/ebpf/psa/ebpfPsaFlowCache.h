@@ -0,0 +1,77 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef BACKENDS_EBPF_PSA_EBPFPSAFLOWCACHE_H_
+#define BACKENDS_EBPF_PSA_EBPFPSAFLOWCACHE_H_
+
+#include "backends/ebpf/ebpfTable.h"
+#include "ebpfPsaControl.h"
+
+namespace EBPF {
+
+/*
+ * Caches decisions of the ingress control block (a "megaflow" cache).
+ * Packets are matched on all fields of headers, user metadata and standard metadata read
+ * by the control block, a hit restores the fields written by the control block and
+ * the output standard metadata without running the control block.
+ * Entries are created with the current epoch, stored in a separate array map; the control plane
+ * has to increment the epoch after each modification of tables to invalidate the cache.
+ */
+class EBPFFlowCachePSA : public EBPFTableBase {
+ public:
+    // A field of headers, user metadata or input standard metadata.
+    struct Field {
+        const IR::Expression* expression;
+        // member of the expression, e.g. ".ebpf_valid"; may be empty
+        cstring member;
+        // nullptr for header validity
+        const IR::Type* type;
+    };
+
+ protected:
+    const EBPFControlPSA* control;
+    size_t size;
+
+    // fields read by the control block, they are used as the key
+    std::vector<Field> keyFields;
+    // fields written by the control block, they are restored from the cache
+    std::vector<Field> valueFields;
+
+    void emitField(CodeBuilder* builder, const Field& field) const;
+    void emitFieldDeclarations(CodeBuilder* builder, const std::vector<Field>& fields) const;
+
+ public:
+    cstring epochMapName;
+    cstring keyVar;
+    cstring valueVar;
+    cstring epochVar;
+
+    EBPFFlowCachePSA(const EBPFProgram* program, const EBPFControlPSA* control, size_t size);
+
+    /* Collects fields used by the control block, returns false if it cannot be cached. */
+    bool build();
+
+    void emitTypes(CodeBuilder* builder);
+    void emitInstance(CodeBuilder* builder);
+    /* Looks up the cache and restores fields on hit, sets valueVar to NULL on miss. */
+    void emitLookup(CodeBuilder* builder);
+    /* Stores the result of the control block in the cache. */
+    void emitUpdate(CodeBuilder* builder);
+};
+
+}  // namespace EBPF
+
+#endif  /* BACKENDS_EBPF_PSA_EBPFPSAFLOWCACHE_H_ */
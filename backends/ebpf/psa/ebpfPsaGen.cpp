@@ -41,12 +41,16 @@ void PSAEbpfGenerator::emitPreamble(CodeBuilder *builder) const {
     builder->appendLine("#define CLONE_MAX_SESSIONS 1024");
     builder->newline();
 
-    builder->appendLine("#ifndef PSA_PORT_RECIRCULATE\n"
-        "#error \"PSA_PORT_RECIRCULATE not specified, "
-        "please use -DPSA_PORT_RECIRCULATE=n option to specify index of recirculation "
-        "interface (see the result of command 'ip link')\"\n"
-        "#endif");
+    // packets are recirculated by tail calls if there is no recirculation interface
+    if (!options.recirculateTailCall) {
+        builder->appendLine("#ifndef PSA_PORT_RECIRCULATE\n"
+            "#error \"PSA_PORT_RECIRCULATE not specified, "
+            "please use -DPSA_PORT_RECIRCULATE=n option to specify index of recirculation "
+            "interface (see the result of command 'ip link')\"\n"
+            "#endif");
+    }
     builder->appendLine("#define P4C_PSA_PORT_RECIRCULATE 0xfffffffa");
+    builder->appendLine("#define P4C_PSA_PORT_CPU 0xfffffffd");
     builder->newline();
 }
 
@@ -60,6 +64,15 @@ void PSAEbpfGenerator::emitCommonPreamble(CodeBuilder *builder) const {
     builder->appendLine("#define write_byte(base, offset, v) do { "
                         "*(u8*)((base) + (offset)) = (v); "
                         "} while (0)");
+    builder->appendLine("#define write_half(base, offset, v) do { "
+                        "*(u16*)((base) + (offset)) = bpf_htons(v); "
+                        "} while (0)");
+    builder->appendLine("#define write_word(base, offset, v) do { "
+                        "*(u32*)((base) + (offset)) = htonl(v); "
+                        "} while (0)");
+    builder->appendLine("#define write_dword(base, offset, v) do { "
+                        "*(u64*)((base) + (offset)) = htonll(v); "
+                        "} while (0)");
     builder->target->emitPreamble(builder);
 }
 
@@ -69,6 +82,10 @@ void PSAEbpfGenerator::emitInternalStructures(CodeBuilder *builder) const {
                         "} __attribute__((aligned(4)));");
     builder->newline();
 
+    emitReplicationListTypes(builder);
+}
+
+void PSAEbpfGenerator::emitReplicationListTypes(CodeBuilder *builder) const {
     // emit helper struct for clone sessions
     builder->appendLine("struct list_key_t {\n"
                         "    __u32 port;\n"
@@ -93,10 +110,122 @@ void PSAEbpfGenerator::emitTypes(CodeBuilder *builder) const {
     ingress->control->emitTableTypes(builder);
     egress->parser->emitTypes(builder);
     egress->control->emitTableTypes(builder);
+    auto ingressPipeline = ingress->to<EBPFIngressPipeline>();
+    if (ingressPipeline->flowCache != nullptr)
+        ingressPipeline->flowCache->emitTypes(builder);
+    if (options.emitStats) {
+        emitTableStatsType(builder);
+        emitDropReasons(builder);
+        emitTrafficManagerCounters(builder);
+    }
+    if (options.latencySampling > 0)
+        emitLatencyHistogramType(builder);
+    if (hasPacketSamplers())
+        EBPFPacketSamplerPSA::emitSampleType(builder);
+    if (options.cpuPortPerfBuffer)
+        emitCPUPortPacketType(builder);
     builder->newline();
 }
 
+bool PSAEbpfGenerator::hasPacketSamplers() const {
+    return !ingress->control->samplers.empty() ||
+           !egress->control->samplers.empty();
+}
+
+std::vector<EBPFTablePSA*> PSAEbpfGenerator::statsTables() const {
+    std::vector<EBPFTablePSA*> tables;
+    for (auto pipeline : {ingress, egress}) {
+        for (auto it : pipeline->control->tables) {
+            auto table = it.second->to<EBPFTablePSA>();
+            if (table != nullptr && table->statsId >= 0)
+                tables.push_back(table);
+        }
+    }
+    return tables;
+}
+
+/*
+ * Counters of a table in the table_stats map. actions[] is indexed by action IDs
+ * of the table, NoAction has ID 0.
+ */
+void PSAEbpfGenerator::emitTableStatsType(CodeBuilder *builder) const {
+    size_t maxActions = 1;
+    for (auto table : statsTables())
+        maxActions = std::max(maxActions, table->actionList->actionList.size() + 1);
+    builder->appendFormat("#define TABLE_STATS_MAX_ACTIONS %u", unsigned(maxActions));
+    builder->newline();
+    builder->appendLine("struct table_stats {\n"
+                        "    u64 hits;\n"
+                        "    u64 misses;\n"
+                        "    u64 default_actions;\n"
+                        "    u64 actions[TABLE_STATS_MAX_ACTIONS];\n"
+                        "};");
+}
+
+/* Codes of drop reasons, indexes of the drop_stats map. */
+void PSAEbpfGenerator::emitDropReasons(CodeBuilder *builder) const {
+    auto& reasons = EBPFPipeline::dropReasons();
+    for (unsigned i = 0; i < reasons.size(); i++) {
+        builder->appendFormat("#define DROP_REASON_%s %u", reasons[i], i);
+        builder->newline();
+    }
+    builder->appendFormat("#define DROP_REASONS %u", unsigned(reasons.size()));
+    builder->newline();
+}
+
+/*
+ * Codes of Traffic Manager counters, indexes of the tm_stats map. Packets sent on
+ * a packet path are counted at the index of its PSA_PacketPath_t value.
+ */
+void PSAEbpfGenerator::emitTrafficManagerCounters(CodeBuilder *builder) const {
+    auto& counters = EBPFPipeline::trafficManagerCounters();
+    for (unsigned i = 0; i < counters.size(); i++) {
+        builder->appendFormat("#define TM_STATS_%s %u", counters[i], i);
+        builder->newline();
+    }
+    builder->appendFormat("#define TM_STATS %u", unsigned(counters.size()));
+    builder->newline();
+}
+
+/*
+ * Histograms of the time spent in blocks of PSA pipelines, indexed by LATENCY_* stages.
+ * Bucket i counts packets which spent [2^i, 2^(i+1)) ns in a block.
+ */
+void PSAEbpfGenerator::emitLatencyHistogramType(CodeBuilder *builder) const {
+    builder->appendFormat("#define LATENCY_HIST_BUCKETS %u", LatencyHistBuckets);
+    builder->newline();
+    unsigned stage = 0;
+    for (auto pipeline : {"INGRESS", "EGRESS"}) {
+        for (auto block : {"PARSER", "CONTROL", "DEPARSER", "TM"}) {
+            builder->appendFormat("#define LATENCY_%s_%s %u", pipeline, block, stage++);
+            builder->newline();
+        }
+    }
+    BUG_CHECK(stage == LatencyStages, "unexpected number of latency stages");
+    builder->appendFormat("#define LATENCY_STAGES %u", stage);
+    builder->newline();
+    builder->appendLine("struct latency_hist {\n"
+                        "    u64 buckets[LATENCY_HIST_BUCKETS];\n"
+                        "};");
+}
+
+/*
+ * Written into the cpu_port_packets perf event array (--cpu-port-perf-buffer),
+ * followed by the packet.
+ */
+void PSAEbpfGenerator::emitCPUPortPacketType(CodeBuilder *builder) const {
+    builder->appendLine("struct cpu_port_packet {\n"
+                        "    u32 ingress_port;\n"
+                        "    u32 packet_length;\n"
+                        "};");
+}
+
 void PSAEbpfGenerator::emitGlobalHeadersMetadata(CodeBuilder *builder) const {
+    for (auto pipeline : {ingress, egress}) {
+        if (pipeline->isSplit())
+            pipeline->emitStageStateType(builder);
+    }
+
     builder->append("struct hdr_md ");
     builder->blockStart();
     builder->emitIndent();
@@ -110,6 +239,16 @@ void PSAEbpfGenerator::emitGlobalHeadersMetadata(CodeBuilder *builder) const {
     userMetadataType->declare(builder, "cpumap_usermeta", false);
     builder->endOfStatement(true);
 
+    // state of pipelines split into several programs
+    for (auto pipeline : {ingress, egress}) {
+        if (!pipeline->isSplit())
+            continue;
+        builder->emitIndent();
+        builder->appendFormat("struct %s %s", pipeline->stageStateName(),
+                              pipeline->stageStateName());
+        builder->endOfStatement(true);
+    }
+
     // additional field to avoid compiler errors when both headers and user_metadata are empty.
     builder->emitIndent();
     builder->append("__u8 __hook");
@@ -138,12 +277,61 @@ void PSAEbpfGenerator::emitPipelineInstances(CodeBuilder *builder) const {
     egress->parser->emitValueSetInstances(builder);
     egress->control->emitTableInstances(builder);
 
+    auto ingressPipeline = ingress->to<EBPFIngressPipeline>();
+    if (ingressPipeline->flowCache != nullptr)
+        ingressPipeline->flowCache->emitInstance(builder);
+
     builder->target->emitTableDecl(builder, "hdr_md_cpumap",
                                    TablePerCPUArray, "u32",
                                    "struct hdr_md", 2);
+
+    auto tables = statsTables();
+    if (!tables.empty()) {
+        builder->target->emitTableDecl(builder, "table_stats",
+                                       TablePerCPUArray, "u32",
+                                       "struct table_stats", tables.size());
+    }
+    if (options.emitStats) {
+        builder->target->emitTableDecl(builder, "drop_stats",
+                                       TablePerCPUArray, "u32",
+                                       "u64", EBPFPipeline::dropReasons().size());
+        builder->target->emitTableDecl(builder, "tm_stats",
+                                       TablePerCPUArray, "u32",
+                                       "u64", EBPFPipeline::trafficManagerCounters().size());
+    }
+
+    if (options.cpuPortPerfBuffer)
+        builder->target->emitPerfEventArrayDecl(builder, "cpu_port_packets");
+
+    if (options.latencySampling > 0) {
+        builder->target->emitTableDecl(builder, "latency_hist",
+                                       TablePerCPUArray, "u32",
+                                       "struct latency_hist", LatencyStages);
+    }
+
+    for (auto pipeline : {ingress, egress}) {
+        if (pipeline->isSplit())
+            pipeline->emitProgArray(builder);
+    }
+    if (options.recirculateTailCall) {
+        builder->target->emitProgArrayDecl(builder, "recirculate_progs",
+                                           {ingress->functionName, egress->functionName});
+    }
 }
 
 void PSAEbpfGenerator::emitInitializer(CodeBuilder *builder) const {
+    if (!options.mapInitManifest.isNullOrEmpty()) {
+        // the map initializer is only needed for entries which are not in the manifest
+        bool needed = false;
+        for (auto pipeline : {ingress, egress}) {
+            for (auto it : pipeline->control->tables) {
+                auto table = it.second->to<EBPFTablePSA>();
+                needed = needed || table == nullptr || table->hasInitializer();
+            }
+        }
+        if (!needed)
+            return;
+    }
     emitInitializerSection(builder);
     builder->appendFormat("int %s()",
                           "map_initializer");
@@ -160,7 +348,379 @@ void PSAEbpfGenerator::emitInitializer(CodeBuilder *builder) const {
     builder->blockEnd(true);
 }
 
+void PSAEbpfGenerator::emitMapInitManifest(std::ostream& out) const {
+    auto maps = new Util::JsonArray();
+    for (auto pipeline : {ingress, egress}) {
+        for (auto it : pipeline->control->tables) {
+            auto table = it.second->to<EBPFTablePSA>();
+            if (table == nullptr || table->addInitialEntries(maps))
+                continue;
+            ::warning(ErrorType::WARN_UNSUPPORTED,
+                      "%1%: initial entries can not be written to the manifest, "
+                      "they are written by the map initializer program",
+                      table->table->container);
+        }
+    }
+    auto manifest = new Util::JsonObject();
+    manifest->emplace("maps", maps);
+    manifest->serialize(out);
+    out << std::endl;
+}
+
+/*
+ * Maps of counters are per-CPU arrays, their manifest entries list what is counted
+ * at each index instead of actions.
+ */
+void PSAEbpfGenerator::emitMapLayoutManifest(std::ostream& out) const {
+    auto maps = new Util::JsonArray();
+    for (auto pipeline : {ingress, egress}) {
+        for (auto it : pipeline->control->tables) {
+            if (auto table = it.second->to<EBPFTablePSA>())
+                table->addMapLayouts(maps);
+        }
+    }
+
+    MapLayout indexLayout;
+    indexLayout.append("u32", 4, 4);
+    auto addCounterMap = [&](cstring name, const std::vector<cstring>& indexes,
+                             unsigned countersPerIndex) {
+        MapLayout valueLayout;
+        for (unsigned i = 0; i < countersPerIndex; i++)
+            valueLayout.append("u64", 8, 8);
+        auto jsonIndexes = new Util::JsonArray();
+        for (auto index : indexes)
+            jsonIndexes->append(index);
+        auto jsonMap = new Util::JsonObject();
+        jsonMap->emplace("name", options.mapPrefix + name);
+        jsonMap->emplace("type", "percpu_array");
+        jsonMap->emplace("max_entries", indexes.size());
+        jsonMap->emplace("key_layout", indexLayout.hash());
+        jsonMap->emplace("value_layout", valueLayout.hash());
+        jsonMap->emplace("indexes", jsonIndexes);
+        maps->append(jsonMap);
+    };
+    if (options.emitStats) {
+        auto tables = statsTables();
+        if (!tables.empty()) {
+            // the same size as struct table_stats, see emitTableStatsType()
+            size_t maxActions = 1;
+            std::vector<cstring> names;
+            for (auto table : tables) {
+                maxActions = std::max(maxActions, table->actionList->actionList.size() + 1);
+                names.push_back(table->instanceName);
+            }
+            addCounterMap("table_stats", names, 3 + maxActions);
+        }
+        addCounterMap("drop_stats", EBPFPipeline::dropReasons(), 1);
+        addCounterMap("tm_stats", EBPFPipeline::trafficManagerCounters(), 1);
+    }
+    if (options.latencySampling > 0) {
+        std::vector<cstring> stages;
+        for (auto pipeline : {"INGRESS", "EGRESS"}) {
+            for (auto block : {"PARSER", "CONTROL", "DEPARSER", "TM"})
+                stages.push_back(cstring(pipeline) + "_" + block);
+        }
+        addCounterMap("latency_hist", stages, LatencyHistBuckets);
+    }
+
+    auto manifest = new Util::JsonObject();
+    manifest->emplace("maps", maps);
+    manifest->serialize(out);
+    out << std::endl;
+}
+
+void PSAEbpfGenerator::emitControlPlaneHeader(CodeBuilder *builder) const {
+    ingress->emitGeneratedComment(builder);
+    builder->appendLine("#ifndef _P4_CONTROL_PLANE_H_");
+    builder->appendLine("#define _P4_CONTROL_PLANE_H_");
+    builder->newline();
+    builder->appendLine("#include <stdbool.h>");
+    builder->appendLine("#include <linux/types.h>");
+    builder->appendLine("#include \"psa.h\"");
+    builder->newline();
+    for (auto width : {8, 16, 32, 64}) {
+        builder->appendFormat("typedef __u%d u%d;", width, width);
+        builder->newline();
+        builder->appendFormat("typedef __s%d i%d;", width, width);
+        builder->newline();
+    }
+    builder->newline();
+
+    builder->appendFormat("#define CLONE_MAX_CLONES %u", MaxClones);
+    builder->newline();
+    builder->appendFormat("#define CLONE_MAX_SESSIONS %u", MaxCloneSessions);
+    builder->newline();
+    builder->newline();
+    emitReplicationListTypes(builder);
+    if (options.emitStats) {
+        emitTableStatsType(builder);
+        emitDropReasons(builder);
+        emitTrafficManagerCounters(builder);
+        for (auto table : statsTables()) {
+            builder->appendFormat("#define %s_STATS_ID %d", table->instanceName.toUpper(),
+                                  table->statsId);
+            builder->newline();
+        }
+        builder->newline();
+    }
+    if (options.latencySampling > 0) {
+        emitLatencyHistogramType(builder);
+        builder->newline();
+    }
+    if (hasPacketSamplers()) {
+        EBPFPacketSamplerPSA::emitSampleType(builder);
+        builder->newline();
+    }
+    if (options.cpuPortPerfBuffer) {
+        emitCPUPortPacketType(builder);
+        builder->newline();
+    }
+
+    builder->appendLine("/*\n"
+                        " * Functions taking a count process a batch of entries, on return\n"
+                        " * the count holds the number of processed entries.\n"
+                        " * Functions return 0 on success and a negative error code otherwise.\n"
+                        " */");
+    builder->newline();
+    for (auto pipeline : {ingress, egress}) {
+        for (auto it : pipeline->control->tables) {
+            auto table = it.second->to<EBPFTablePSA>();
+            if (table == nullptr)
+                continue;
+            if (!table->hasControlPlaneFunctions()) {
+                ::warning(ErrorType::WARN_UNSUPPORTED,
+                          "%1%: table is not managed by the control-plane library, "
+                          "only scalar keys and action parameters are supported",
+                          table->table->container);
+                continue;
+            }
+            table->emitKeyType(builder);
+            table->emitValueType(builder);
+            table->emitControlPlaneFunctions(builder, true);
+            builder->newline();
+        }
+    }
+
+    // the list of a session or a group is created before its members are added
+    for (auto list : {"clone_session", "multicast_group"}) {
+        builder->appendFormat("int %s_create(int fd, __u32 id);\n"
+                              "int %s_delete(int fd, __u32 id);\n"
+                              "int %s_add_members(int fd, __u32 id, "
+                              "const struct clone_session_entry *entries, __u32 *count);\n"
+                              "int %s_delete_members(int fd, __u32 id, "
+                              "const struct clone_session_entry *entries, __u32 *count);",
+                              list, list, list, list);
+        builder->newline();
+    }
+    builder->newline();
+    builder->appendLine("#endif");
+}
+
+void PSAEbpfGenerator::emitControlPlaneSource(CodeBuilder *builder, cstring headerFile) const {
+    ingress->emitGeneratedComment(builder);
+    builder->appendLine("#include <endian.h>");
+    builder->appendLine("#include <errno.h>");
+    builder->appendLine("#include <stddef.h>");
+    builder->appendLine("#include <string.h>");
+    builder->appendLine("#include <unistd.h>");
+    builder->appendLine("#include <bpf/bpf.h>");
+    const char* headerName = headerFile.findlast('/');
+    builder->appendFormat("#include \"%s\"", headerName ? headerName + 1 : headerFile.c_str());
+    builder->newline();
+    builder->newline();
+
+    for (auto pipeline : {ingress, egress}) {
+        for (auto it : pipeline->control->tables) {
+            auto table = it.second->to<EBPFTablePSA>();
+            if (table != nullptr && table->hasControlPlaneFunctions())
+                table->emitControlPlaneFunctions(builder, false);
+        }
+    }
+
+    /*
+     * Clone sessions and multicast groups are lists stored in the inner hash maps
+     * of clone_session_tbl and multicast_grp_tbl, see do_for_each(). New members are
+     * linked right after the head, so the datapath always sees a consistent list.
+     */
+    builder->appendLine(
+            "static int replication_list_fd(int fd, __u32 id)\n"
+            "{\n"
+            "    __u32 inner_id;\n"
+            "    int ret = bpf_map_lookup_elem(fd, &id, &inner_id);\n"
+            "    if (ret)\n"
+            "        return ret;\n"
+            "    return bpf_map_get_fd_by_id(inner_id);\n"
+            "}\n"
+            "\n"
+            "static int replication_list_create(int fd, __u32 id)\n"
+            "{\n"
+            "    elem_t head_idx;\n"
+            "    struct element head;\n"
+            "    memset(&head_idx, 0, sizeof(head_idx));\n"
+            "    memset(&head, 0, sizeof(head));\n"
+            "    int inner_fd = bpf_map_create(BPF_MAP_TYPE_HASH, NULL, sizeof(elem_t),\n"
+            "                                  sizeof(struct element), CLONE_MAX_CLONES, NULL);\n"
+            "    if (inner_fd < 0)\n"
+            "        return inner_fd;\n"
+            "    int ret = bpf_map_update_elem(inner_fd, &head_idx, &head, BPF_NOEXIST);\n"
+            "    if (ret == 0)\n"
+            "        ret = bpf_map_update_elem(fd, &id, &inner_fd, BPF_ANY);\n"
+            "    close(inner_fd);\n"
+            "    return ret;\n"
+            "}\n"
+            "\n"
+            "static int replication_list_add(int fd, __u32 id,\n"
+            "                                const struct clone_session_entry *entries,\n"
+            "                                __u32 *count)\n"
+            "{\n"
+            "    elem_t head_idx, idx;\n"
+            "    struct element head, elem;\n"
+            "    __u32 n = *count;\n"
+            "    *count = 0;\n"
+            "    int inner_fd = replication_list_fd(fd, id);\n"
+            "    if (inner_fd < 0)\n"
+            "        return inner_fd;\n"
+            "    memset(&head_idx, 0, sizeof(head_idx));\n"
+            "    int ret = bpf_map_lookup_elem(inner_fd, &head_idx, &head);\n"
+            "    for (; ret == 0 && *count < n; (*count)++) {\n"
+            "        const struct clone_session_entry *entry = &entries[*count];\n"
+            "        if (entry->egress_port == 0 && entry->instance == 0) {\n"
+            "            ret = -EINVAL;  // reserved for the head of the list\n"
+            "            break;\n"
+            "        }\n"
+            "        memset(&idx, 0, sizeof(idx));\n"
+            "        idx.port = entry->egress_port;\n"
+            "        idx.instance = entry->instance;\n"
+            "        elem.entry = *entry;\n"
+            "        elem.next_id = head.next_id;\n"
+            "        ret = bpf_map_update_elem(inner_fd, &idx, &elem, BPF_NOEXIST);\n"
+            "        if (ret)\n"
+            "            break;\n"
+            "        head.next_id = idx;\n"
+            "        ret = bpf_map_update_elem(inner_fd, &head_idx, &head, BPF_EXIST);\n"
+            "    }\n"
+            "    close(inner_fd);\n"
+            "    return ret;\n"
+            "}\n"
+            "\n"
+            "static int replication_list_remove(int inner_fd, elem_t idx)\n"
+            "{\n"
+            "    elem_t prev_idx;\n"
+            "    struct element prev, elem;\n"
+            "    memset(&prev_idx, 0, sizeof(prev_idx));\n"
+            "    int ret = bpf_map_lookup_elem(inner_fd, &prev_idx, &prev);\n"
+            "    for (unsigned i = 0; ret == 0 && i < CLONE_MAX_CLONES; i++) {\n"
+            "        if (prev.next_id.port == 0 && prev.next_id.instance == 0)\n"
+            "            break;\n"
+            "        ret = bpf_map_lookup_elem(inner_fd, &prev.next_id, &elem);\n"
+            "        if (ret)\n"
+            "            return ret;\n"
+            "        if (prev.next_id.port == idx.port && "
+            "prev.next_id.instance == idx.instance) {\n"
+            "            prev.next_id = elem.next_id;\n"
+            "            ret = bpf_map_update_elem(inner_fd, &prev_idx, &prev, BPF_EXIST);\n"
+            "            if (ret)\n"
+            "                return ret;\n"
+            "            return bpf_map_delete_elem(inner_fd, &idx);\n"
+            "        }\n"
+            "        prev_idx = prev.next_id;\n"
+            "        prev = elem;\n"
+            "    }\n"
+            "    return ret ? ret : -ENOENT;\n"
+            "}\n"
+            "\n"
+            "static int replication_list_delete(int fd, __u32 id,\n"
+            "                                   const struct clone_session_entry *entries,\n"
+            "                                   __u32 *count)\n"
+            "{\n"
+            "    elem_t idx;\n"
+            "    __u32 n = *count;\n"
+            "    *count = 0;\n"
+            "    int inner_fd = replication_list_fd(fd, id);\n"
+            "    if (inner_fd < 0)\n"
+            "        return inner_fd;\n"
+            "    int ret = 0;\n"
+            "    for (; *count < n; (*count)++) {\n"
+            "        memset(&idx, 0, sizeof(idx));\n"
+            "        idx.port = entries[*count].egress_port;\n"
+            "        idx.instance = entries[*count].instance;\n"
+            "        ret = replication_list_remove(inner_fd, idx);\n"
+            "        if (ret)\n"
+            "            break;\n"
+            "    }\n"
+            "    close(inner_fd);\n"
+            "    return ret;\n"
+            "}");
+    builder->newline();
+
+    for (auto list : {"clone_session", "multicast_group"}) {
+        builder->appendFormat(
+                "int %s_create(int fd, __u32 id)\n"
+                "{\n"
+                "    return replication_list_create(fd, id);\n"
+                "}\n"
+                "\n"
+                "int %s_delete(int fd, __u32 id)\n"
+                "{\n"
+                "    return bpf_map_delete_elem(fd, &id);\n"
+                "}\n"
+                "\n"
+                "int %s_add_members(int fd, __u32 id, "
+                "const struct clone_session_entry *entries, __u32 *count)\n"
+                "{\n"
+                "    return replication_list_add(fd, id, entries, count);\n"
+                "}\n"
+                "\n"
+                "int %s_delete_members(int fd, __u32 id, "
+                "const struct clone_session_entry *entries, __u32 *count)\n"
+                "{\n"
+                "    return replication_list_delete(fd, id, entries, count);\n"
+                "}",
+                list, list, list, list);
+        builder->newline();
+        builder->newline();
+    }
+}
+
+// Returns the code of a trace message indented by the given number of levels, to be
+// substituted into templates of helper functions. Empty if tracing is disabled.
+static cstring traceMessageCode(const CodeBuilder *builder, int level, const char *format,
+                                const char *arg1 = nullptr, const char *arg2 = nullptr) {
+    CodeBuilder code(builder->target);
+    for (int i = 0; i < level; i++)
+        code.increaseIndent();
+    int argc = arg2 != nullptr ? 2 : (arg1 != nullptr ? 1 : 0);
+    builder->target->emitTraceMessage(&code, format, argc, arg1, arg2);
+    return code.toString();
+}
+
 void PSAEbpfGenerator::emitHelperFunctions(CodeBuilder *builder) const {
+    if (options.emitStats) {
+        cstring countDrop =
+            "static __always_inline\n"
+            "void count_drop(u32 reason)\n"
+            "{\n"
+            "    u64 *count = bpf_map_lookup_elem(&%drop_stats%, &reason);\n"
+            "    if (count != NULL) {\n"
+            "        (*count)++;\n"
+            "    }\n"
+            "}";
+        builder->appendLine(countDrop.replace("%drop_stats%",
+                                              builder->target->mapName("drop_stats")));
+        builder->newline();
+        cstring countTM =
+            "static __always_inline\n"
+            "void count_tm(u32 counter)\n"
+            "{\n"
+            "    u64 *count = bpf_map_lookup_elem(&%tm_stats%, &counter);\n"
+            "    if (count != NULL) {\n"
+            "        (*count)++;\n"
+            "    }\n"
+            "}";
+        builder->appendLine(countTM.replace("%tm_stats%", builder->target->mapName("tm_stats")));
+        builder->newline();
+    }
+
     cstring forEachFunc =
             "static __always_inline\n"
             "int do_for_each(SK_BUFF *skb, void *map, "
@@ -173,7 +733,7 @@ void PSAEbpfGenerator::emitHelperFunctions(CodeBuilder *builder) const {
             "        return -1;\n"
             "    }\n"
             "    if (elem->next_id.port == 0 && elem->next_id.instance == 0) {\n"
-            "       %trace_msg_no_elements%"
+                    "%trace_msg_no_elements%"
             "        return 0;\n"
             "    }\n"
             "    elem_t next_id = elem->next_id;\n"
@@ -190,12 +750,8 @@ void PSAEbpfGenerator::emitHelperFunctions(CodeBuilder *builder) const {
             "    }\n"
             "    return 0;\n"
             "}";
-    if (options.emitTraceMessages) {
-        forEachFunc = forEachFunc.replace("%trace_msg_no_elements%",
-            "        bpf_trace_message(\"do_for_each: No elements found in list\\n\");\n");
-    } else {
-        forEachFunc = forEachFunc.replace("%trace_msg_no_elements%", "");
-    }
+    forEachFunc = forEachFunc.replace("%trace_msg_no_elements%",
+        traceMessageCode(builder, 2, "do_for_each: No elements found in list"));
     builder->appendLine(forEachFunc);
     builder->newline();
 
@@ -206,20 +762,65 @@ void PSAEbpfGenerator::emitHelperFunctions(CodeBuilder *builder) const {
             "{\n"
             "    struct clone_session_entry *entry = (struct clone_session_entry *) data;\n"
                 "%trace_msg_redirect%"
-            "    bpf_clone_redirect(skb, entry->egress_port, 0);\n"
+            "%clone_redirect%"
             "}";
-    if (options.emitTraceMessages) {
-        cloneFunction = cloneFunction.replace(cstring("%trace_msg_redirect%"),
-            "    bpf_trace_message(\"do_clone: cloning pkt, egress_port=%d, cos=%d\\n\", "
-            "entry->egress_port, entry->class_of_service);\n");
+    if (options.emitStats) {
+        // copies are counted on their packet path, set by do_packet_clones()
+        cloneFunction = cloneFunction.replace(cstring("%clone_redirect%"),
+            "    struct psa_global_metadata *meta = (struct psa_global_metadata *) skb->cb;\n"
+            "    if (bpf_clone_redirect(skb, entry->egress_port, 0) == 0) {\n"
+            "        count_tm(meta->packet_path);\n"
+            "        count_tm(TM_STATS_CLONES);\n"
+            "    } else {\n"
+            "        count_tm(TM_STATS_CLONE_FAILURES);\n"
+            "    }\n");
     } else {
-        cloneFunction = cloneFunction.replace(cstring("%trace_msg_redirect%"), "");
+        cloneFunction = cloneFunction.replace(cstring("%clone_redirect%"),
+            "    bpf_clone_redirect(skb, entry->egress_port, 0);\n");
     }
+    cloneFunction = cloneFunction.replace(cstring("%trace_msg_redirect%"),
+        traceMessageCode(builder, 1, "do_clone: cloning pkt, egress_port=%d, cos=%d",
+                         "entry->egress_port", "entry->class_of_service"));
     builder->appendLine(cloneFunction);
     builder->newline();
 
-    cstring pktClonesFunc =
+    if (options.latencySampling > 0) {
+        // Records the time elapsed since start in the log2 histogram of a stage,
+        // returns the current time to measure the next block.
+        cstring latencyRecord =
             "static __always_inline\n"
+            "u64 latency_record(u32 stage, u64 start)\n"
+            "{\n"
+            "    u64 now = bpf_ktime_get_ns();\n"
+            "    u64 delta = now - start;\n"
+            "    u32 bucket = 0;\n"
+            "    if (delta >> 32) {\n"
+            "        bucket = LATENCY_HIST_BUCKETS - 1;\n"
+            "    } else {\n"
+            "        if (delta >> 16) { delta >>= 16; bucket += 16; }\n"
+            "        if (delta >> 8) { delta >>= 8; bucket += 8; }\n"
+            "        if (delta >> 4) { delta >>= 4; bucket += 4; }\n"
+            "        if (delta >> 2) { delta >>= 2; bucket += 2; }\n"
+            "        if (delta >> 1) { bucket += 1; }\n"
+            "    }\n"
+            "    struct latency_hist *hist = bpf_map_lookup_elem(&%latency_hist%, &stage);\n"
+            "    if (hist != NULL && bucket < LATENCY_HIST_BUCKETS) {\n"
+            "        hist->buckets[bucket]++;\n"
+            "    }\n"
+            "    return now;\n"
+            "}";
+        builder->appendLine(latencyRecord.replace("%latency_hist%",
+                                                  builder->target->mapName("latency_hist")));
+        builder->newline();
+    }
+
+    // do_packet_clones() is called from several places, so it is generated as a subprogram.
+    // BPF-to-BPF calls cannot be mixed with tail calls (used by split pipelines and
+    // --recirculate-tail-call) before Linux 5.10.
+    bool useTailCalls = ingress->isSplit() || egress->isSplit() ||
+                        options.recirculateTailCall;
+    cstring pktClonesFunc =
+            "%function_attr%\n"
             "int do_packet_clones(SK_BUFF * skb, void * map, __u32 session_id, "
                 "PSA_PacketPath_t new_pkt_path, __u8 caller_id)\n"
             "{\n"
@@ -228,6 +829,7 @@ void PSAEbpfGenerator::emitHelperFunctions(CodeBuilder *builder) const {
             "    void * inner_map;\n"
             "    inner_map = bpf_map_lookup_elem(map, &session_id);\n"
             "    if (inner_map != NULL) {\n"
+                "%count_replication%"
             "        PSA_PacketPath_t original_pkt_path = meta->packet_path;\n"
             "        meta->packet_path = new_pkt_path;\n"
             "        if (do_for_each(skb, inner_map, CLONE_MAX_CLONES, &do_clone) < 0) {\n"
@@ -236,31 +838,45 @@ void PSAEbpfGenerator::emitHelperFunctions(CodeBuilder *builder) const {
             "        }\n"
             "        meta->packet_path = original_pkt_path;\n"
             "    } else {\n"
+                    "%count_missing_session%"
                     "%trace_msg_no_session%"
             "    }\n"
                 "%trace_msg_cloning_done%"
             "    return 0;\n"
             " }";
-    if (options.emitTraceMessages) {
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_clone_requested%"),
-            "    bpf_trace_message(\"Clone#%d: pkt clone requested, session=%d\\n\", "
-            "caller_id, session_id);\n");
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_clone_failed%"),
-            "            bpf_trace_message(\"Clone#%d: failed to clone packet\", caller_id);\n");
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_no_session%"),
-            "        bpf_trace_message(\"Clone#%d: session_id not found, "
-            "no clones created\\n\", caller_id);\n");
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_cloning_done%"),
-            "    bpf_trace_message(\"Clone#%d: packet cloning finished\\n\", caller_id);\n");
-    } else {
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_clone_requested%"), "");
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_clone_failed%"), "");
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_no_session%"), "");
-        pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_cloning_done%"), "");
-    }
+    pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_clone_requested%"),
+        traceMessageCode(builder, 1, "Clone#%d: pkt clone requested, session=%d",
+                         "caller_id", "session_id"));
+    pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_clone_failed%"),
+        traceMessageCode(builder, 3, "Clone#%d: failed to clone packet", "caller_id"));
+    pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_no_session%"),
+        traceMessageCode(builder, 2, "Clone#%d: session_id not found, no clones created",
+                         "caller_id"));
+    pktClonesFunc = pktClonesFunc.replace(cstring("%trace_msg_cloning_done%"),
+        traceMessageCode(builder, 1, "Clone#%d: packet cloning finished", "caller_id"));
+
+    pktClonesFunc = pktClonesFunc.replace(cstring("%count_replication%"),
+        options.emitStats ? "        count_tm(TM_STATS_REPLICATIONS);\n" : "");
+    pktClonesFunc = pktClonesFunc.replace(cstring("%count_missing_session%"),
+        options.emitStats ? "        count_tm(TM_STATS_MISSING_SESSIONS);\n" : "");
+
+    pktClonesFunc = pktClonesFunc.replace(cstring("%function_attr%"),
+        useTailCalls ? "static __always_inline" : "static __noinline");
 
     builder->appendLine(pktClonesFunc);
     builder->newline();
+
+    if (ingress->control->tableSubprograms.empty() &&
+        egress->control->tableSubprograms.empty())
+        return;
+
+    builder->appendLine("struct table_apply_result {\n"
+                        "    u8 hit;\n"
+                        "    unsigned int action_run;\n"
+                        "};");
+    builder->newline();
+    ingress->control->emitTableSubprograms(builder);
+    egress->control->emitTableSubprograms(builder);
 }
 
 // =====================PSAArchTC=============================
@@ -349,6 +965,41 @@ void PSAArchTC::emitInitializerSection(CodeBuilder *builder) const {
     builder->appendLine("SEC(\"classifier/map-initializer\")");
 }
 
+/*
+ * Finds fields of an input metadata parameter (e.g. the input standard metadata) read by a block.
+ * A reference to the whole structure (e.g. a copy made by the inliner) uses all its fields.
+ */
+class InputMetadataUsage : public Inspector {
+    P4::ReferenceMap* refMap;
+    P4::TypeMap* typeMap;
+    const IR::Parameter* param;
+    std::set<cstring>& fields;
+
+ public:
+    InputMetadataUsage(P4::ReferenceMap* refMap, P4::TypeMap* typeMap,
+                       const IR::Parameter* param, std::set<cstring>& fields) :
+            refMap(refMap), typeMap(typeMap), param(param), fields(fields) {}
+
+    bool preorder(const IR::Member* member) override {
+        auto pe = member->expr->to<IR::PathExpression>();
+        if (pe != nullptr && refMap->getDeclaration(pe->path) == param) {
+            fields.insert(member->member.name);
+            return false;
+        }
+        return true;
+    }
+
+    bool preorder(const IR::PathExpression* pe) override {
+        if (refMap->getDeclaration(pe->path) != param)
+            return false;
+        auto type = typeMap->getType(param, true)->to<IR::Type_StructLike>();
+        BUG_CHECK(type != nullptr, "%1%: expected a structure", param);
+        for (auto field : type->fields)
+            fields.insert(field->name.name);
+        return false;
+    }
+};
+
 // =====================ConvertToEbpfPSA=============================
 const PSAEbpfGenerator * ConvertToEbpfPSA::build(const IR::ToplevelBlock *tlb) {
     /*
@@ -419,6 +1070,45 @@ const PSAEbpfGenerator * ConvertToEbpfPSA::build(const IR::ToplevelBlock *tlb) {
     tlb->getProgram()->apply(*egress_pipeline_converter);
     auto tcEgress = egress_pipeline_converter->getEbpfPipeline();
 
+    // normal_meta is bridged to the Egress pipeline only if the Egress parser reads it
+    auto egressParserBlock = egressParser->to<IR::ParserBlock>();
+    auto normalMeta = egressParserBlock->container->getApplyParameters()->parameters.at(4);
+    std::set<cstring> normalMetaFields;
+    InputMetadataUsage normalMetaUsage(refmap, typemap, normalMeta, normalMetaFields);
+    egressParserBlock->container->apply(normalMetaUsage);
+    if (!normalMetaFields.empty()) {
+        auto ingressBridged = new EBPFBridgedMetadataPSA(tcIngress,
+                                                         tcIngress->deparser->normal_meta);
+        if (!ingressBridged->isEmpty()) {
+            tcIngress->bridgedMetadata = ingressBridged;
+            tcEgress->bridgedMetadata = new EBPFBridgedMetadataPSA(tcEgress, normalMeta);
+        }
+        if (ingressBridged->isInPacket()) {
+            // headers are moved by the prepended metadata, they have to be written again
+            for (auto pipeline : {tcIngress, tcEgress}) {
+                pipeline->deparser->unmodifiedHeaders.clear();
+                pipeline->deparser->encapOuterHeader = nullptr;
+                pipeline->parser->deferredFields.clear();
+                pipeline->parser->deferredExtracts.clear();
+            }
+        }
+    }
+
+    if (options.recirculateTailCall)
+        tcEgress->to<EBPFEgressPipeline>()->limitRecirculateDepth(tcIngress);
+
+    if (options.emitStats) {
+        // tables of both pipelines are numbered by their position in the table_stats map
+        int statsId = 0;
+        for (auto pipeline : {tcIngress, tcEgress}) {
+            for (auto it : pipeline->control->tables) {
+                auto table = it.second->to<EBPFTablePSA>();
+                if (table != nullptr)
+                    table->statsId = statsId++;
+            }
+        }
+    }
+
     return new PSAArchTC(options, ebpfTypes, xdp, tcIngress, tcEgress);
 }
 
@@ -458,6 +1148,46 @@ bool ConvertToEbpfPipeline::preorder(const IR::PackageBlock *block) {
     deparserBlock->apply(*deparser_converter);
     pipeline->deparser = deparser_converter->getEBPFDeparser();
     CHECK_NULL(pipeline->deparser);
+    // the input metadata of the parser and the control block are emitted as one variable
+    auto parserParams = parserBlock->container->getApplyParameters();
+    InputMetadataUsage parserUsage(refmap, typemap, parserParams->parameters.at(3),
+                                   pipeline->usedInputMetadata);
+    parserBlock->container->apply(parserUsage);
+    InputMetadataUsage controlUsage(refmap, typemap, pipeline->control->inputStandardMetadata,
+                                    pipeline->usedInputMetadata);
+    controlBlock->container->apply(controlUsage);
+    pipeline->deparser->findUnmodifiedHeaders(pipeline->parser, pipeline->control);
+    pipeline->deparser->findTunnelEncapsulation();
+    if (type == TC_EGRESS) {
+        // packets leave through the port chosen by the Ingress pipeline without being processed
+        auto egress = pipeline->to<EBPFEgressPipeline>();
+        egress->passThrough = egress->hasEmptyBlocks();
+        if (egress->passThrough)
+            return true;
+        // fields that are never read are loaded by the deparser, only if it has to write them
+        pipeline->deparser->findDeferredFields(pipeline->parser, pipeline->control);
+    }
+    pipeline->splitIntoStages(options.maxProgramInstructions);
+    // BPF-to-BPF calls cannot be mixed with tail calls, see do_packet_clones()
+    if (!pipeline->isSplit() && !options.recirculateTailCall)
+        pipeline->control->chooseTableSubprograms();
+    if (type == TC_INGRESS && options.flowCacheSize > 0) {
+        if (pipeline->isSplit()) {
+            ::warning(ErrorType::WARN_UNSUPPORTED,
+                      "%1%: flow cache is not supported for pipelines split into several programs",
+                      pipeline->control->controlBlock->container);
+        } else {
+            auto flowCache = new EBPFFlowCachePSA(pipeline, pipeline->control,
+                                                  options.flowCacheSize);
+            if (flowCache->build()) {
+                pipeline->to<EBPFIngressPipeline>()->flowCache = flowCache;
+            } else {
+                ::warning(ErrorType::WARN_UNSUPPORTED,
+                          "%1%: flow cache disabled, the control block uses externs or fields "
+                          "not supported by the cache", pipeline->control->controlBlock->container);
+            }
+        }
+    }
 
     return true;
 }
@@ -486,6 +1216,7 @@ bool ConvertToEBPFParserPSA::preorder(const IR::ParserBlock *prsr) {
     parser->packet = *it; ++it;
     parser->headers = *it; ++it;
     parser->user_metadata = *it;
+    // resubmit_meta in the Ingress parser, normal_meta in the Egress parser
     auto resubmit_meta = *(it + 2);
 
     for (auto state : prsr->container->states) {
@@ -498,7 +1229,9 @@ bool ConvertToEBPFParserPSA::preorder(const IR::ParserBlock *prsr) {
         return false;
     parser->headerType = EBPFTypeFactory::instance->create(ht);
 
-    parser->visitor->useAsPointerVariable(resubmit_meta->name.name);
+    if (type == TC_INGRESS) {
+        parser->visitor->useAsPointerVariable(resubmit_meta->name.name);
+    }
     parser->visitor->useAsPointerVariable(parser->user_metadata->name.name);
     parser->visitor->useAsPointerVariable(parser->headers->name.name);
 
@@ -520,7 +1253,7 @@ bool ConvertToEBPFControlPSA::preorder(const IR::ControlBlock *ctrl) {
     control->inputStandardMetadata = *it; ++it;
     control->outputStandardMetadata = *it;
 
-    auto codegen = new ControlBodyTranslator(control);
+    auto codegen = new ControlBodyTranslatorPSA(control);
     codegen->substitute(control->headers, parserHeaders);
 
     if (type != TC_EGRESS) {
@@ -549,11 +1282,6 @@ bool ConvertToEBPFControlPSA::preorder(const IR::TableBlock *tblblk) {
     auto keyGenerator = tblblk->container->getKey();
     if (keyGenerator != nullptr) {
         for (auto it : keyGenerator->keyElements) {
-            // optimization: check if we should generate timestamp
-            if (it->expression->toString().endsWith("timestamp")) {
-                control->timestampIsUsed = true;
-            }
-
             auto mtdecl = refmap->getDeclaration(it->matchType->path, true);
             auto matchType = mtdecl->getNode()->to<IR::Declaration_ID>();
             if (matchType->name.name != P4::P4CoreLibrary::instance.exactMatch.name &&
@@ -578,26 +1306,6 @@ bool ConvertToEBPFControlPSA::preorder(const IR::TableBlock *tblblk) {
     return true;
 }
 
-bool ConvertToEBPFControlPSA::preorder(const IR::Member *m) {
-    // the condition covers both ingress and egress timestamp
-    if (m->member.name.endsWith("timestamp")) {
-        control->timestampIsUsed = true;
-    }
-
-    return true;
-}
-
-bool ConvertToEBPFControlPSA::preorder(const IR::IfStatement *ifState) {
-    if (ifState->condition->is<IR::Equ>()) {
-        auto i = ifState->condition->to<IR::Equ>();
-        if (i->right->toString().endsWith("timestamp") ||
-            i->left->toString().endsWith("timestamp")) {
-            control->timestampIsUsed = true;
-        }
-    }
-    return true;
-}
-
 bool ConvertToEBPFControlPSA::preorder(const IR::Declaration_Variable* decl) {
     if (type == TC_INGRESS) {
         if (decl->type->is<IR::Type_Name>() &&
@@ -608,6 +1316,18 @@ bool ConvertToEBPFControlPSA::preorder(const IR::Declaration_Variable* decl) {
     return true;
 }
 
+bool ConvertToEBPFControlPSA::preorder(const IR::ExternBlock* instance) {
+    auto di = instance->node->to<IR::Declaration_Instance>();
+    if (di == nullptr)
+        return false;
+    cstring name = EBPFObject::externalName(di);
+    if (instance->type->name == PacketSampler_Model::instance.name) {
+        auto sampler = new EBPFPacketSamplerPSA(program, instance, name, control->codeGen);
+        control->samplers.emplace(name, sampler);
+    }
+    return false;
+}
+
 // =====================EBPFDeparser=============================
 bool ConvertToEBPFDeparserPSA::preorder(const IR::ControlBlock *ctrl) {
     if (type == TC_INGRESS) {
@@ -624,10 +1344,13 @@ bool ConvertToEBPFDeparserPSA::preorder(const IR::ControlBlock *ctrl) {
 
     deparser->codeGen->substitute(deparser->headers, parserHeaders);
     deparser->codeGen->useAsPointerVariable(deparser->headers->name.name);
+    // user metadata is emitted with the name of the control block parameter
+    auto controlUserMetadata = program->to<EBPFPipeline>()->control->user_metadata;
+    deparser->codeGen->substitute(deparser->user_metadata, controlUserMetadata);
+    deparser->codeGen->useAsPointerVariable(deparser->user_metadata->name.name);
 
     if (type == TC_INGRESS) {
         deparser->codeGen->useAsPointerVariable(deparser->resubmit_meta->name.name);
-        deparser->codeGen->useAsPointerVariable(deparser->user_metadata->name.name);
     }
 
     if (ctrl->container->is<IR::P4Control>()) {
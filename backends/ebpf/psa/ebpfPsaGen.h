@@ -28,6 +28,8 @@ limitations under the License.
 
 namespace EBPF {
 
+class EBPFTablePSA;
+
 enum pipeline_type {
     TC_INGRESS,
     TC_EGRESS
@@ -37,6 +39,9 @@ class PSAEbpfGenerator {
  public:
     static const unsigned MaxClones = 64;
     static const unsigned MaxCloneSessions = 1024;
+    static const unsigned LatencyHistBuckets = 32;
+    // parser, control, deparser and Traffic Manager of both pipelines
+    static const unsigned LatencyStages = 8;
 
     const EbpfOptions&     options;
     std::vector<EBPFType*> ebpfTypes;
@@ -54,6 +59,7 @@ class PSAEbpfGenerator {
     virtual void emitPreamble(CodeBuilder* builder) const;
     void emitCommonPreamble(CodeBuilder *builder) const;
     void emitInternalStructures(CodeBuilder* pBuilder) const;
+    void emitReplicationListTypes(CodeBuilder *builder) const;
     void emitTypes(CodeBuilder *builder) const;
     void emitGlobalHeadersMetadata(CodeBuilder *builder) const;
     virtual void emitInstances(CodeBuilder *builder) const = 0;
@@ -61,7 +67,29 @@ class PSAEbpfGenerator {
     void emitPipelineInstances(CodeBuilder *builder) const;
     void emitInitializer(CodeBuilder *builder) const;
     virtual void emitInitializerSection(CodeBuilder *builder) const = 0;
+    // Writes initial entries of tables to the manifest, they are then skipped by
+    // the map initializer program. Must be called before emit().
+    void emitMapInitManifest(std::ostream& out) const;
+    // Writes layouts of keys and values of maps of tables and of counters, to find maps
+    // which can be reused by a new version of the program.
+    void emitMapLayoutManifest(std::ostream& out) const;
+    // Typed control-plane library managing entries of tables and packet replication lists.
+    void emitControlPlaneHeader(CodeBuilder *builder) const;
+    void emitControlPlaneSource(CodeBuilder *builder, cstring headerFile) const;
     void emitHelperFunctions(CodeBuilder *builder) const;
+    // Tables counting hits, misses and executed actions in the table_stats map.
+    std::vector<EBPFTablePSA*> statsTables() const;
+    void emitTableStatsType(CodeBuilder *builder) const;
+    // Drop reasons counted in the drop_stats map.
+    void emitDropReasons(CodeBuilder *builder) const;
+    // Packet path and replication counters of the Traffic Manager in the tm_stats map.
+    void emitTrafficManagerCounters(CodeBuilder *builder) const;
+    // Per-stage latency histograms in the latency_hist map (--latency-histograms).
+    void emitLatencyHistogramType(CodeBuilder *builder) const;
+    // Header of packets sent to user space by --cpu-port-perf-buffer.
+    void emitCPUPortPacketType(CodeBuilder *builder) const;
+    // True if a control block instantiates a PacketSampler extern.
+    bool hasPacketSamplers() const;
 };
 
 class PSAArchTC : public PSAEbpfGenerator {
@@ -167,8 +195,7 @@ class ConvertToEBPFControlPSA : public Inspector {
     bool preorder(const IR::TableBlock *) override;
     bool preorder(const IR::ControlBlock *) override;
     bool preorder(const IR::Declaration_Variable*) override;
-    bool preorder(const IR::Member *m) override;
-    bool preorder(const IR::IfStatement *a) override;
+    bool preorder(const IR::ExternBlock*) override;
 
     EBPF::EBPFControlPSA *getEBPFControl() { return control; }
 };
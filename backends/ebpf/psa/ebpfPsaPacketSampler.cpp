@@ -0,0 +1,138 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ebpfPsaPacketSampler.h"
+#include "frontends/p4/methodInstance.h"
+
+namespace EBPF {
+
+PacketSampler_Model PacketSampler_Model::instance;
+
+EBPFPacketSamplerPSA::EBPFPacketSamplerPSA(const EBPFProgram* program,
+                                           const IR::ExternBlock* block,
+                                           cstring name, CodeGenInspector* codeGen) :
+        EBPFTableBase(program, name, codeGen), snaplen(0) {
+    dataMapName = instanceName + "_samples";
+    rateMapName = instanceName + "_rate";
+
+    auto sz = block->getParameterValue(PacketSampler_Model::instance.snaplen.name);
+    if (sz == nullptr || !sz->is<IR::Constant>()) {
+        ::error(ErrorType::ERR_INVALID,
+                "%1% (%2%): expected an integer argument; is the model corrupted?",
+                PacketSampler_Model::instance.snaplen, name);
+        return;
+    }
+    auto cst = sz->to<IR::Constant>();
+    if (!cst->fitsUint() || cst->asUnsigned() == 0) {
+        ::error(ErrorType::ERR_INVALID, "%1%: snaplen must be a positive integer", cst);
+        return;
+    }
+    snaplen = cst->asUnsigned();
+}
+
+void EBPFPacketSamplerPSA::emitSampleType(CodeBuilder* builder) {
+    builder->appendLine("/*\n"
+                        " * Written by a PacketSampler into its perf event array, followed by\n"
+                        " * captured_length bytes of the packet.\n"
+                        " */\n"
+                        "struct packet_sample {\n"
+                        "    u32 ingress_port;\n"
+                        "    u32 egress_port;\n"
+                        "    u32 packet_path;\n"
+                        "    u32 sampling_rate;\n"
+                        "    u32 packet_length;\n"
+                        "    u32 captured_length;\n"
+                        "};");
+}
+
+void EBPFPacketSamplerPSA::emitInstance(CodeBuilder* builder) {
+    builder->target->emitTableDecl(builder, rateMapName, TableArray, "u32", "u32", 1);
+    builder->target->emitPerfEventArrayDecl(builder, dataMapName);
+}
+
+void EBPFPacketSamplerPSA::emitMethodInvocation(CodeBuilder* builder,
+                                                const P4::ExternMethod* method) {
+    if (method->method->name.name != PacketSampler_Model::instance.sample.name) {
+        ::error(ErrorType::ERR_UNSUPPORTED,
+                "%1%: Unexpected method call", method->expr);
+        return;
+    }
+    auto args = method->expr->arguments;
+    BUG_CHECK(args->size() == 3, "%1%: expected 3 arguments", method->expr);
+
+    cstring keyName = program->refMap->newName("key");
+    cstring rateName = program->refMap->newName("sampling_rate");
+    cstring sampleName = program->refMap->newName("sample");
+    cstring skb = program->model.CPacketName.str();
+
+    builder->emitIndent();
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendFormat("u32 %s = 0", keyName.c_str());
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("u32 *%s", rateName.c_str());
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->target->emitTableLookup(builder, rateMapName, keyName, rateName);
+    builder->endOfStatement(true);
+
+    builder->emitIndent();
+    builder->appendFormat("if (%s != NULL && *%s != 0 && bpf_get_prandom_u32() %% *%s == 0) ",
+                          rateName.c_str(), rateName.c_str(), rateName.c_str());
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendFormat("struct packet_sample %s = ", sampleName.c_str());
+    builder->blockStart();
+    const char* fields[] = {"ingress_port", "egress_port", "packet_path"};
+    for (size_t i = 0; i < args->size(); i++) {
+        builder->emitIndent();
+        builder->appendFormat(".%s = ", fields[i]);
+        codeGen->visit(args->at(i));
+        builder->appendLine(",");
+    }
+    builder->emitIndent();
+    builder->appendFormat(".sampling_rate = *%s,", rateName.c_str());
+    builder->newline();
+    builder->emitIndent();
+    builder->appendFormat(".packet_length = %s->len,", skb.c_str());
+    builder->newline();
+    builder->blockEnd(false);
+    builder->endOfStatement(true);
+
+    // bpf_perf_event_output() fails if more bytes than the packet length are requested
+    builder->emitIndent();
+    builder->appendFormat("%s.captured_length = %s.packet_length < %u ? %s.packet_length : %u",
+                          sampleName.c_str(), sampleName.c_str(), snaplen,
+                          sampleName.c_str(), snaplen);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("bpf_perf_event_output(%s, &%s, "
+                          "BPF_F_CURRENT_CPU | ((u64) %s.captured_length << 32), "
+                          "&%s, sizeof(%s))",
+                          skb.c_str(), builder->target->mapName(dataMapName).c_str(),
+                          sampleName.c_str(),
+                          sampleName.c_str(), sampleName.c_str());
+    builder->endOfStatement(true);
+    cstring msgStr = Util::printf_format("PacketSampler: %s sampled the packet",
+                                         instanceName.c_str());
+    builder->target->emitTraceMessage(builder, msgStr.c_str());
+    builder->blockEnd(true);
+    builder->blockEnd(true);
+}
+
+}  // namespace EBPF
@@ -0,0 +1,59 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef BACKENDS_EBPF_PSA_EBPFPSAPACKETSAMPLER_H_
+#define BACKENDS_EBPF_PSA_EBPFPSAPACKETSAMPLER_H_
+
+#include "frontends/common/model.h"
+#include "backends/ebpf/ebpfTable.h"
+
+namespace EBPF {
+
+// Keep this in sync with p4include/ebpf_psa.p4
+struct PacketSampler_Model : public ::Model::Extern_Model {
+    PacketSampler_Model() : Extern_Model("PacketSampler"),
+                            snaplen("snaplen"), sample("sample") {}
+    ::Model::Elem snaplen;
+    ::Model::Elem sample;
+
+    static PacketSampler_Model instance;
+};
+
+/*
+ * Implements the PacketSampler extern: 1 out of N packets is sent to user space
+ * through a perf event array, N is read from an array map so that the control plane
+ * can change it at runtime. A sample is a struct packet_sample followed by
+ * the first snaplen bytes of the packet.
+ */
+class EBPFPacketSamplerPSA : public EBPFTableBase {
+ protected:
+    unsigned snaplen;
+
+ public:
+    cstring rateMapName;
+
+    EBPFPacketSamplerPSA(const EBPFProgram* program, const IR::ExternBlock* block,
+                         cstring name, CodeGenInspector* codeGen);
+
+    // Emits the definition of struct packet_sample, shared by all samplers.
+    static void emitSampleType(CodeBuilder* builder);
+    void emitInstance(CodeBuilder* builder);
+    void emitMethodInvocation(CodeBuilder* builder, const P4::ExternMethod* method);
+};
+
+}  // namespace EBPF
+
+#endif  /* BACKENDS_EBPF_PSA_EBPFPSAPACKETSAMPLER_H_ */
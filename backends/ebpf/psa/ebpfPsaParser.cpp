@@ -114,6 +114,7 @@ void EBPFPsaParser::emitRejectState(CodeBuilder* builder) {
     builder->blockStart();
     builder->target->emitTraceMessage(builder,
         "Parser: Explicit transition to reject state, dropping packet..");
+    program->emitDropCount(builder, "PARSER_REJECT");
     builder->emitIndent();
     builder->appendFormat("return %s", builder->target->abortReturnCode().c_str());
     builder->endOfStatement(true);
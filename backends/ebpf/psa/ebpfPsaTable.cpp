@@ -15,8 +15,14 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 #include <algorithm>
+#include <cctype>
+#include <functional>
+#include <iomanip>
+#include <set>
+#include <sstream>
 
 #include "backends/ebpf/ebpfType.h"
+#include "lib/hash.h"
 #include "ebpfPsaTable.h"
 #include "ebpfPipeline.h"
 
@@ -40,24 +46,81 @@ EBPFTablePSA::EBPFTablePSA(const EBPFProgram* program, const IR::TableBlock* tab
         }
         this->size = 1;
     }
+
+    auto defaultActionProperty = table->container->properties->getProperty(
+            IR::TableProperties::defaultActionPropertyName);
+    constDefaultAction = defaultActionProperty != nullptr && defaultActionProperty->isConstant;
+    constEntriesCompiled = checkConstEntriesCompiled();
+    denseArray = !constEntriesCompiled && checkDenseArray();
+    statsVariable = program->refMap->newName("stats");
+}
+
+/*
+ * Tables with up to maxCompiledConstEntries const entries only, matched on exact or LPM fields
+ * not wider than 64 bits, are compiled into a chain of conditions, so they do not need a BPF map.
+ * A map lookup is cheaper than a longer chain.
+ */
+bool EBPFTablePSA::checkConstEntriesCompiled() const {
+    auto entriesProperty = table->container->properties->getProperty(
+            IR::TableProperties::entriesPropertyName);
+    if (keyGenerator == nullptr || entriesProperty == nullptr || !entriesProperty->isConstant)
+        return false;
+    if (table->container->getEntries()->size() > maxCompiledConstEntries)
+        return false;
+    for (auto keyElement : keyGenerator->keyElements) {
+        auto scalar = ::get(keyTypes, keyElement)->to<EBPFScalarType>();
+        if (scalar == nullptr || !EBPFScalarType::generatesScalar(scalar->widthInBits()))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Tables matched on a single exact field not wider than 16 bits, whose size covers
+ * all values of the field, are stored in an array map indexed by the field.
+ * Array elements always exist, so the value carries a flag marking installed entries.
+ */
+bool EBPFTablePSA::checkDenseArray() const {
+    if (keyGenerator == nullptr || keyGenerator->keyElements.size() != 1)
+        return false;
+    auto keyElement = keyGenerator->keyElements.at(0);
+    if (keyElement->matchType->path->name.name != P4::P4CoreLibrary::instance.exactMatch.name)
+        return false;
+    auto scalar = ::get(keyTypes, keyElement)->to<EBPFScalarType>();
+    if (scalar == nullptr || scalar->widthInBits() > 16)
+        return false;
+    return size >= (size_t(1) << scalar->widthInBits());
 }
 
 void EBPFTablePSA::emitValueStructStructure(CodeBuilder* builder) {
     // TODO: placeholder for handling psa_implementation
     EBPFTable::emitValueStructStructure(builder);
+
+    if (denseArray) {
+        builder->emitIndent();
+        builder->append("u8 valid");
+        builder->endOfStatement(true);
+    }
 }
 
 void EBPFTablePSA::emitInstance(CodeBuilder *builder) {
-    if (keyGenerator != nullptr) {
+    if (denseArray) {
+        auto keyElement = keyGenerator->keyElements.at(0);
+        auto width = ::get(keyTypes, keyElement)->to<EBPFScalarType>()->widthInBits();
+        emitTableDecl(builder, instanceName, TableArray, program->arrayIndexType,
+                      cstring("struct ") + valueTypeName, size_t(1) << width);
+    } else if (hasDataMap()) {
         TableKind kind = isLPMTable() ? TableLPMTrie : TableHash;
         emitTableDecl(builder, instanceName, kind,
                       cstring("struct ") + keyTypeName,
                       cstring("struct ") + valueTypeName, size);
     }
 
-    emitTableDecl(builder, defaultActionMapName, TableArray,
-                  program->arrayIndexType,
-                  cstring("struct ") + valueTypeName, 1);
+    if (!constDefaultAction) {
+        emitTableDecl(builder, defaultActionMapName, TableArray,
+                      program->arrayIndexType,
+                      cstring("struct ") + valueTypeName, 1);
+    }
 }
 
 void EBPFTablePSA::emitTableDecl(CodeBuilder *builder,
@@ -84,8 +147,502 @@ void EBPFTablePSA::emitAction(CodeBuilder* builder, cstring valueName, cstring a
 }
 
 void EBPFTablePSA::emitInitializer(CodeBuilder *builder) {
-    this->emitDefaultActionInitializer(builder);
-    this->emitConstEntriesInitializer(builder);
+    if (initialEntriesInManifest)
+        return;
+    if (!constDefaultAction)
+        this->emitDefaultActionInitializer(builder);
+    if (!constEntriesCompiled)
+        this->emitConstEntriesInitializer(builder);
+}
+
+namespace {
+
+// Bytes of a C structure emitted for a BPF map key or value,
+// laid out as by the C compiler for a little-endian target.
+class StructImage {
+ public:
+    std::vector<uint8_t> bytes;
+    unsigned alignment = 1;
+
+    void align(unsigned fieldAlignment) {
+        alignment = std::max(alignment, fieldAlignment);
+        while (bytes.size() % fieldAlignment != 0)
+            bytes.push_back(0);
+    }
+    void append(big_int value, unsigned size, unsigned fieldAlignment, bool networkOrder) {
+        align(fieldAlignment);
+        if (value < 0)
+            value += big_int(1) << (size * 8);
+        std::vector<uint8_t> field;
+        for (unsigned i = 0; i < size; i++) {
+            field.push_back(static_cast<uint8_t>(static_cast<unsigned>(value & 0xff)));
+            value >>= 8;
+        }
+        if (networkOrder)
+            std::reverse(field.begin(), field.end());
+        bytes.insert(bytes.end(), field.begin(), field.end());
+    }
+    void append(const StructImage& member, size_t size, unsigned memberAlignment) {
+        align(memberAlignment);
+        size_t end = bytes.size() + size;
+        bytes.insert(bytes.end(), member.bytes.begin(), member.bytes.end());
+        bytes.resize(end, 0);
+    }
+    // Pads the structure to a multiple of its alignment.
+    void finish() { align(alignment); }
+    cstring toString() const {
+        std::stringstream out;
+        for (auto b : bytes)
+            out << std::hex << std::setw(2) << std::setfill('0') << unsigned(b);
+        return out.str();
+    }
+};
+
+// Size and alignment of a C field declared for the type, false if it is not a scalar.
+// Fields wider than 64 bits are byte arrays stored in the network byte order.
+bool fieldLayout(EBPFType* type, unsigned& size, unsigned& alignment, bool& byteArray) {
+    byteArray = false;
+    if (type->is<EBPFBoolType>()) {
+        size = alignment = 1;
+        return true;
+    }
+    auto scalar = type->to<EBPFScalarType>();
+    if (scalar == nullptr)
+        return false;
+    if (EBPFScalarType::generatesScalar(scalar->widthInBits())) {
+        size = alignment = scalar->alignment();
+        return true;
+    }
+    // partial bytes of wide fields are shifted by the parser
+    if (scalar->widthInBits() % 8 != 0)
+        return false;
+    size = scalar->bytesRequired();
+    alignment = 1;
+    byteArray = true;
+    return true;
+}
+
+bool constantValue(const IR::Expression* expression, big_int& value) {
+    if (auto constant = expression->to<IR::Constant>()) {
+        value = constant->value;
+        return true;
+    }
+    if (auto boolLiteral = expression->to<IR::BoolLiteral>()) {
+        value = boolLiteral->value ? 1 : 0;
+        return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+// =====================MapLayout================================
+void MapLayout::append(cstring type, unsigned fieldSize, unsigned fieldAlignment) {
+    alignment = std::max(alignment, fieldAlignment);
+    size = ROUNDUP(size, fieldAlignment) * fieldAlignment;
+    fields += std::string(type) + "@" + std::to_string(size) + ":" +
+              std::to_string(fieldSize) + ";";
+    size += fieldSize;
+}
+
+void MapLayout::append(EBPFType* type, bool networkOrder) {
+    if (type->is<EBPFBoolType>()) {
+        append("bool", 1, 1);
+        return;
+    }
+    if (auto scalar = type->to<EBPFScalarType>()) {
+        std::string name = std::string(scalar->isSigned ? "int<" : "bit<") +
+                           std::to_string(scalar->widthInBits()) + ">";
+        if (EBPFScalarType::generatesScalar(scalar->widthInBits())) {
+            append(networkOrder ? name + " be" : name, scalar->alignment(), scalar->alignment());
+        } else {
+            // wider fields are byte arrays in the network byte order
+            append(name + " be", scalar->bytesRequired(), 1);
+        }
+        return;
+    }
+    unsigned width = 0;
+    if (auto wt = type->to<IHasWidth>())
+        width = wt->implementationWidthInBits();
+    append(type->type->toString(), ROUNDUP(width, 8), 1);
+}
+
+void MapLayout::appendUnion(const std::vector<MapLayout>& members) {
+    std::string description = "union{";
+    unsigned unionSize = 0, unionAlignment = 1;
+    for (auto& member : members) {
+        description += "{" + member.fields + "}";
+        unionSize = std::max(unionSize, member.size);
+        unionAlignment = std::max(unionAlignment, member.alignment);
+    }
+    append(description + "}", ROUNDUP(unionSize, unionAlignment) * unionAlignment,
+           unionAlignment);
+}
+
+void MapLayout::finish(unsigned minAlignment) {
+    alignment = std::max(alignment, minAlignment);
+    size = ROUNDUP(size, alignment) * alignment;
+}
+
+cstring MapLayout::hash() const {
+    std::string layout = fields + "size:" + std::to_string(size);
+    std::stringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0')
+        << uint64_t(Util::Hash::fnv1a(layout.data(), layout.size()));
+    return out.str();
+}
+
+// =====================EBPFTablePSA=============================
+bool EBPFTablePSA::hasInitializer() const {
+    if (initialEntriesInManifest)
+        return false;
+    if (!constDefaultAction) {
+        auto mce = table->container->getDefaultAction()->to<IR::MethodCallExpression>();
+        auto pe = mce->method->to<IR::PathExpression>();
+        if (pe->path->name.originalName != P4::P4CoreLibrary::instance.noAction.name)
+            return true;
+    }
+    return !constEntriesCompiled && table->container->getEntries() != nullptr;
+}
+
+unsigned EBPFTablePSA::actionId(const IR::P4Action* action) const {
+    // the same numbering as emitValueActionIDNames(), 0 is reserved for NoAction
+    unsigned id = 1;
+    for (auto a : actionList->actionList) {
+        auto decl = program->refMap->getDeclaration(a->getPath(), true);
+        auto listed = decl->getNode()->to<IR::P4Action>();
+        if (listed->name.originalName == P4::P4CoreLibrary::instance.noAction.name)
+            continue;
+        if (listed == action)
+            return id;
+        id++;
+    }
+    return 0;
+}
+
+cstring EBPFTablePSA::encodeKey(const IR::ListExpression* keys) {
+    StructImage key;
+    big_int value;
+    if (denseArray) {
+        if (!constantValue(keys->components.at(0), value))
+            return nullptr;
+        key.append(value, 4, 4, false);
+        return key.toString();
+    }
+
+    // the prefix length is written once the offset of the LPM field is known
+    bool lpmTable = isLPMTable();
+    unsigned prefixLen = 0;
+    if (lpmTable)
+        key.append(0, 4, 4, false);
+
+    for (size_t index = 0; index < keyGenerator->keyElements.size(); index++) {
+        auto keyElement = keyGenerator->keyElements[index];
+        bool lpm = keyElement->matchType->path->name.name ==
+                   P4::P4CoreLibrary::instance.lpmMatch.name;
+        unsigned size, alignment;
+        bool byteArray;
+        if (!fieldLayout(::get(keyTypes, keyElement), size, alignment, byteArray) ||
+            (lpm && byteArray))
+            return nullptr;
+        auto expr = keys->components[index];
+        if (auto km = expr->to<IR::Mask>())
+            expr = km->left;
+        if (!constantValue(expr, value))
+            return nullptr;
+        // LPM fields are stored in the network byte order, see emitKey()
+        key.append(value, size, alignment, lpm || byteArray);
+        if (!lpm)
+            continue;
+
+        auto scalar = ::get(keyTypes, keyElement)->to<EBPFScalarType>();
+        if (scalar == nullptr)
+            return nullptr;
+        unsigned width = scalar->widthInBits();
+        unsigned prefix = width;
+        if (auto km = keys->components[index]->to<IR::Mask>()) {
+            auto mask = km->right->to<IR::Constant>();
+            if (mask == nullptr)
+                return nullptr;
+            unsigned len = mask->value == 0 ? width : boost::multiprecision::lsb(mask->value);
+            if (len + bitcount(mask->value) != width)
+                return nullptr;
+            prefix = width - len;
+        }
+        // as in the control-plane library: fields preceding the LPM field and
+        // the padding bits in front of its value are always matched
+        unsigned offset = key.bytes.size() - size - 4;
+        prefixLen = offset * 8 + (size * 8 - width) + prefix;
+    }
+    if (lpmTable) {
+        StructImage prefixImage;
+        prefixImage.append(prefixLen, 4, 4, false);
+        std::copy(prefixImage.bytes.begin(), prefixImage.bytes.end(), key.bytes.begin());
+    }
+    if (keyFieldNames.empty())
+        key.append(0, 1, 1, false);
+
+    // the key structure is declared with __attribute__((aligned(4)))
+    key.align(4);
+    key.finish();
+    return key.toString();
+}
+
+cstring EBPFTablePSA::encodeValue(const IR::MethodCallExpression* actionMce) const {
+    auto mi = P4::MethodInstance::resolve(actionMce, program->refMap, program->typeMap);
+    auto ac = mi->to<P4::ActionCall>();
+    BUG_CHECK(ac != nullptr, "%1%: expected an action call", mi);
+
+    StructImage value;
+    value.append(actionId(ac->action), 4, 4, false);
+
+    // the union holds arguments of all actions
+    StructImage arguments;
+    size_t unionSize = 0;
+    unsigned unionAlignment = 1;
+    for (auto a : actionList->actionList) {
+        auto decl = program->refMap->getDeclaration(a->getPath(), true);
+        auto action = decl->getNode()->to<IR::P4Action>();
+        StructImage params;
+        for (auto p : *action->parameters->getEnumerator()) {
+            auto type = EBPFTypeFactory::instance->create(
+                    program->typeMap->getTypeType(p->type, true));
+            unsigned size, alignment;
+            bool byteArray;
+            if (!fieldLayout(type, size, alignment, byteArray))
+                return nullptr;
+            big_int argValue = 0;
+            if (action == ac->action &&
+                !constantValue(mi->substitution.lookup(p)->expression, argValue))
+                return nullptr;
+            params.append(argValue, size, alignment, byteArray);
+        }
+        params.finish();
+        unionSize = std::max(unionSize, params.bytes.size());
+        unionAlignment = std::max(unionAlignment, params.alignment);
+        if (action == ac->action)
+            arguments = params;
+    }
+    value.append(arguments, ROUNDUP(unionSize, unionAlignment) * unionAlignment,
+                 unionAlignment);
+
+    if (denseArray)
+        value.append(1, 1, 1, false);
+    value.finish();
+    return value.toString();
+}
+
+/*
+ * Entries are written by the control plane as they are, so the manifest holds images
+ * of C structures of the key and the value of each entry.
+ */
+bool EBPFTablePSA::addInitialEntries(Util::JsonArray* maps) {
+    std::vector<std::pair<cstring, cstring>> defaultEntries, entries;
+    if (!constDefaultAction) {
+        auto mce = table->container->getDefaultAction()->to<IR::MethodCallExpression>();
+        auto pe = mce->method->to<IR::PathExpression>();
+        if (pe->path->name.originalName != P4::P4CoreLibrary::instance.noAction.name) {
+            StructImage zeroKey;
+            zeroKey.append(0, 4, 4, false);
+            defaultEntries.emplace_back(zeroKey.toString(), encodeValue(mce));
+        }
+    }
+    auto entriesList = table->container->getEntries();
+    if (!constEntriesCompiled && entriesList != nullptr) {
+        for (auto entry : entriesList->entries) {
+            auto mce = entry->action->to<IR::MethodCallExpression>();
+            entries.emplace_back(encodeKey(entry->keys), encodeValue(mce));
+        }
+    }
+    for (auto& entry : defaultEntries) {
+        if (entry.second.isNullOrEmpty())
+            return false;
+    }
+    for (auto& entry : entries) {
+        if (entry.first.isNullOrEmpty() || entry.second.isNullOrEmpty())
+            return false;
+    }
+
+    for (auto map : { std::make_pair(defaultActionMapName, &defaultEntries),
+                      std::make_pair(instanceName, &entries) }) {
+        if (map.second->empty())
+            continue;
+        auto jsonMap = new Util::JsonObject();
+        jsonMap->emplace("name", program->options.mapPrefix + map.first);
+        jsonMap->emplace("key_size", map.second->front().first.size() / 2);
+        jsonMap->emplace("value_size", map.second->front().second.size() / 2);
+        auto jsonEntries = new Util::JsonArray();
+        for (auto& entry : *map.second) {
+            auto jsonEntry = new Util::JsonObject();
+            jsonEntry->emplace("key", entry.first);
+            jsonEntry->emplace("value", entry.second);
+            jsonEntries->append(jsonEntry);
+        }
+        jsonMap->emplace("entries", jsonEntries);
+        maps->append(jsonMap);
+    }
+    initialEntriesInManifest = true;
+    return true;
+}
+
+/*
+ * Besides the layouts of the key and the value, the manifest lists the layout of arguments
+ * of each action, so that entries of a table whose actions were only added can be converted.
+ */
+void EBPFTablePSA::addMapLayouts(Util::JsonArray* maps) {
+    // the same structures as emitted by emitKeyType() and emitValueStructStructure()
+    MapLayout keyLayout, indexLayout, valueLayout;
+    if (!denseArray && keyGenerator != nullptr) {
+        if (isLPMTable())
+            keyLayout.append("u32", 4, 4);
+        for (auto keyElement : keyGenerator->keyElements) {
+            // LPM fields are stored in the network byte order, see emitKey()
+            bool lpm = keyElement->matchType->path->name.name ==
+                       P4::P4CoreLibrary::instance.lpmMatch.name;
+            keyLayout.append(::get(keyTypes, keyElement), lpm);
+        }
+    }
+    if (keyFieldNames.empty())
+        keyLayout.append("u8", 1, 1);
+    keyLayout.finish(4);
+    indexLayout.append("u32", 4, 4);
+
+    auto actions = new Util::JsonArray();
+    std::vector<MapLayout> arguments(1);  // NoAction
+    for (auto a : actionList->actionList) {
+        auto decl = program->refMap->getDeclaration(a->getPath(), true);
+        auto action = decl->getNode()->to<IR::P4Action>();
+        if (action->name.originalName == P4::P4CoreLibrary::instance.noAction.name)
+            continue;
+        MapLayout params;
+        for (auto p : *action->parameters->getEnumerator()) {
+            params.append(EBPFTypeFactory::instance->create(
+                    program->typeMap->getTypeType(p->type, true)));
+        }
+        params.finish();
+        arguments.push_back(params);
+        auto jsonAction = new Util::JsonObject();
+        jsonAction->emplace("name", action->controlPlaneName());
+        jsonAction->emplace("id", actionId(action));
+        jsonAction->emplace("layout", params.hash());
+        actions->append(jsonAction);
+    }
+    valueLayout.append("u32", 4, 4);
+    valueLayout.appendUnion(arguments);
+    if (denseArray)
+        valueLayout.append("u8", 1, 1);
+    valueLayout.finish();
+
+    auto addMap = [&](cstring name, cstring type, size_t maxEntries,
+                      const MapLayout& key) {
+        auto jsonMap = new Util::JsonObject();
+        jsonMap->emplace("name", program->options.mapPrefix + name);
+        jsonMap->emplace("type", type);
+        jsonMap->emplace("max_entries", maxEntries);
+        jsonMap->emplace("key_layout", key.hash());
+        jsonMap->emplace("value_layout", valueLayout.hash());
+        jsonMap->emplace("actions", actions);
+        maps->append(jsonMap);
+    };
+    if (denseArray) {
+        auto keyElement = keyGenerator->keyElements.at(0);
+        auto width = ::get(keyTypes, keyElement)->to<EBPFScalarType>()->widthInBits();
+        addMap(instanceName, "array", size_t(1) << width, indexLayout);
+    } else if (hasDataMap()) {
+        addMap(instanceName, isLPMTable() ? "lpm_trie" : "hash", size, keyLayout);
+    }
+    if (!constDefaultAction)
+        addMap(defaultActionMapName, "array", 1, indexLayout);
+}
+
+void EBPFTablePSA::emitConstEntryKey(CodeBuilder *builder, CodeGenInspector& cg,
+                                     const IR::Entry* entry, cstring keyName) {
+    if (denseArray) {
+        // the array map is indexed by the value of the only key field, as in encodeKey()
+        builder->emitIndent();
+        builder->appendFormat("%s %s = ", program->arrayIndexType, keyName);
+        entry->keys->components.at(0)->apply(cg);
+        builder->endOfStatement(true);
+        return;
+    }
+
+    builder->emitIndent();
+    builder->appendFormat("struct %s %s = {}", this->keyTypeName.c_str(), keyName.c_str());
+    builder->endOfStatement(true);
+    for (size_t index = 0; index < keyGenerator->keyElements.size(); index++) {
+        auto keyElement = keyGenerator->keyElements[index];
+        cstring fieldName = get(keyFieldNames, keyElement);
+        CHECK_NULL(fieldName);
+        builder->emitIndent();
+        builder->appendFormat("%s.%s = ", keyName.c_str(), fieldName.c_str());
+        auto mtdecl = program->refMap->getDeclaration(keyElement->matchType->path, true);
+        auto matchType = mtdecl->getNode()->to<IR::Declaration_ID>();
+        if (matchType->name.name == P4::P4CoreLibrary::instance.lpmMatch.name) {
+            auto expr = entry->keys->components[index];
+
+            auto ebpfType = ::get(keyTypes, keyElement);
+            unsigned width = 0, fieldWidth = 0;
+            cstring swap;
+            if (ebpfType->is<EBPFScalarType>()) {
+                auto scalar = ebpfType->to<EBPFScalarType>();
+                width = scalar->implementationWidthInBits();
+                fieldWidth = scalar->widthInBits();
+
+                if (width <= 8) {
+                    swap = "";  // single byte, nothing to swap
+                } else if (width <= 16) {
+                    swap = "bpf_htons";
+                } else if (width <= 32) {
+                    swap = "bpf_htonl";
+                } else if (width <= 64) {
+                    swap = "bpf_htonll";
+                } else {
+                    // TODO: handle width > 64 bits
+                    ::error(ErrorType::ERR_UNSUPPORTED,
+                            "%1%: fields wider than 64 bits are not supported yet",
+                            fieldName);
+                }
+            }
+            builder->appendFormat("%s(", swap);
+            if (auto km = expr->to<IR::Mask>()) {
+                km->left->apply(cg);
+            } else {
+                expr->apply(cg);
+            }
+            builder->append(")");
+            builder->endOfStatement(true);
+            builder->emitIndent();
+            // fields preceding the LPM field and the padding bits in front of
+            // its value are always matched, lookups use the whole key
+            builder->appendFormat("%s.%s = (__builtin_offsetof(struct %s, %s) - "
+                                  "sizeof(%s.%s)) * 8 + %u + ",
+                                  keyName.c_str(), prefixFieldName.c_str(),
+                                  keyTypeName.c_str(), fieldName.c_str(),
+                                  keyName.c_str(), prefixFieldName.c_str(),
+                                  width - fieldWidth);
+            unsigned prefixLen = fieldWidth;
+            if (auto km = expr->to<IR::Mask>()) {
+                auto trailing_zeros = [fieldWidth](const big_int& n) -> int {
+                    return (n == 0) ? fieldWidth : boost::multiprecision::lsb(n); };
+                auto count_ones = [](const big_int& n) -> unsigned {
+                    return bitcount(n); };
+                auto mask = km->right->to<IR::Constant>()->value;
+                auto len = trailing_zeros(mask);
+                if (len + count_ones(mask) != fieldWidth) {  // any remaining 0s?
+                    ::error(ErrorType::ERR_INVALID,
+                            "%1% invalid mask for LPM key", keyElement);
+                    return;
+                }
+                prefixLen = fieldWidth - len;
+            }
+            builder->append(prefixLen);
+            builder->endOfStatement(true);
+
+        } else if (matchType->name.name == P4::P4CoreLibrary::instance.exactMatch.name) {
+            entry->keys->components[index]->apply(cg);
+            builder->endOfStatement(true);
+        }
+    }
 }
 
 void EBPFTablePSA::emitConstEntriesInitializer(CodeBuilder *builder) {
@@ -97,75 +654,7 @@ void EBPFTablePSA::emitConstEntriesInitializer(CodeBuilder *builder) {
             auto keyName = program->refMap->newName("key");
             auto valueName = program->refMap->newName("value");
             // construct key
-            builder->emitIndent();
-            builder->appendFormat("struct %s %s = {}", this->keyTypeName.c_str(), keyName.c_str());
-            builder->endOfStatement(true);
-            for (size_t index = 0; index < keyGenerator->keyElements.size(); index++) {
-                auto keyElement = keyGenerator->keyElements[index];
-                cstring fieldName = get(keyFieldNames, keyElement);
-                CHECK_NULL(fieldName);
-                builder->emitIndent();
-                builder->appendFormat("%s.%s = ", keyName.c_str(), fieldName.c_str());
-                auto mtdecl = program->refMap->getDeclaration(keyElement->matchType->path, true);
-                auto matchType = mtdecl->getNode()->to<IR::Declaration_ID>();
-                if (matchType->name.name == P4::P4CoreLibrary::instance.lpmMatch.name) {
-                    auto expr = entry->keys->components[index];
-
-                    auto ebpfType = ::get(keyTypes, keyElement);
-                    unsigned width = 0;
-                    cstring swap;
-                    if (ebpfType->is<EBPFScalarType>()) {
-                        auto scalar = ebpfType->to<EBPFScalarType>();
-                        width = scalar->implementationWidthInBits();
-
-                        if (width <= 8) {
-                            swap = "";  // single byte, nothing to swap
-                        } else if (width <= 16) {
-                            swap = "bpf_htons";
-                        } else if (width <= 32) {
-                            swap = "bpf_htonl";
-                        } else if (width <= 64) {
-                            swap = "bpf_htonll";
-                        } else {
-                            // TODO: handle width > 64 bits
-                            ::error(ErrorType::ERR_UNSUPPORTED,
-                                    "%1%: fields wider than 64 bits are not supported yet",
-                                    fieldName);
-                        }
-                    }
-                    builder->appendFormat("%s(", swap);
-                    if (auto km = expr->to<IR::Mask>()) {
-                        km->left->apply(cg);
-                    } else {
-                        expr->apply(cg);
-                    }
-                    builder->append(")");
-                    builder->endOfStatement(true);
-                    builder->emitIndent();
-                    builder->appendFormat("%s.%s = ", keyName.c_str(), prefixFieldName.c_str());
-                    unsigned prefixLen = 32;
-                    if (auto km = expr->to<IR::Mask>()) {
-                        auto trailing_zeros = [width](const big_int& n) -> int {
-                            return (n == 0) ? width : boost::multiprecision::lsb(n); };
-                        auto count_ones = [](const big_int& n) -> unsigned {
-                            return bitcount(n); };
-                        auto mask = km->right->to<IR::Constant>()->value;
-                        auto len = trailing_zeros(mask);
-                        if (len + count_ones(mask) != width) {  // any remaining 0s in the prefix?
-                            ::error(ErrorType::ERR_INVALID,
-                                    "%1% invalid mask for LPM key", keyElement);
-                            return;
-                        }
-                        prefixLen = width - len;
-                    }
-                    builder->append(prefixLen);
-                    builder->endOfStatement(true);
-
-                } else if (matchType->name.name == P4::P4CoreLibrary::instance.exactMatch.name) {
-                    entry->keys->components[index]->apply(cg);
-                    builder->endOfStatement(true);
-                }
-            }
+            emitConstEntryKey(builder, cg, entry, keyName);
 
             // construct value
             auto *mce = entry->action->to<IR::MethodCallExpression>();
@@ -232,6 +721,14 @@ void EBPFTablePSA::emitMapUpdateTraceMsg(CodeBuilder *builder, cstring mapName,
 
 void EBPFTablePSA::emitTableValue(CodeBuilder* builder, const IR::MethodCallExpression* actionMce,
                                   cstring valueName) {
+    builder->emitIndent();
+    builder->appendFormat("struct %s %s = ", valueTypeName.c_str(), valueName.c_str());
+    emitTableValueInitializer(builder, actionMce);
+    builder->endOfStatement(true);
+}
+
+void EBPFTablePSA::emitTableValueInitializer(CodeBuilder* builder,
+                                             const IR::MethodCallExpression* actionMce) {
     auto mi = P4::MethodInstance::resolve(actionMce, program->refMap, program->typeMap);
     auto ac = mi->to<P4::ActionCall>();
     BUG_CHECK(ac != nullptr, "%1%: expected an action call", mi);
@@ -242,32 +739,154 @@ void EBPFTablePSA::emitTableValue(CodeBuilder* builder, const IR::MethodCallExpr
     CodeGenInspector cg(program->refMap, program->typeMap);
     cg.setBuilder(builder);
 
-    builder->emitIndent();
-    builder->appendFormat("struct %s %s = ", valueTypeName.c_str(), valueName.c_str());
     builder->blockStart();
     builder->emitIndent();
     cstring fullActionName = p4ActionToActionIDName(action);
     builder->appendFormat(".action = %s,", fullActionName);
     builder->newline();
 
-    builder->emitIndent();
-    builder->appendFormat(".u = {.%s = {", actionName.c_str());
-    for (auto p : *mi->substitution.getParametersInArgumentOrder()) {
-        auto arg = mi->substitution.lookup(p);
-        arg->apply(cg);
-        builder->append(",");
+    if (denseArray) {
+        // mark the value as an installed entry of a dense array table
+        builder->emitIndent();
+        builder->appendLine(".valid = 1,");
+    }
+
+    if (action->name.originalName != P4::P4CoreLibrary::instance.noAction.name) {
+        builder->emitIndent();
+        builder->appendFormat(".u = {.%s = {", actionName.c_str());
+        for (auto p : *mi->substitution.getParametersInArgumentOrder()) {
+            auto arg = mi->substitution.lookup(p);
+            arg->apply(cg);
+            builder->append(",");
+        }
+        builder->append("}},\n");
     }
-    builder->append("}},\n");
     builder->blockEnd(false);
+}
+
+void EBPFTablePSA::emitConstEntriesLookup(CodeBuilder* builder, cstring value) {
+    CodeGenInspector cg(program->refMap, program->typeMap);
+    cg.setBuilder(builder);
+    const IR::EntriesList* entries = table->container->getEntries();
+    cstring constValue = value + "_const";
+
+    // longer prefixes have to be matched first
+    std::vector<const IR::Entry*> sorted(entries->entries.begin(), entries->entries.end());
+    auto prefixLength = [this](const IR::Entry* entry) {
+        unsigned length = 0;
+        for (size_t index = 0; index < keyGenerator->keyElements.size(); index++) {
+            auto expr = entry->keys->components[index];
+            if (auto km = expr->to<IR::Mask>())
+                length += bitcount(km->right->to<IR::Constant>()->value);
+            else if (!expr->is<IR::DefaultExpression>())
+                length += ::get(keyTypes, keyGenerator->keyElements[index])
+                        ->to<EBPFScalarType>()->widthInBits();
+        }
+        return length;
+    };
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&prefixLength](const IR::Entry* a, const IR::Entry* b) {
+                         return prefixLength(a) > prefixLength(b); });
+
+    builder->appendFormat("struct %s %s", valueTypeName.c_str(), constValue.c_str());
     builder->endOfStatement(true);
+    bool first = true;
+    for (auto entry : sorted) {
+        builder->emitIndent();
+        if (!first)
+            builder->append("else ");
+        first = false;
+        builder->append("if (");
+        bool firstKey = true;
+        for (size_t index = 0; index < keyGenerator->keyElements.size(); index++) {
+            auto keyElement = keyGenerator->keyElements[index];
+            auto expr = entry->keys->components[index];
+            if (expr->is<IR::DefaultExpression>())
+                continue;
+            if (!firstKey)
+                builder->append(" && ");
+            firstKey = false;
+            builder->append("(");
+            codeGen->visit(keyElement->expression);
+            if (auto km = expr->to<IR::Mask>()) {
+                builder->append(" & ");
+                km->right->apply(cg);
+                builder->append(") == (");
+                km->left->apply(cg);
+                builder->append(" & ");
+                km->right->apply(cg);
+                builder->append(")");
+            } else {
+                builder->append(") == ");
+                expr->apply(cg);
+            }
+        }
+        if (firstKey)
+            builder->append("1");
+        builder->append(") ");
+        builder->blockStart();
+        builder->emitIndent();
+        builder->appendFormat("%s = (struct %s) ", constValue.c_str(), valueTypeName.c_str());
+        emitTableValueInitializer(builder, entry->action->to<IR::MethodCallExpression>());
+        builder->endOfStatement(true);
+        builder->emitIndent();
+        builder->appendFormat("%s = &%s", value.c_str(), constValue.c_str());
+        builder->endOfStatement(true);
+        builder->blockEnd(true);
+    }
+}
+
+void EBPFTablePSA::emitDenseArrayLookup(CodeBuilder* builder, cstring key, cstring value) {
+    cstring index = key + "_index";
+    cstring fieldName = ::get(keyFieldNames, keyGenerator->keyElements.at(0));
+    builder->appendFormat("%s %s = %s.%s", program->arrayIndexType.c_str(), index.c_str(),
+                          key.c_str(), fieldName.c_str());
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->target->emitTableLookup(builder, instanceName, index, value);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("if (%s != NULL && !%s->valid) ", value.c_str(), value.c_str());
+    builder->blockStart();
+    builder->emitIndent();
+    builder->appendFormat("%s = NULL", value.c_str());
+    builder->endOfStatement(true);
+    builder->blockEnd(true);
 }
 
 void EBPFTablePSA::emitLookup(CodeBuilder* builder, cstring key, cstring value) {
+    if (constEntriesCompiled) {
+        emitConstEntriesLookup(builder, value);
+        return;
+    }
+    if (denseArray) {
+        emitDenseArrayLookup(builder, key, value);
+        return;
+    }
     // TODO: placeholder for handling ternary table caching
     EBPFTable::emitLookup(builder, key, value);
 }
 
+void EBPFTablePSA::emitLookupDeclarations(CodeBuilder* builder, cstring value) {
+    if (!constDefaultAction)
+        return;
+    builder->emitIndent();
+    builder->appendFormat("struct %s %s_default", valueTypeName.c_str(), value.c_str());
+    builder->endOfStatement(true);
+}
+
 void EBPFTablePSA::emitLookupDefault(CodeBuilder* builder, cstring key, cstring value) {
+    if (constDefaultAction) {
+        // const default action is known at compile time, no need to look it up
+        auto defaultAction = table->container->getDefaultAction();
+        builder->appendFormat("%s_default = (struct %s) ", value.c_str(), valueTypeName.c_str());
+        emitTableValueInitializer(builder, defaultAction->to<IR::MethodCallExpression>());
+        builder->endOfStatement(true);
+        builder->emitIndent();
+        builder->appendFormat("%s = &%s_default", value.c_str(), value.c_str());
+        builder->endOfStatement(true);
+        return;
+    }
     // TODO: placeholder for handling psa_implementation
     EBPFTable::emitLookupDefault(builder, key, value);
 }
@@ -276,4 +895,338 @@ bool EBPFTablePSA::dropOnNoMatchingEntryFound() const {
     // TODO: placeholder for handling psa_implementation
     return EBPFTable::dropOnNoMatchingEntryFound();
 }
+
+void EBPFTablePSA::emitStatsDeclarations(CodeBuilder* builder) {
+    if (statsId < 0)
+        return;
+    cstring key = statsVariable + "_key";
+    builder->emitIndent();
+    builder->appendFormat("u32 %s = %d", key, statsId);
+    builder->endOfStatement(true);
+    builder->emitIndent();
+    builder->appendFormat("struct table_stats *%s = ", statsVariable);
+    builder->target->emitTableLookup(builder, "table_stats", key, nullptr);
+    builder->endOfStatement(true);
+}
+
+void EBPFTablePSA::emitStatsIncrement(CodeBuilder* builder, cstring counter,
+                                      cstring condition) {
+    if (statsId < 0)
+        return;
+    builder->emitIndent();
+    builder->appendFormat("if (%s != NULL", statsVariable);
+    if (!condition.isNullOrEmpty())
+        builder->appendFormat(" && %s", condition);
+    builder->append(")");
+    builder->newline();
+    builder->increaseIndent();
+    builder->emitIndent();
+    builder->appendFormat("%s->%s++", statsVariable, counter);
+    builder->endOfStatement(true);
+    builder->decreaseIndent();
+}
+
+namespace {
+
+// Emits a function of the control-plane library, only its declaration if declarationOnly is set.
+void emitLibraryFunction(CodeBuilder* builder, cstring signature, bool declarationOnly,
+                         std::function<void()> body) {
+    builder->append(signature);
+    if (declarationOnly) {
+        builder->endOfStatement(true);
+        return;
+    }
+    builder->newline();
+    builder->blockStart();
+    body();
+    builder->blockEnd(true);
+    builder->newline();
+}
+
+// Type of an action parameter or a key field, with type names resolved.
+EBPFType* libraryFieldType(P4::TypeMap* typeMap, const IR::Type* type) {
+    return EBPFTypeFactory::instance->create(typeMap->getTypeType(type, true));
+}
+
+// C type of a scalar field, or nullptr if the field is a byte array.
+cstring libraryScalarType(CodeBuilder* builder, EBPFType* type) {
+    auto scalar = type->to<EBPFScalarType>();
+    if (scalar != nullptr && !EBPFScalarType::generatesScalar(scalar->widthInBits()))
+        return nullptr;
+    CodeBuilder typeBuilder(builder->target);
+    type->emit(&typeBuilder);
+    return typeBuilder.toString();
+}
+
+// Width of the C type declared for a scalar field of the given width.
+unsigned libraryScalarWidth(unsigned width) {
+    if (width <= 8)
+        return 8;
+    else if (width <= 16)
+        return 16;
+    else if (width <= 32)
+        return 32;
+    return 64;
+}
+
+}  // namespace
+
+bool EBPFTablePSA::hasControlPlaneFunctions() const {
+    auto supported = [](EBPFType* type) {
+        return type->is<EBPFBoolType>() || type->is<EBPFScalarType>();
+    };
+    if (keyGenerator != nullptr) {
+        for (auto c : keyGenerator->keyElements) {
+            auto type = program->typeMap->getType(c->expression, true);
+            if (!supported(libraryFieldType(program->typeMap, type)))
+                return false;
+        }
+    }
+    for (auto a : actionList->actionList) {
+        auto decl = program->refMap->getDeclaration(a->getPath(), true);
+        auto action = decl->getNode()->to<IR::P4Action>();
+        for (auto p : *action->parameters->getEnumerator()) {
+            if (!supported(libraryFieldType(program->typeMap, p->type)))
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Emits functions of the control-plane library for the table:
+ * - <table>_key_init() fills a key from host order values of key fields,
+ * - <table>_value_<action>() fills a value running the action with the given parameters,
+ * - <table>_insert(), <table>_delete() and <table>_lookup() manage entries of the table map,
+ * - <table>_set_default_action() writes the default action map.
+ * Keys and values are the types emitted by emitKeyType() and emitValueType().
+ */
+void EBPFTablePSA::emitControlPlaneFunctions(CodeBuilder* builder, bool declarationsOnly) {
+    cstring keyType = denseArray ? program->arrayIndexType : cstring("struct ") + keyTypeName;
+    cstring valueType = cstring("struct ") + valueTypeName;
+
+    if (hasDataMap() && !denseArray) {
+        cstring params = "";
+        std::set<cstring> paramNames;
+        std::vector<std::function<void()>> statements;
+        const IR::KeyElement* lpmElement = nullptr;
+        for (auto c : keyGenerator->keyElements) {
+            cstring fieldName = ::get(keyFieldNames, c);
+            auto type = libraryFieldType(program->typeMap,
+                                         program->typeMap->getType(c->expression, true));
+            std::string identifier = c->expression->toString().c_str();
+            for (auto& ch : identifier) {
+                if (!isalnum(ch))
+                    ch = '_';
+            }
+            cstring name = identifier;
+            if (!paramNames.emplace(name).second)
+                name = fieldName;
+            paramNames.emplace(name);
+
+            bool lpm = c->matchType->path->name.name == P4::P4CoreLibrary::instance.lpmMatch.name;
+            cstring scalarType = libraryScalarType(builder, type);
+            if (scalarType != nullptr) {
+                params += Util::printf_format(", %s %s", scalarType, name);
+                auto width = type->to<IHasWidth>()->widthInBits();
+                cstring swap;
+                if (lpm && width > 8)
+                    swap = Util::printf_format("htobe%u", libraryScalarWidth(width));
+                statements.push_back([builder, fieldName, name, swap]() {
+                    builder->emitIndent();
+                    if (swap != nullptr)
+                        builder->appendFormat("table_key->%s = %s(%s)", fieldName, swap, name);
+                    else
+                        builder->appendFormat("table_key->%s = %s", fieldName, name);
+                    builder->endOfStatement(true);
+                });
+            } else {
+                params += Util::printf_format(", const u8 *%s", name);
+                auto bytes = type->to<EBPFScalarType>()->bytesRequired();
+                statements.push_back([builder, fieldName, name, bytes, lpm]() {
+                    builder->emitIndent();
+                    if (lpm) {
+                        // the same byte order as in emitKey()
+                        builder->appendFormat("for (unsigned i = 0; i < %u; i++)", bytes);
+                        builder->newline();
+                        builder->increaseIndent();
+                        builder->emitIndent();
+                        builder->appendFormat("table_key->%s[i] = %s[%u - i]",
+                                              fieldName, name, bytes - 1);
+                        builder->decreaseIndent();
+                    } else {
+                        builder->appendFormat("memcpy(table_key->%s, %s, %u)",
+                                              fieldName, name, bytes);
+                    }
+                    builder->endOfStatement(true);
+                });
+            }
+            if (lpm) {
+                params += Util::printf_format(", __u32 %s_prefix_len", name);
+                lpmElement = c;
+                auto width = type->to<IHasWidth>()->widthInBits();
+                unsigned padding = 0;
+                if (EBPFScalarType::generatesScalar(width))
+                    padding = libraryScalarWidth(width) - width;
+                statements.push_back([this, builder, keyType, fieldName, name, padding]() {
+                    // bits of the key preceding the prefix are always matched
+                    builder->emitIndent();
+                    builder->appendFormat("table_key->%s = (offsetof(%s, %s) - "
+                                          "sizeof(table_key->%s)) * 8 + %u + %s_prefix_len",
+                                          prefixFieldName, keyType, fieldName,
+                                          prefixFieldName, padding, name);
+                    builder->endOfStatement(true);
+                });
+            }
+        }
+        BUG_CHECK(isLPMTable() == (lpmElement != nullptr), "%1%: unexpected LPM key", table);
+
+        emitLibraryFunction(builder, Util::printf_format("void %s_key_init(%s *table_key%s)",
+                                                         instanceName, keyType, params),
+                            declarationsOnly, [&]() {
+            builder->emitIndent();
+            builder->append("memset(table_key, 0, sizeof(*table_key))");
+            builder->endOfStatement(true);
+            for (auto& statement : statements)
+                statement();
+        });
+    }
+
+    for (auto a : actionList->actionList) {
+        auto decl = program->refMap->getDeclaration(a->getPath(), true);
+        auto action = decl->getNode()->to<IR::P4Action>();
+        cstring name = EBPFObject::externalName(action);
+        cstring id = "0";
+        if (action->name.originalName == P4::P4CoreLibrary::instance.noAction.name)
+            name = "_NoAction";
+        else
+            id = p4ActionToActionIDName(action);
+
+        cstring params = "";
+        for (auto p : *action->parameters->getEnumerator()) {
+            cstring scalarType = libraryScalarType(
+                    builder, libraryFieldType(program->typeMap, p->type));
+            if (scalarType != nullptr)
+                params += Util::printf_format(", %s %s", scalarType, p->externalName());
+            else
+                params += Util::printf_format(", const u8 *%s", p->externalName());
+        }
+
+        cstring functionName = instanceName + "_value" +
+                               (name.startsWith("_") ? "" : "_") + name;
+        emitLibraryFunction(builder, Util::printf_format("void %s(%s *table_value%s)",
+                                                         functionName, valueType, params),
+                            declarationsOnly, [&]() {
+            builder->emitIndent();
+            builder->append("memset(table_value, 0, sizeof(*table_value))");
+            builder->endOfStatement(true);
+            builder->emitIndent();
+            builder->appendFormat("table_value->action = %s", id);
+            builder->endOfStatement(true);
+            for (auto p : *action->parameters->getEnumerator()) {
+                auto type = libraryFieldType(program->typeMap, p->type);
+                builder->emitIndent();
+                if (libraryScalarType(builder, type) != nullptr) {
+                    builder->appendFormat("table_value->u.%s.%s = %s", name,
+                                          p->externalName(), p->externalName());
+                } else {
+                    builder->appendFormat("memcpy(table_value->u.%s.%s, %s, %u)", name,
+                                          p->externalName(), p->externalName(),
+                                          type->to<EBPFScalarType>()->bytesRequired());
+                }
+                builder->endOfStatement(true);
+            }
+            if (denseArray) {
+                builder->emitIndent();
+                builder->append("table_value->valid = 1");
+                builder->endOfStatement(true);
+            }
+        });
+    }
+
+    if (hasDataMap()) {
+        // LPM tries do not support batched operations
+        bool batched = !isLPMTable();
+        emitLibraryFunction(builder, Util::printf_format(
+                "int %s_insert(int fd, const %s *keys, const %s *values, __u32 *count)",
+                instanceName, keyType, valueType), declarationsOnly, [&]() {
+            if (batched) {
+                builder->emitIndent();
+                builder->append("return bpf_map_update_batch(fd, keys, values, count, NULL)");
+                builder->endOfStatement(true);
+                return;
+            }
+            builder->appendLine(
+                    "    __u32 n = *count;\n"
+                    "    int ret = 0;\n"
+                    "    for (*count = 0; *count < n; (*count)++) {\n"
+                    "        ret = bpf_map_update_elem(fd, &keys[*count], &values[*count], "
+                    "BPF_ANY);\n"
+                    "        if (ret)\n"
+                    "            break;\n"
+                    "    }\n"
+                    "    return ret;");
+        });
+
+        emitLibraryFunction(builder, Util::printf_format(
+                "int %s_delete(int fd, const %s *keys, __u32 *count)",
+                instanceName, keyType), declarationsOnly, [&]() {
+            if (batched && !denseArray) {
+                builder->emitIndent();
+                builder->append("return bpf_map_delete_batch(fd, keys, count, NULL)");
+                builder->endOfStatement(true);
+                return;
+            }
+            cstring remove = "bpf_map_delete_elem(fd, &keys[*count])";
+            if (denseArray) {
+                // array elements can not be deleted, they are marked as not installed
+                builder->emitIndent();
+                builder->appendFormat("%s empty", valueType);
+                builder->endOfStatement(true);
+                builder->emitIndent();
+                builder->append("memset(&empty, 0, sizeof(empty))");
+                builder->endOfStatement(true);
+                remove = "bpf_map_update_elem(fd, &keys[*count], &empty, BPF_ANY)";
+            }
+            builder->appendFormat(
+                    "    __u32 n = *count;\n"
+                    "    int ret = 0;\n"
+                    "    for (*count = 0; *count < n; (*count)++) {\n"
+                    "        ret = %s;\n"
+                    "        if (ret)\n"
+                    "            break;\n"
+                    "    }\n"
+                    "    return ret;", remove);
+            builder->newline();
+        });
+
+        emitLibraryFunction(builder, Util::printf_format(
+                "int %s_lookup(int fd, const %s *key, %s *value)",
+                instanceName, keyType, valueType), declarationsOnly, [&]() {
+            if (!denseArray) {
+                builder->emitIndent();
+                builder->append("return bpf_map_lookup_elem(fd, key, value)");
+                builder->endOfStatement(true);
+                return;
+            }
+            builder->appendLine(
+                    "    int ret = bpf_map_lookup_elem(fd, key, value);\n"
+                    "    if (ret == 0 && !value->valid)\n"
+                    "        return -ENOENT;\n"
+                    "    return ret;");
+        });
+    }
+
+    if (!constDefaultAction) {
+        emitLibraryFunction(builder, Util::printf_format(
+                "int %s_set_default_action(int fd, const %s *value)",
+                instanceName, valueType), declarationsOnly, [&]() {
+            builder->appendFormat(
+                    "    %s zero = 0;\n"
+                    "    return bpf_map_update_elem(fd, &zero, value, BPF_ANY);",
+                    program->arrayIndexType);
+            builder->newline();
+        });
+    }
+}
 }  // namespace EBPF
@@ -18,11 +18,32 @@ limitations under the License.
 #define BACKENDS_EBPF_PSA_EBPFPSATABLE_H_
 
 #include "frontends/p4/methodInstance.h"
+#include "lib/json.h"
 #include "backends/ebpf/ebpfTable.h"
 #include "ebpfPsaControl.h"
 
 namespace EBPF {
 
+// Layout of a C structure of a BPF map key or value: the type, the offset and the size
+// of each field. Names of fields and of types are not a part of it, so the hash of the
+// layout only changes when entries written to the map can not be reused.
+class MapLayout {
+    std::string fields;
+
+ public:
+    unsigned size = 0;
+    unsigned alignment = 1;
+
+    void append(cstring type, unsigned fieldSize, unsigned fieldAlignment);
+    // Appends a field declared for the type, networkOrder for scalars stored in
+    // the network byte order.
+    void append(EBPFType* type, bool networkOrder = false);
+    void appendUnion(const std::vector<MapLayout>& members);
+    // Pads the structure to a multiple of its alignment.
+    void finish(unsigned minAlignment = 1);
+    cstring hash() const;
+};
+
 class EBPFTablePSA : public EBPFTable {
  private:
     void emitTableDecl(CodeBuilder *builder,
@@ -31,11 +52,40 @@ class EBPFTablePSA : public EBPFTable {
                        cstring keyTypeName,
                        cstring valueTypeName,
                        size_t size) const;
+    bool checkConstEntriesCompiled() const;
+    bool checkDenseArray() const;
 
  protected:
+    // Maximal number of const entries compiled into code, bigger tables are looked up in a map.
+    static const unsigned maxCompiledConstEntries = 16;
+    // Whether const entries are compiled into code instead of stored in a BPF map.
+    bool constEntriesCompiled = false;
+    // Whether the table is an array map indexed directly by its only exact key field.
+    bool denseArray = false;
+    // Whether the default action is declared const, so it is not stored in a BPF map.
+    bool constDefaultAction = false;
+    // Whether the initial entries are written to the map initialization manifest
+    // instead of by the map initializer program.
+    bool initialEntriesInManifest = false;
+    // Pointer to the entry of the table in the table_stats map.
+    cstring statsVariable;
+
+    unsigned actionId(const IR::P4Action* action) const;
+    // Byte images of the key and the value of an entry as hex strings, nullptr if
+    // some field can not be encoded.
+    cstring encodeKey(const IR::ListExpression* keys);
+    cstring encodeValue(const IR::MethodCallExpression* actionMce) const;
+
     void emitTableValue(CodeBuilder* builder, const IR::MethodCallExpression* actionMce,
                         cstring valueName);
+    void emitTableValueInitializer(CodeBuilder* builder,
+                                   const IR::MethodCallExpression* actionMce);
+    void emitConstEntriesLookup(CodeBuilder* builder, cstring value);
+    void emitDenseArrayLookup(CodeBuilder* builder, cstring key, cstring value);
     void emitDefaultActionInitializer(CodeBuilder *builder);
+    // Declares the key of a const entry written by the map initializer.
+    void emitConstEntryKey(CodeBuilder *builder, CodeGenInspector& cg,
+                           const IR::Entry* entry, cstring keyName);
     void emitConstEntriesInitializer(CodeBuilder *builder);
     void emitMapUpdateTraceMsg(CodeBuilder *builder, cstring mapName,
                                cstring returnCode) const;
@@ -48,9 +98,31 @@ class EBPFTablePSA : public EBPFTable {
     void emitValueStructStructure(CodeBuilder* builder) override;
     void emitAction(CodeBuilder* builder, cstring valueName, cstring actionRunVariable) override;
     void emitInitializer(CodeBuilder* builder) override;
+    void emitLookupDeclarations(CodeBuilder* builder, cstring value) override;
     void emitLookup(CodeBuilder* builder, cstring key, cstring value) override;
     void emitLookupDefault(CodeBuilder* builder, cstring key, cstring value) override;
     bool dropOnNoMatchingEntryFound() const override;
+    void emitStatsDeclarations(CodeBuilder* builder) override;
+    void emitStatsIncrement(CodeBuilder* builder, cstring counter,
+                            cstring condition = nullptr) override;
+    // Index of the table in the table_stats map, -1 if statistics are not emitted.
+    int statsId = -1;
+
+    // Whether entries of the table are stored in a BPF map.
+    bool hasDataMap() const {
+        return denseArray || (keyGenerator != nullptr && !constEntriesCompiled);
+    }
+    // Whether the map initializer program has to write entries of this table.
+    bool hasInitializer() const;
+    // Appends the initial entries of the table maps to the manifest. Returns false if they
+    // can not be encoded, they are written by the map initializer program then.
+    bool addInitialEntries(Util::JsonArray* maps);
+    // Appends the layouts of the table maps to the manifest.
+    void addMapLayouts(Util::JsonArray* maps);
+    // Whether keys and action parameters of the table can be passed to functions
+    // of the control-plane library.
+    bool hasControlPlaneFunctions() const;
+    void emitControlPlaneFunctions(CodeBuilder* builder, bool declarationsOnly);
 };
 
 }  // namespace EBPF
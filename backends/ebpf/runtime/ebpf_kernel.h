@@ -59,6 +59,7 @@ limitations under the License.
 
 #else // BEGIN EBPF KERNEL DEFINITIONS
 
+#include <linux/errno.h>  // error codes returned by helpers
 #include <linux/pkt_cls.h>  // TC_ACT_OK, TC_ACT_SHOT
 #include "linux/bpf.h"  // types, and general bpf definitions
 // This file contains the definitions of all the kernel bpf essentials
@@ -94,6 +95,12 @@ struct bpf_elf_map {
         ____btf_map_##name = {};
 
 #define REGISTER_START()
+/* Number of entries of perf event arrays loaded without BTF. It must be at least the number
+ * of possible CPUs, otherwise bpf_perf_event_output() with BPF_F_CURRENT_CPU fails (-E2BIG)
+ * on CPUs above the limit and their events are silently lost. */
+#ifndef PERF_EVENT_ARRAY_MAX_CPUS
+#define PERF_EVENT_ARRAY_MAX_CPUS 128
+#endif
 #ifndef BTF
 /* Note: pinning exports the table name globally, do not remove */
 #define REGISTER_TABLE(NAME, TYPE, KEY_TYPE, VALUE_TYPE, MAX_ENTRIES) \
@@ -135,6 +142,28 @@ struct bpf_elf_map SEC("maps") NAME = {          \
     .pinning     = 2,                  \
     .flags       = FLAGS,              \
 };
+/* Programs have to be inserted into the program array by the loader */
+#define REGISTER_PROG_ARRAY(NAME, MAX_ENTRIES, ...) \
+    REGISTER_TABLE(NAME, BPF_MAP_TYPE_PROG_ARRAY, __u32, __u32, MAX_ENTRIES)
+/* SIZE is in bytes, a power of 2 multiple of the page size */
+#define REGISTER_RINGBUF(NAME, SIZE) \
+struct bpf_elf_map SEC("maps") NAME = {          \
+    .type        = BPF_MAP_TYPE_RINGBUF, \
+    .size_key    = 0,                  \
+    .size_value  = 0,                  \
+    .max_elem    = SIZE,               \
+    .pinning     = 2,                  \
+    .flags       = 0,                  \
+};
+#define REGISTER_PERF_EVENT_ARRAY(NAME) \
+struct bpf_elf_map SEC("maps") NAME = {          \
+    .type        = BPF_MAP_TYPE_PERF_EVENT_ARRAY, \
+    .size_key    = sizeof(__u32),      \
+    .size_value  = sizeof(__u32),      \
+    .max_elem    = PERF_EVENT_ARRAY_MAX_CPUS, \
+    .pinning     = 2,                  \
+    .flags       = 0,                  \
+};
 #else
 #define REGISTER_TABLE(NAME, TYPE, KEY_TYPE, VALUE_TYPE, MAX_ENTRIES) \
 struct {                                 \
@@ -177,6 +206,33 @@ struct {                                 \
     __uint(max_entries, MAX_ENTRIES);    \
     __uint(pinning, LIBBPF_PIN_BY_NAME); \
 } NAME SEC(".maps");
+/* Pinned, so that the programs are not removed from the array when the loader exits */
+#define REGISTER_PROG_ARRAY(NAME, MAX_ENTRIES, ...) \
+struct {                                 \
+    __uint(type, BPF_MAP_TYPE_PROG_ARRAY); \
+    __uint(key_size, sizeof(__u32));     \
+    __uint(max_entries, MAX_ENTRIES);    \
+    __uint(pinning, LIBBPF_PIN_BY_NAME); \
+    __array(values, int (SK_BUFF *));    \
+} NAME SEC(".maps") = {                  \
+    .values = { __VA_ARGS__ },           \
+};
+/* SIZE is in bytes, a power of 2 multiple of the page size */
+#define REGISTER_RINGBUF(NAME, SIZE)     \
+struct {                                 \
+    __uint(type, BPF_MAP_TYPE_RINGBUF);  \
+    __uint(max_entries, SIZE);           \
+    __uint(pinning, LIBBPF_PIN_BY_NAME); \
+} NAME SEC(".maps");
+/* Perf event arrays do not support BTF of keys and values. max_entries is omitted,
+ * so libbpf sizes the array to the number of possible CPUs. */
+#define REGISTER_PERF_EVENT_ARRAY(NAME)  \
+struct {                                 \
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY); \
+    __uint(key_size, sizeof(__u32));     \
+    __uint(value_size, sizeof(__u32));   \
+    __uint(pinning, LIBBPF_PIN_BY_NAME); \
+} NAME SEC(".maps");
 #endif
 #define REGISTER_END()
 
@@ -0,0 +1,237 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+ * Prints trace records written to the trace_ringbuf map by programs compiled with
+ * `--trace-ringbuf <formats file>`. Records only carry the ID of a trace point and its
+ * arguments, the decoder formats them with the format strings recorded by the compiler.
+ *
+ * Build: gcc -o ebpf_trace_decoder ebpf_trace_decoder.c -lbpf
+ * Usage: ebpf_trace_decoder <formats file> <pinned trace_ringbuf map>
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/types.h>
+#include <bpf/bpf.h>     // bpf_obj_get()
+#include <bpf/libbpf.h>  // ring_buffer__new()
+
+/* Must match struct trace_record emitted by the compiler */
+#define TRACE_MAX_ARGS 4
+struct trace_record {
+    __u32 id;
+    __u32 cpu;
+    __u64 args[TRACE_MAX_ARGS];
+};
+
+struct trace_point {
+    int argc;
+    char *format;
+};
+
+static struct trace_point *trace_points;
+static unsigned int num_trace_points;
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+/* Formats are written as contents of C string literals, resolve escape sequences in place */
+static void unescape(char *str) {
+    char *out = str;
+    for (char *in = str; *in != '\0'; in++) {
+        if (*in != '\\' || in[1] == '\0') {
+            *out++ = *in;
+            continue;
+        }
+        in++;
+        switch (*in) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            default: *out++ = *in; break;
+        }
+    }
+    *out = '\0';
+}
+
+/* Each line of the formats file is: <ID> <number of arguments> <format> */
+static int load_formats(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned int id;
+        int argc, offset;
+        if (sscanf(line, "%u %d %n", &id, &argc, &offset) != 2) {
+            fprintf(stderr, "%s: invalid line: %s", path, line);
+            fclose(file);
+            return -1;
+        }
+        line[strcspn(line, "\n")] = '\0';
+
+        if (id >= num_trace_points) {
+            struct trace_point *points = realloc(trace_points, (id + 1) * sizeof(*points));
+            if (points == NULL) {
+                fclose(file);
+                return -1;
+            }
+            memset(points + num_trace_points, 0,
+                   (id + 1 - num_trace_points) * sizeof(*points));
+            trace_points = points;
+            num_trace_points = id + 1;
+        }
+        trace_points[id].argc = argc;
+        trace_points[id].format = strdup(line + offset);
+        if (trace_points[id].format == NULL) {
+            fclose(file);
+            return -1;
+        }
+        unescape(trace_points[id].format);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+/*
+ * Prints a format string interpreted like bpf_trace_printk(). Arguments are recorded as
+ * 64-bit values, so length modifiers of conversions are replaced by "ll".
+ */
+static void print_format(const char *format, const __u64 *args, int argc) {
+    int arg = 0;
+    const char *p = format;
+    while (*p != '\0') {
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+
+        char spec[32];
+        size_t len = 0;
+        spec[len++] = *p++;
+        while (*p != '\0' && strchr("#0- +", *p) != NULL && len < 16)
+            spec[len++] = *p++;
+        while (*p >= '0' && *p <= '9' && len < 24)
+            spec[len++] = *p++;
+        while (*p == 'l' || *p == 'h' || *p == 'z')
+            p++;
+        char conversion = *p;
+        if (conversion != '\0')
+            p++;
+
+        __u64 value = arg < argc && arg < TRACE_MAX_ARGS ? args[arg] : 0;
+        arg++;
+        switch (conversion) {
+            case 'd':
+            case 'i':
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+                spec[len++] = conversion;
+                spec[len] = '\0';
+                printf(spec, (long long) value);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+                spec[len++] = conversion;
+                spec[len] = '\0';
+                printf(spec, (unsigned long long) value);
+                break;
+            case 'c':
+                putchar((int) value);
+                break;
+            default:
+                /* pointers and strings cannot be dereferenced in user space */
+                printf("0x%llx", (unsigned long long) value);
+                break;
+        }
+    }
+}
+
+static int handle_record(void *ctx, void *data, size_t size) {
+    (void) ctx;
+    const struct trace_record *record = data;
+    if (size < sizeof(*record))
+        return 0;
+
+    printf("[%03u] ", record->cpu);
+    if (record->id >= num_trace_points || trace_points[record->id].format == NULL) {
+        printf("unknown trace point %u\n", record->id);
+        return 0;
+    }
+    const struct trace_point *point = &trace_points[record->id];
+    print_format(point->format, record->args, point->argc);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <formats file> <pinned trace_ringbuf map>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (load_formats(argv[1]) != 0)
+        return EXIT_FAILURE;
+
+    int map_fd = bpf_obj_get(argv[2]);
+    if (map_fd < 0) {
+        fprintf(stderr, "%s: cannot open map: %s\n", argv[2], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct ring_buffer *rb = ring_buffer__new(map_fd, handle_record, NULL, NULL);
+    if (rb == NULL) {
+        fprintf(stderr, "%s: cannot open ring buffer: %s\n", argv[2], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    int ret = 0;
+    while (!stop) {
+        ret = ring_buffer__poll(rb, 100 /* ms */);
+        if (ret == -EINTR) {
+            ret = 0;
+            continue;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Failed to read ring buffer: %s\n", strerror(-ret));
+            break;
+        }
+        fflush(stdout);
+    }
+
+    ring_buffer__free(rb);
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
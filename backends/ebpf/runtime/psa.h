@@ -113,16 +113,20 @@ struct psa_egress_deparser_input_metadata_t {
 
 /*
  * Opaque struct to be used to share global PSA metadata fields between eBPF program attached to Ingress and Egress.
- * The size of this struct must be less than 32 bytes.
+ * It is stored in skb->cb, so the size of this struct must not exceed 20 bytes.
  */
 struct psa_global_metadata {
     MulticastGroup_t multicast_group;  /// set by Ingress, read by PRE
     PortId_t         egress_port;  /// set by Ingress, read by PRE
     CloneSessionId_t clone_session_id;  /// set by Ingress/Egress, read by PRE
-    bool             clone;  /// set by Ingress/Egress, read by PRE
-    bool             drop;   /// set by Ingress/Egress, read by PRE
+    __u8             clone : 1;  /// set by Ingress/Egress, read by PRE
+    __u8             drop : 1;   /// set by Ingress/Egress, read by PRE
+    __u8             recirculating : 1;  /// set by Ingress TM, read by Egress (--recirculate-tail-call)
+    __u8             recirculate_depth;  /// number of recirculations of the packet (--recirculate-tail-call)
     PSA_PacketPath_t packet_path;  /// set by eBPF program as helper variable, read by ingress/egress
+    __u8             bridged_metadata_len;  /// set by Ingress deparser, cleared by Egress parser
     EgressInstance_t instance;  /// set by PRE, read by Egress
+    __u8             bridged_metadata[4];  /// set by Ingress deparser if it fits, read by Egress
 } __attribute__((aligned(4)));
 
 struct clone_session_entry {
@@ -42,8 +42,14 @@ void KernelSamplesTarget::emitIncludes(Util::SourceCodeBuilder* builder) const {
 
 void KernelSamplesTarget::emitResizeBuffer(Util::SourceCodeBuilder *builder,
                                            cstring buffer, cstring offsetVar) const {
-    builder->appendFormat("bpf_skb_adjust_room(%s, %s, 1, 0)",
-                          buffer, offsetVar);
+    emitResizeBuffer(builder, buffer, offsetVar, "0");
+}
+
+void KernelSamplesTarget::emitResizeBuffer(Util::SourceCodeBuilder *builder,
+                                           cstring buffer, cstring offsetVar,
+                                           cstring flags) const {
+    builder->appendFormat("bpf_skb_adjust_room(%s, %s, BPF_ADJ_ROOM_MAC, %s)",
+                          buffer, offsetVar, flags);
 }
 
 void KernelSamplesTarget::emitTableLookup(Util::SourceCodeBuilder* builder, cstring tblName,
@@ -51,13 +57,13 @@ void KernelSamplesTarget::emitTableLookup(Util::SourceCodeBuilder* builder, cstr
     if (!value.isNullOrEmpty())
         builder->appendFormat("%s = ", value.c_str());
     builder->appendFormat("BPF_MAP_LOOKUP_ELEM(%s, &%s)",
-                          tblName.c_str(), key.c_str());
+                          mapName(tblName).c_str(), key.c_str());
 }
 
 void KernelSamplesTarget::emitTableUpdate(Util::SourceCodeBuilder* builder, cstring tblName,
                                           cstring key, cstring value) const {
     builder->appendFormat("BPF_MAP_UPDATE_ELEM(%s, &%s, &%s, BPF_ANY);",
-                          tblName.c_str(), key.c_str(), value.c_str());
+                          mapName(tblName).c_str(), key.c_str(), value.c_str());
 }
 
 void KernelSamplesTarget::emitUserTableUpdate(Util::SourceCodeBuilder* builder, cstring tblName,
@@ -71,6 +77,7 @@ void KernelSamplesTarget::emitTableDecl(Util::SourceCodeBuilder* builder,
                                         cstring keyType, cstring valueType,
                                         unsigned size) const {
     cstring kind, flags;
+    tblName = mapName(tblName);
     cstring registerTable = "REGISTER_TABLE(%s, %s, %s, %s, %d)";
     cstring registerTableWithFlags = "REGISTER_TABLE_FLAGS(%s, %s, %s, %s, %d, %s)";
 
@@ -120,6 +127,26 @@ void KernelSamplesTarget::emitTableDeclSpinlock(Util::SourceCodeBuilder* builder
     }
 }
 
+void KernelSamplesTarget::emitProgArrayDecl(Util::SourceCodeBuilder* builder, cstring tblName,
+                                            const std::vector<cstring>& programs) const {
+    for (auto prog : programs) {
+        builder->appendFormat("int %s(%s *);", prog.c_str(), packetDescriptorType().c_str());
+        builder->newline();
+    }
+    builder->appendFormat("REGISTER_PROG_ARRAY(%s, %d", mapName(tblName).c_str(),
+                          static_cast<int>(programs.size()));
+    for (size_t i = 0; i < programs.size(); i++)
+        builder->appendFormat(", [%d] = (void *) &%s", static_cast<int>(i), programs[i].c_str());
+    builder->append(")");
+    builder->newline();
+}
+
+void KernelSamplesTarget::emitPerfEventArrayDecl(Util::SourceCodeBuilder* builder,
+                                                 cstring tblName) const {
+    builder->appendFormat("REGISTER_PERF_EVENT_ARRAY(%s)", mapName(tblName).c_str());
+    builder->newline();
+}
+
 void
 KernelSamplesTarget::emitMapInMapDecl(Util::SourceCodeBuilder *builder, cstring innerName,
                                       TableKind innerTableKind, cstring innerKeyType,
@@ -134,6 +161,8 @@ KernelSamplesTarget::emitMapInMapDecl(Util::SourceCodeBuilder *builder, cstring
     cstring registerInnerTable = "REGISTER_TABLE_INNER(%s, %s, %s, %s, %d, %d, %d)";
 
     innerMapIndex++;
+    innerName = mapName(innerName);
+    outerName = mapName(outerName);
 
     cstring kind = getBPFMapType(innerTableKind);
     builder->appendFormat(registerInnerTable, innerName,
@@ -172,7 +201,38 @@ void KernelSamplesTarget::emitMain(Util::SourceCodeBuilder* builder,
 
 void KernelSamplesTarget::emitPreamble(Util::SourceCodeBuilder* builder) const {
     cstring macro;
-    if (emitTraceMessages) {
+    if (emitTraceMessages && traceToRingbuf) {
+        builder->appendFormat("#define TRACE_MAX_ARGS %d", MaxTraceRecordArgs);
+        builder->newline();
+        cstring ringbuf = "#ifndef TRACE_RINGBUF_SIZE\n"
+                          "#define TRACE_RINGBUF_SIZE (256 * 1024)\n"
+                          "#endif\n"
+                          "struct trace_record {\n"
+                          "    __u32 id;\n"
+                          "    __u32 cpu;\n"
+                          "    __u64 args[TRACE_MAX_ARGS];\n"
+                          "};\n"
+                          "REGISTER_RINGBUF(%trace_ringbuf%, TRACE_RINGBUF_SIZE)\n"
+                          "static __always_inline\n"
+                          "void bpf_trace_record(__u32 id, __u64 arg0, __u64 arg1, __u64 arg2, "
+                          "__u64 arg3)\n"
+                          "{\n"
+                          "    struct trace_record *rec = "
+                          "bpf_ringbuf_reserve(&%trace_ringbuf%, sizeof(*rec), 0);\n"
+                          "    if (rec == NULL)\n"
+                          "        return;\n"
+                          "    rec->id = id;\n"
+                          "    rec->cpu = bpf_get_smp_processor_id();\n"
+                          "    rec->args[0] = arg0;\n"
+                          "    rec->args[1] = arg1;\n"
+                          "    rec->args[2] = arg2;\n"
+                          "    rec->args[3] = arg3;\n"
+                          "    bpf_ringbuf_submit(rec, 0);\n"
+                          "}";
+        builder->appendLine(ringbuf.replace("%trace_ringbuf%", mapName("trace_ringbuf")));
+        // All trace messages are emitted by emitTraceMessage(), which knows their IDs.
+        macro = "#define bpf_trace_message(fmt, ...)";
+    } else if (emitTraceMessages) {
         macro = "#define bpf_trace_message(fmt, ...)                                \\\n"
                 "    do {                                                           \\\n"
                 "        char ____fmt[] = fmt;                                      \\\n"
@@ -201,6 +261,34 @@ void KernelSamplesTarget::emitTraceMessage(Util::SourceCodeBuilder* builder, con
     if (!msg.endsWith("\\n"))
         msg = msg + "\\n";
 
+    if (traceToRingbuf) {
+        BUG_CHECK(argc <= MaxTraceRecordArgs, "%1%: too many trace arguments", format);
+        unsigned id = traceFormats.size();
+        for (unsigned i = 0; i < traceFormats.size(); i++) {
+            if (traceFormats[i].first == msg && traceFormats[i].second == argc) {
+                id = i;
+                break;
+            }
+        }
+        if (id == traceFormats.size())
+            traceFormats.emplace_back(msg, argc);
+
+        builder->emitIndent();
+        builder->appendFormat("bpf_trace_record(%u", id);
+        va_start(ap, argc);
+        for (int i = 0; i < MaxTraceRecordArgs; ++i) {
+            auto arg = i < argc ? va_arg(ap, const char *) : nullptr;
+            if (arg == nullptr)
+                builder->append(", 0");
+            else
+                builder->appendFormat(", (__u64) (%s)", arg);
+        }
+        va_end(ap);
+        builder->append(");");
+        builder->newline();
+        return;
+    }
+
     msg = cstring("\"") + msg + "\"";
     va_start(ap, argc);
     for (int i = 0; i < argc; ++i) {
@@ -216,6 +304,12 @@ void KernelSamplesTarget::emitTraceMessage(Util::SourceCodeBuilder* builder, con
     builder->newline();
 }
 
+void KernelSamplesTarget::emitTraceFormats(std::ostream& out) const {
+    // <ID> <number of arguments> <format as a C string literal without quotes>
+    for (unsigned i = 0; i < traceFormats.size(); i++)
+        out << i << " " << traceFormats[i].second << " " << traceFormats[i].first << std::endl;
+}
+
 void KernelSamplesTarget::annotateTableWithBTF(Util::SourceCodeBuilder* builder, cstring name,
                                                cstring keyType, cstring valueType) const {
     builder->appendFormat("BPF_ANNOTATE_KV_PAIR(%s, %s, %s)",
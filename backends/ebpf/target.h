@@ -17,6 +17,10 @@ limitations under the License.
 #ifndef _BACKENDS_EBPF_TARGET_H_
 #define _BACKENDS_EBPF_TARGET_H_
 
+#include <ostream>
+#include <utility>
+#include <vector>
+
 #include "lib/cstring.h"
 #include "lib/error.h"
 #include "lib/sourceCodeBuilder.h"
@@ -51,6 +55,15 @@ class Target {
     virtual void emitIncludes(Util::SourceCodeBuilder* builder) const = 0;
     virtual void emitResizeBuffer(Util::SourceCodeBuilder* builder, cstring buffer,
                                   cstring offsetVar) const = 0;
+    // Resizes the buffer passing additional flags, e.g. tunnel encapsulation flags.
+    // Targets which do not support any flags ignore them.
+    virtual void emitResizeBuffer(Util::SourceCodeBuilder* builder, cstring buffer,
+                                  cstring offsetVar, cstring flags) const {
+        (void) flags;
+        emitResizeBuffer(builder, buffer, offsetVar);
+    }
+    // Returns the name of the map declared as tblName in the generated program.
+    virtual cstring mapName(cstring tblName) const { return tblName; }
     virtual void emitTableLookup(Util::SourceCodeBuilder* builder, cstring tblName,
                                  cstring key, cstring value) const = 0;
     virtual void emitTableUpdate(Util::SourceCodeBuilder* builder, cstring tblName,
@@ -73,6 +86,27 @@ class Target {
                 "emitTableDeclSpinlock is not supported on %1% target",
                 name);
     }
+    // Declares a program array holding the given programs at consecutive indices,
+    // used to chain programs with tail calls.
+    virtual void emitProgArrayDecl(Util::SourceCodeBuilder* builder, cstring tblName,
+                                   const std::vector<cstring>& programs) const {
+        (void) builder;
+        (void) tblName;
+        (void) programs;
+        ::error(ErrorType::ERR_UNSUPPORTED,
+                "emitProgArrayDecl is not supported on %1% target",
+                name);
+    }
+    // Declares a perf event array with an entry per CPU, used to send events with
+    // bpf_perf_event_output() to user space.
+    virtual void emitPerfEventArrayDecl(Util::SourceCodeBuilder* builder,
+                                        cstring tblName) const {
+        (void) builder;
+        (void) tblName;
+        ::error(ErrorType::ERR_UNSUPPORTED,
+                "emitPerfEventArrayDecl is not supported on %1% target",
+                name);
+    }
     // map-in-map requires declaration of both inner and outer map,
     // thus we define them together in a single method.
     virtual void emitMapInMapDecl(Util::SourceCodeBuilder* builder,
@@ -112,7 +146,7 @@ class Target {
     /// @param format Format string, interpreted by `printk`-like function. For more
     ///        information see documentation for `bpf_trace_printk`.
     /// @param argc Number of variadic arguments. Up to 3 arguments can be passed
-    ///        due to limitation of eBPF.
+    ///        due to limitation of eBPF (up to 4 when tracing into the ring buffer).
     /// @param ... Arguments to the format string, they must be C string and valid code in C.
     ///
     /// To print variable value: `emitTraceMessage(builder, "var=%u", 1, "var_name")`
@@ -150,16 +184,30 @@ class KernelSamplesTarget : public Target {
 
  protected:
     bool emitTraceMessages;
+    // Trace messages are written as binary records into the trace_ringbuf ring buffer
+    // instead of bpf_trace_printk(). Formats of trace points are indexed by their IDs.
+    bool traceToRingbuf;
+    mutable std::vector<std::pair<cstring, int>> traceFormats;
+    // Prepended to names of all maps, so that maps of several programs
+    // can be pinned in the same directory.
+    cstring mapPrefix;
 
  public:
-    explicit KernelSamplesTarget(bool emitTrace = false, cstring name = "Linux kernel")
-        : Target(name), innerMapIndex(0), emitTraceMessages(emitTrace) {}
+    static const int MaxTraceRecordArgs = 4;
+
+    explicit KernelSamplesTarget(bool emitTrace = false, cstring name = "Linux kernel",
+                                 bool traceToRingbuf = false, cstring mapPrefix = "")
+        : Target(name), innerMapIndex(0), emitTraceMessages(emitTrace),
+          traceToRingbuf(traceToRingbuf), mapPrefix(mapPrefix) {}
 
     void emitLicense(Util::SourceCodeBuilder* builder, cstring license) const override;
     void emitCodeSection(Util::SourceCodeBuilder* builder, cstring sectionName) const override;
     void emitIncludes(Util::SourceCodeBuilder* builder) const override;
     void emitResizeBuffer(Util::SourceCodeBuilder* builder, cstring buffer,
                           cstring offsetVar) const override;
+    void emitResizeBuffer(Util::SourceCodeBuilder* builder, cstring buffer,
+                          cstring offsetVar, cstring flags) const override;
+    cstring mapName(cstring tblName) const override { return mapPrefix + tblName; }
     void emitTableLookup(Util::SourceCodeBuilder* builder, cstring tblName,
                          cstring key, cstring value) const override;
     void emitTableUpdate(Util::SourceCodeBuilder* builder, cstring tblName,
@@ -172,6 +220,10 @@ class KernelSamplesTarget : public Target {
     void emitTableDeclSpinlock(Util::SourceCodeBuilder* builder,
                                cstring tblName, TableKind tableKind,
                                cstring keyType, cstring valueType, unsigned size) const override;
+    void emitProgArrayDecl(Util::SourceCodeBuilder* builder, cstring tblName,
+                           const std::vector<cstring>& programs) const override;
+    void emitPerfEventArrayDecl(Util::SourceCodeBuilder* builder,
+                                cstring tblName) const override;
     void emitMapInMapDecl(Util::SourceCodeBuilder* builder,
                           cstring innerName, TableKind innerTableKind,
                           cstring innerKeyType, cstring innerValueType, unsigned innerSize,
@@ -183,6 +235,9 @@ class KernelSamplesTarget : public Target {
     void emitPreamble(Util::SourceCodeBuilder* builder) const override;
     void emitTraceMessage(Util::SourceCodeBuilder* builder, const char* format,
                           int argc = 0, ...) const override;
+    /// Writes the format and the number of arguments of each trace point recorded into
+    /// the ring buffer, one per line ordered by IDs, for the trace decoder.
+    void emitTraceFormats(std::ostream& out) const;
     cstring dataOffset(cstring base) const override
     { return cstring("((void*)(long)")+ base + "->data)"; }
     cstring dataEnd(cstring base) const override
@@ -235,6 +290,8 @@ class TestTarget : public EBPF::KernelSamplesTarget {
     TestTarget() : KernelSamplesTarget(false, "Userspace Test") {}
 
     void emitResizeBuffer(Util::SourceCodeBuilder*, cstring, cstring) const override {};
+    void emitResizeBuffer(Util::SourceCodeBuilder*, cstring, cstring,
+                          cstring) const override {};
     void emitIncludes(Util::SourceCodeBuilder* builder) const override;
     void emitTableDecl(Util::SourceCodeBuilder* builder,
                        cstring tblName, TableKind tableKind,
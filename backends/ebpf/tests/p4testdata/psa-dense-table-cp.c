@@ -0,0 +1,84 @@
+/*
+Copyright 2022-present Orange
+Copyright 2022-present Open Networking Foundation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+ * Manages entries of tbl_fwd_proto of psa-dense-table.p4 with the library
+ * generated by --control-plane-lib.
+ * Usage: psa-dense-table-cp <pinned map> insert|delete
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <bpf/bpf.h>
+
+#include "psa-dense-table-cp.h"
+
+static int insert(int fd) {
+    u32 keys[2] = {17, 6};
+    struct ingress_tbl_fwd_proto_value values[2];
+    struct ingress_tbl_fwd_proto_value value;
+    __u32 count = 2;
+
+    ingress_tbl_fwd_proto_value_ingress_do_forward(&values[0], 6);
+    ingress_tbl_fwd_proto_value_ingress_do_drop(&values[1]);
+    if (ingress_tbl_fwd_proto_insert(fd, keys, values, &count) != 0 || count != 2) {
+        fprintf(stderr, "insert failed, %u entries inserted\n", count);
+        return 1;
+    }
+    if (ingress_tbl_fwd_proto_lookup(fd, &keys[0], &value) != 0 ||
+        memcmp(&value, &values[0], sizeof(value)) != 0) {
+        fprintf(stderr, "lookup of inserted entry failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int delete(int fd) {
+    u32 keys[2] = {17, 6};
+    struct ingress_tbl_fwd_proto_value value;
+    __u32 count = 2;
+
+    if (ingress_tbl_fwd_proto_delete(fd, keys, &count) != 0 || count != 2) {
+        fprintf(stderr, "delete failed, %u entries deleted\n", count);
+        return 1;
+    }
+    /* array elements are not removed, the library reports them as missing */
+    if (ingress_tbl_fwd_proto_lookup(fd, &keys[0], &value) != -ENOENT) {
+        fprintf(stderr, "deleted entry found\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <pinned map> insert|delete\n", argv[0]);
+        return 1;
+    }
+    int fd = bpf_obj_get(argv[1]);
+    if (fd < 0) {
+        fprintf(stderr, "can't open map %s\n", argv[1]);
+        return 1;
+    }
+    if (strcmp(argv[2], "insert") == 0)
+        return insert(fd);
+    if (strcmp(argv[2], "delete") == 0)
+        return delete(fd);
+    fprintf(stderr, "unknown command %s\n", argv[2]);
+    return 1;
+}
@@ -28,7 +28,9 @@ import os
 import logging
 import json
 import shlex
+import struct
 import subprocess
+import time
 import ptf
 import ptf.testutils as testutils
 
@@ -58,6 +60,7 @@ class P4EbpfTest(BaseTest):
     skip_reason = ''
     switch_ns = 'test'
     p4_file_path = ""
+    p4c_additional_args = ""
 
     def setUp(self):
         super(P4EbpfTest, self).setUp()
@@ -78,6 +81,8 @@ class P4EbpfTest(BaseTest):
         p4args = "--Wdisable=unused"
         if self.is_trace_logs_enabled():
             p4args += " --trace"
+        if self.p4c_additional_args:
+            p4args += " " + self.p4c_additional_args
 
         logger.info("P4ARGS=" + p4args)
         self.exec_cmd("make -f ../runtime/kernel.mk BPFOBJ={output} P4FILE={p4file} "
@@ -144,6 +149,39 @@ class P4EbpfTest(BaseTest):
         value = [format(int(v, 0), '02x') for v in json.loads(stdout)['value']]
         return ' '.join(value)
 
+    def read_percpu_counters(self, name, key):
+        """Returns u64 counters of a per-CPU map entry summed over all CPUs."""
+        cmd = "bpftool -j map lookup pinned {}/{} key {}".format(PIPELINE_MAPS_MOUNT_PATH, name, key)
+        _, stdout, _ = self.exec_ns_cmd(cmd, "Failed to read map {}".format(name))
+        counters = None
+        for cpu_value in json.loads(stdout)['values']:
+            value = bytes(int(v, 0) for v in cpu_value['value'])
+            words = struct.unpack("<{}Q".format(len(value) // 8), value)
+            counters = list(words) if counters is None else [a + b for a, b in zip(counters, words)]
+        return counters
+
+    def read_perf_events(self, name, action):
+        """Returns data of events written to a perf event array while action() is called."""
+        cmd = "nsenter --net=/var/run/netns/{} timeout 2 bpftool -j map event_pipe " \
+              "pinned {}/{}".format(self.switch_ns, PIPELINE_MAPS_MOUNT_PATH, name)
+        reader = subprocess.Popen(shlex.split(cmd), stdout=subprocess.PIPE)
+        time.sleep(0.5)  # let bpftool open the perf buffers
+        action()
+        stdout, _ = reader.communicate()
+        events = []
+        decoder = json.JSONDecoder()
+        output = stdout.decode("utf-8").strip()
+        while output:
+            event, end = decoder.raw_decode(output)
+            events.append(bytes(int(v, 0) for v in event["data"]))
+            output = output[end:].strip()
+        return events
+
+    def update_map(self, name, key, value):
+        cmd = "bpftool map update pinned {}/{} key {} value {}".format(PIPELINE_MAPS_MOUNT_PATH, name,
+                                                                     key, value)
+        self.exec_ns_cmd(cmd, "Failed to update map {}".format(name))
+
     def verify_map_entry(self, name, key, expected_value, mask=None):
         value = self.read_map(name, key)
 
@@ -19,7 +19,7 @@ from common import *
 import copy
 
 from scapy.fields import ShortField, IntField
-from scapy.layers.l2 import Ether
+from scapy.layers.l2 import Ether, GRE
 from scapy.layers.inet import IP, UDP
 from scapy.packet import Packet, bind_layers, split_layers
 from ptf.packet import MPLS
@@ -56,6 +56,14 @@ class PSAResubmitTest(P4EbpfTest):
         testutils.verify_packet(self, pkt, PORT1)
 
 
+class PSAResubmitSplitPipelineTest(PSAResubmitTest):
+    """
+    Test resubmission of a pipeline split into programs chained by tail calls.
+    """
+
+    p4c_additional_args = "--max-prog-insns 1"
+
+
 class SimpleTunnelingPSATest(P4EbpfTest):
 
     p4_file_path = "p4testdata/psa-tunneling.p4"
@@ -73,6 +81,55 @@ class SimpleTunnelingPSATest(P4EbpfTest):
         testutils.verify_packet(self, pkt, PORT1)
 
 
+class SimpleTunnelingSplitPipelinePSATest(SimpleTunnelingPSATest):
+    """
+    Test a pipeline split into programs chained by tail calls,
+    the parser state and local variables are passed between programs.
+    """
+
+    p4c_additional_args = "--max-prog-insns 1"
+
+
+class GreTunnelingPSATest(P4EbpfTest):
+    """
+    Test GRE encapsulation, the buffer is resized with BPF_F_ADJ_ROOM_ENCAP_* flags.
+    """
+
+    p4_file_path = "p4testdata/psa-gre-tunneling.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet(ip_dst="192.168.1.1")
+
+        exp_pkt = Ether(dst=pkt[Ether].dst, src=pkt[Ether].src) / \
+                  IP(src="10.0.0.1", dst="10.0.0.2", id=0, ttl=64, proto=47, chksum=0) / \
+                  GRE(proto=0x0800) / pkt[IP]
+
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, exp_pkt, PORT1)
+
+
+class GreNestedTunnelingPSATest(P4EbpfTest):
+    """
+    Test GRE encapsulation of a packet already encapsulated by the ingress pipeline.
+    The kernel refuses BPF_F_ADJ_ROOM_ENCAP_* flags for it with -EALREADY,
+    so the egress deparser resizes the buffer again without them.
+    """
+
+    p4_file_path = "p4testdata/psa-gre-nested-tunneling.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet(ip_dst="192.168.1.1")
+
+        exp_pkt = Ether(dst=pkt[Ether].dst, src=pkt[Ether].src) / \
+                  IP(src="10.0.1.1", dst="10.0.1.2", id=0, ttl=64, proto=47, chksum=0) / \
+                  GRE(proto=0x0800) / \
+                  IP(src="10.0.0.1", dst="10.0.0.2", id=0, ttl=64, proto=47, chksum=0) / \
+                  GRE(proto=0x0800) / pkt[IP]
+
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, exp_pkt, PORT1)
+
+
 class PSACloneI2E(P4EbpfTest):
 
     p4_file_path = "p4testdata/clone-i2e.p4"
@@ -192,6 +249,23 @@ class MulticastPSATest(P4EbpfTest):
         super(MulticastPSATest, self).tearDown()
 
 
+class TrafficManagerStatsPSATest(MulticastPSATest):
+    """
+    Multicast group 5 does not exist, group 8 replicates the packet to 2 ports.
+    """
+
+    p4c_additional_args = "--emit-stats"
+
+    def runTest(self):
+        super(TrafficManagerStatsPSATest, self).runTest()
+
+        def tm_counter(code):
+            return self.read_percpu_counters(name="tm_stats", key="{} 0 0 0".format(code))[0]
+
+        # NORMAL_MULTICAST, REPLICATIONS, CLONES, CLONE_FAILURES, MISSING_SESSIONS
+        self.assertEqual([tm_counter(code) for code in [2, 7, 8, 9, 10]], [2, 1, 2, 0, 1])
+
+
 class SimpleLpmP4PSATest(P4EbpfTest):
 
     p4_file_path = "p4testdata/psa-lpm.p4"
@@ -230,6 +304,368 @@ class SimpleLpmP4TwoKeysPSATest(P4EbpfTest):
         testutils.verify_packet(self, pkt, PORT1)
 
 
+class DenseTablePSATest(P4EbpfTest):
+    """
+    Exact table with an 8-bit key and size 256 is an array map indexed by the key.
+    """
+    p4_file_path = "p4testdata/psa-dense-table.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_udp_packet(ip_src='1.1.1.1', ip_dst='10.10.11.11')
+        # array elements without valid flag do not match, default action drops packet
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+        # key: protocol 17 (UDP); value: action do_forward, port 6 (PORT2 in ptf), valid
+        self.update_map(name="ingress_tbl_fwd_proto", key="17 0 0 0",
+                        value="1 0 0 0 6 0 0 0 1 0 0 0")
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        # entry deleted by clearing valid flag
+        self.update_map(name="ingress_tbl_fwd_proto", key="17 0 0 0",
+                        value="1 0 0 0 6 0 0 0 0 0 0 0")
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+
+class DenseTableConstEntriesPSATest(P4EbpfTest):
+    """
+    Const entries of a dense table are written by the map initializer at indexes
+    given by the key, protocol 17 (UDP) is forwarded to port 6, 6 (TCP) to port 5.
+    """
+    p4_file_path = "p4testdata/psa-dense-table-const-entries.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_udp_packet(ip_src='1.1.1.1', ip_dst='10.10.11.11')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        pkt = testutils.simple_tcp_packet(ip_src='1.1.1.1', ip_dst='10.10.11.11')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+
+        # key: protocol 17; value: action do_forward, port 6, valid
+        self.assertEqual(self.read_map(name="ingress_tbl_fwd_proto", key="17 0 0 0"),
+                         "01 00 00 00 06 00 00 00 01 00 00 00")
+
+        # protocol 1 (ICMP) is dropped by its entry
+        pkt = testutils.simple_icmp_packet(ip_src='1.1.1.1', ip_dst='10.10.11.11')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+
+class ControlPlaneLibPSATest(P4EbpfTest):
+    """
+    The library generated with --control-plane-lib is compiled, linked with libbpf
+    and used to insert and delete entries of a dense table.
+    """
+    p4_file_path = "p4testdata/psa-dense-table.p4"
+    p4c_additional_args = "--control-plane-lib ptf_out/psa-dense-table-cp.c"
+
+    def setUp(self):
+        super(ControlPlaneLibPSATest, self).setUp()
+        self.exec_cmd("cc -Wall -I../runtime -I../runtime/contrib/libbpf/include/uapi -Iptf_out "
+                      "-o ptf_out/psa-dense-table-cp p4testdata/psa-dense-table-cp.c "
+                      "ptf_out/psa-dense-table-cp.c -lbpf",
+                      "Control-plane library compilation error")
+
+    def runTest(self):
+        tbl = "{}/ingress_tbl_fwd_proto".format(PIPELINE_MAPS_MOUNT_PATH)
+        pkt = testutils.simple_udp_packet(ip_src='1.1.1.1', ip_dst='10.10.11.11')
+        # protocol 17 (UDP): do_forward to port 6 (PORT2 in ptf), protocol 6: do_drop
+        self.exec_ns_cmd("ptf_out/psa-dense-table-cp {} insert".format(tbl),
+                         "Insert with control-plane library failed")
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        # lookup of a deleted entry returns -ENOENT
+        self.exec_ns_cmd("ptf_out/psa-dense-table-cp {} delete".format(tbl),
+                         "Delete with control-plane library failed")
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+
+class TableSubprogramPSATest(P4EbpfTest):
+    """
+    Tables applied twice or with big actions are generated as BPF subprograms.
+    """
+    p4_file_path = "p4testdata/psa-table-subprogram.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet(ip_src='1.2.3.4', ip_dst='10.10.11.11', ip_id=1)
+        # tbl_rewrite miss, tbl_fwd default action forwards to port 5 (PORT1 in ptf)
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+
+        # tbl_fwd applied from the other branch
+        self.table_add(table="ingress_tbl_fwd", keys=[4], action=1, data=[6])
+        pkt[Ether].type = 0x86dd
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        pkt = testutils.simple_ip_packet(ip_src='1.2.3.4', ip_dst='10.10.11.11', ip_id=1)
+        self.table_add(table="ingress_tbl_rewrite", keys=["1.2.3.4", "10.10.11.11"], action=1,
+                       data=[0x11, 0x22, 32, 4,
+                             "5.6.7.8", "10.0.0.1", 5])
+        testutils.send_packet(self, PORT0, pkt)
+        exp_pkt = testutils.simple_ip_packet(eth_src='00:00:00:00:00:11', eth_dst='00:00:00:00:00:22',
+                                             ip_src='5.6.7.8', ip_dst='10.0.0.1', ip_ttl=31,
+                                             ip_tos=4, ip_id=2)
+        exp_pkt[IP].chksum = 0
+        testutils.verify_packet(self, exp_pkt, PORT1)
+
+
+class TableSubprogramTailCallPSATest(TableSubprogramPSATest):
+    """
+    Tables are generated inline if recirculation uses tail calls,
+    BPF-to-BPF calls cannot be mixed with tail calls.
+    """
+
+    p4c_additional_args = "--recirculate-tail-call"
+
+
+class FlowCachePSATest(P4EbpfTest):
+    """
+    Decisions of the ingress pipeline are cached until the epoch is incremented.
+    """
+    p4_file_path = "p4testdata/psa-lpm.p4"
+    p4c_additional_args = "--flow-cache 1024"
+
+    def runTest(self):
+        self.table_add(table="ingress_tbl_fwd_lpm", keys=["10.10.0.0/16"], action=1, data=[6])
+        pkt = testutils.simple_ip_packet(ip_src='1.1.1.1', ip_dst='10.10.11.11')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        # the cached decision is used until the control plane increments the epoch
+        self.table_update(table="ingress_tbl_fwd_lpm", keys=["10.10.0.0/16"], action=1, data=[5])
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        self.update_map(name="ingress_flow_cache_epoch", key="0 0 0 0", value="1 0 0 0")
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+
+        # other flows do not match any entry and are dropped
+        pkt = testutils.simple_ip_packet(ip_src='1.1.1.1', ip_dst='192.168.2.1')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+
+class FlowCachePartialWritePSATest(P4EbpfTest):
+    """
+    Fields written only by some actions are a part of the key of the flow cache,
+    packets of other entries keep their own values.
+    """
+    p4_file_path = "p4testdata/psa-flow-cache-partial-write.p4"
+    p4c_additional_args = "--flow-cache 1024"
+
+    def runTest(self):
+        # do_forward(5), does not write srcAddr
+        self.table_add(table="ingress_tbl_fwd", keys=["10.10.11.11"], action=1, data=[5])
+        for eth_src in ['00:00:00:00:00:01', '00:00:00:00:00:02', '00:00:00:00:00:01']:
+            pkt = testutils.simple_ip_packet(eth_src=eth_src, ip_dst='10.10.11.11')
+            testutils.send_packet(self, PORT0, pkt)
+            testutils.verify_packet(self, pkt, PORT1)
+
+        # do_forward_set_src(5, 00:00:00:00:00:aa)
+        self.table_add(table="ingress_tbl_fwd", keys=["10.10.22.22"], action=2,
+                       data=[5, 0xaa])
+        for eth_src in ['00:00:00:00:00:01', '00:00:00:00:00:02']:
+            pkt = testutils.simple_ip_packet(eth_src=eth_src, ip_dst='10.10.22.22')
+            testutils.send_packet(self, PORT0, pkt)
+            pkt[Ether].src = '00:00:00:00:00:aa'
+            testutils.verify_packet(self, pkt, PORT1)
+
+
+class TableStatsPSATest(P4EbpfTest):
+    """
+    Hits, misses, default actions and executed actions are counted per table, drops per reason.
+    """
+    p4_file_path = "p4testdata/psa-lpm.p4"
+    p4c_additional_args = "--emit-stats"
+
+    def runTest(self):
+        self.table_add(table="ingress_tbl_fwd_lpm", keys=["10.10.0.0/16"], action=1, data=[6])
+        pkt = testutils.simple_ip_packet(ip_src='1.1.1.1', ip_dst='10.10.11.11')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        # default action NoAction, the packet is dropped
+        pkt = testutils.simple_ip_packet(ip_src='1.1.1.1', ip_dst='192.168.2.1')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+        # ingress_tbl_fwd_lpm has ID 0: hits, misses, default actions, NoAction, do_forward, do_drop
+        counters = self.read_percpu_counters(name="table_stats", key="0 0 0 0")
+        self.assertEqual(counters[:6], [1, 1, 1, 1, 1, 0])
+
+        # the second packet is dropped by the ingress pipeline, DROP_REASON_INGRESS_DROP is 5
+        drops = self.read_percpu_counters(name="drop_stats", key="5 0 0 0")
+        self.assertEqual(drops, [1])
+
+
+class LatencyHistogramsPSATest(P4EbpfTest):
+    """
+    Each block of both pipelines records the latency of every packet in its histogram.
+    """
+    p4_file_path = "p4testdata/simple-fwd.p4"
+    p4c_additional_args = "--latency-histograms 1"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet()
+        for _ in range(3):
+            testutils.send_packet(self, PORT0, pkt)
+            testutils.verify_packet(self, pkt, PORT1)
+
+        # stages 0-7: ingress and egress parser, control, deparser and Traffic Manager
+        for stage in range(8):
+            buckets = self.read_percpu_counters(name="latency_hist", key="{} 0 0 0".format(stage))
+            self.assertEqual(sum(buckets), 3)
+
+
+class TraceRingbufPSATest(P4EbpfTest):
+    """
+    Programs tracing into the ring buffer are accepted by the verifier and forward packets.
+    """
+    p4_file_path = "p4testdata/simple-fwd.p4"
+    p4c_additional_args = "--trace-ringbuf ptf_out/simple-fwd-trace.txt"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet()
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+
+        with open("ptf_out/simple-fwd-trace.txt") as formats:
+            self.assertTrue(formats.readline().startswith("0 "))
+
+
+class PacketSamplerPSATest(P4EbpfTest):
+    """
+    PacketSampler extern: packets are written to the perf event array only when
+    the sampling rate is set, with their metadata and up to 64 first bytes.
+    """
+    p4_file_path = "p4testdata/psa-packet-sampler.p4"
+
+    def read_samples(self, pkts):
+        def send():
+            for pkt in pkts:
+                testutils.send_packet(self, PORT0, pkt)
+                testutils.verify_packet(self, pkt, PORT1)
+        return self.read_perf_events("ingress_sampler_samples", send)
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet(pktlen=100)
+        # sampling is disabled by default
+        self.assertEqual(self.read_samples([pkt]), [])
+
+        self.update_map("ingress_sampler_rate", "0 0 0 0", "1 0 0 0")
+        samples = self.read_samples([pkt, pkt])
+        self.assertEqual(len(samples), 2)
+        for sample in samples:
+            _, egress_port, packet_path, rate, length, captured = struct.unpack("<6I", sample[:24])
+            self.assertEqual(egress_port, 5)
+            self.assertEqual(packet_path, 0)  # NORMAL
+            self.assertEqual(rate, 1)
+            self.assertEqual(length, 100)
+            self.assertEqual(captured, 64)
+            self.assertEqual(sample[24:24 + captured], bytes(pkt)[:64])
+
+
+class CPUPortPerfBufferPSATest(P4EbpfTest):
+    """
+    Packets sent to PSA_PORT_CPU are written to the cpu_port_packets perf event array
+    instead of the CPU interface, other packets are forwarded.
+    """
+    p4_file_path = "p4testdata/psa-cpu-port.p4"
+    p4c_additional_args = "--cpu-port-perf-buffer --emit-stats"
+
+    def runTest(self):
+        arp = testutils.simple_arp_packet()
+        pkt = testutils.simple_ip_packet()
+
+        def send():
+            testutils.send_packet(self, PORT0, arp)
+            testutils.verify_no_other_packets(self)
+            testutils.send_packet(self, PORT0, pkt)
+            testutils.verify_packet(self, pkt, PORT1)
+
+        events = self.read_perf_events("cpu_port_packets", send)
+        self.assertEqual(len(events), 1)
+        _, length = struct.unpack("<2I", events[0][:8])
+        self.assertEqual(length, len(arp))
+        self.assertEqual(events[0][8:8 + length], bytes(arp))
+        # TM_STATS_CPU_PORT
+        self.assertEqual(self.read_percpu_counters(name="tm_stats", key="11 0 0 0"), [1])
+
+
+class RecirculateTailCallPSATest(P4EbpfTest):
+    """
+    Packets sent to PSA_PORT_RECIRCULATE are recirculated by tail calls between the pipelines,
+    without the recirculation interface. Packets recirculated too many times are dropped.
+    """
+    p4_file_path = "p4testdata/psa-recirculate-tail-call.p4"
+    p4c_additional_args = "--recirculate-tail-call --emit-stats"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet(eth_dst='00:11:22:33:FE:F1', eth_src='55:44:33:22:11:00')
+        testutils.send_packet(self, PORT0, pkt)
+        pkt[Ether].dst = '00:00:00:00:00:00'
+        pkt[Ether].src = '00:44:33:22:11:00'
+        testutils.verify_packet(self, pkt, PORT1)
+
+        pkt = testutils.simple_ip_packet(eth_dst='00:11:22:33:FE:F0')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+        # DROP_REASON_RECIRCULATE_LIMIT
+        self.assertEqual(self.read_percpu_counters(name="drop_stats", key="12 0 0 0"), [1])
+        # TM_STATS_RECIRCULATE, once for the first packet and 4 times for the second one
+        self.assertEqual(self.read_percpu_counters(name="tm_stats", key="6 0 0 0"), [5])
+
+
+class RecirculateTailCallSplitPipelinePSATest(P4EbpfTest):
+    """
+    Both pipelines are split into 5 programs, so the tail calls of 2 recirculations fill
+    the kernel limit of 33 tail calls. Packets recirculated more times are counted as
+    RECIRCULATE_LIMIT instead of failing a tail call.
+    """
+    p4_file_path = "p4testdata/psa-recirculate-tail-call-split.p4"
+    p4c_additional_args = "--recirculate-tail-call --max-prog-insns 1 --emit-stats " \
+                          "--Wwarn=unsupported"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet(eth_dst='00:11:22:33:FE:F1', eth_src='55:44:33:22:11:00')
+        testutils.send_packet(self, PORT0, pkt)
+        pkt[Ether].dst = '00:00:00:00:00:00'
+        pkt[Ether].src = '00:44:33:22:11:00'
+        testutils.verify_packet(self, pkt, PORT1)
+
+        pkt = testutils.simple_ip_packet(eth_dst='00:11:22:33:FE:F0')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+        # DROP_REASON_RECIRCULATE_LIMIT and DROP_REASON_INTERNAL_ERROR
+        self.assertEqual(self.read_percpu_counters(name="drop_stats", key="12 0 0 0"), [1])
+        self.assertEqual(self.read_percpu_counters(name="drop_stats", key="10 0 0 0"), [0])
+        # TM_STATS_RECIRCULATE, once for the first packet and 2 times for the second one
+        self.assertEqual(self.read_percpu_counters(name="tm_stats", key="6 0 0 0"), [3])
+
+
+class MapPrefixPSATest(P4EbpfTest):
+    """
+    Maps are declared with the names given by --map-prefix.
+    """
+    p4_file_path = "p4testdata/action-const-default.p4"
+    p4c_additional_args = "--map-prefix p1_ --emit-stats"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet()
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+        # TM_STATS_NORMAL_UNICAST
+        self.assertEqual(self.read_percpu_counters(name="p1_tm_stats", key="1 0 0 0"), [1])
+
+
 class ConstDefaultActionPSATest(P4EbpfTest):
 
     p4_file_path = "p4testdata/action-const-default.p4"
@@ -273,6 +709,129 @@ class ConstEntryAndActionPSATest(P4EbpfTest):
         testutils.verify_packet(self, pkt, PORT0)
 
 
+class ConstEntryMapPSATest(P4EbpfTest):
+    """
+    Tables with more const entries than are compiled into the program are stored in maps.
+    """
+    p4_file_path = "p4testdata/psa-map-init-manifest.p4"
+
+    def runTest(self):
+        # tbl_exact: UDP, 10.10.11.11 and identification 0x1234-0x1244, port 6 (PORT2 in ptf)
+        pkt = testutils.simple_udp_packet(ip_dst='10.10.11.11', ip_id=0x1244)
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT2)
+
+        # tbl_lpm: UDP and 10.1.0.0/24-10.1.16.0/24, port 5 (PORT1 in ptf)
+        pkt = testutils.simple_udp_packet(ip_dst='10.1.16.200')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+
+        # default action drops packet
+        pkt = testutils.simple_udp_packet(ip_dst='10.1.17.1')
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+
+class MapInitManifestPSATest(ConstEntryMapPSATest):
+    """
+    Initial entries are written to the manifest instead of the map initializer program,
+    as images of C structures of keys and values.
+    """
+    p4c_additional_args = "--map-init-manifest ptf_out/psa-map-init-manifest.json"
+
+    @staticmethod
+    def hex_bytes(image):
+        return " ".join(["hex"] + [image[i:i + 2] for i in range(0, len(image), 2)])
+
+    def runTest(self):
+        with open("ptf_out/psa-map-init-manifest.json") as manifest:
+            maps = {m["name"]: m for m in json.load(manifest)["maps"]}
+        self.assertEqual(sorted(maps), ["ingress_tbl_exact", "ingress_tbl_exact_defaultAction",
+                                        "ingress_tbl_lpm", "ingress_tbl_lpm_defaultAction"])
+
+        # protocol (u8), 3 bytes of padding, dstAddr (u32) and identification (u16)
+        # in the host byte order, 2 bytes of padding; value: action do_forward, port 6
+        tbl = maps["ingress_tbl_exact"]
+        self.assertEqual((tbl["key_size"], tbl["value_size"], len(tbl["entries"])), (12, 8, 17))
+        self.assertEqual(tbl["entries"][0], {"key": "11000000" "0b0b0a0a" "3412" "0000",
+                                             "value": "01000000" "06000000"})
+
+        # prefixlen 56 covers protocol with its padding (32 bits) and /24 of dstAddr,
+        # which is in the network byte order
+        tbl = maps["ingress_tbl_lpm"]
+        self.assertEqual((tbl["key_size"], tbl["value_size"], len(tbl["entries"])), (12, 8, 17))
+        self.assertEqual(tbl["entries"][16], {"key": "38000000" "11000000" "0a011000",
+                                              "value": "01000000" "05000000"})
+
+        # default action do_drop
+        tbl = maps["ingress_tbl_lpm_defaultAction"]
+        self.assertEqual(tbl["entries"], [{"key": "00000000", "value": "02000000" "00000000"}])
+
+        for name, tbl in maps.items():
+            for entry in tbl["entries"]:
+                self.update_map(name=name, key=self.hex_bytes(entry["key"]),
+                                value=self.hex_bytes(entry["value"]))
+        super(MapInitManifestPSATest, self).runTest()
+
+
+class MapLayoutManifestPSATest(P4EbpfTest):
+    """
+    Layouts in the manifest do not depend on names of fields and on the map prefix,
+    adding an action changes the value layout but not layouts of the other actions.
+    """
+    p4_file_path = "p4testdata/psa-map-init-manifest.p4"
+    p4c_additional_args = "--emit-stats --map-layout-manifest ptf_out/psa-map-layout.json"
+
+    @staticmethod
+    def load_manifest(path):
+        with open(path) as manifest:
+            return {m["name"]: m for m in json.load(manifest)["maps"]}
+
+    def compile_variant(self, name, replacements, args=""):
+        with open(self.p4_file_path) as p4file:
+            source = p4file.read()
+        for old, new in replacements:
+            source = source.replace(old, new)
+        with open("ptf_out/{}.p4".format(name), "w") as p4file:
+            p4file.write(source)
+        self.exec_cmd("p4c-ebpf --Werror --arch psa --target kernel -Ip4testdata {args} "
+                      "--emit-stats --map-layout-manifest ptf_out/{name}.json "
+                      "-o ptf_out/{name}.c ptf_out/{name}.p4".format(name=name, args=args),
+                      "Compilation of {} failed".format(name))
+        return self.load_manifest("ptf_out/{}.json".format(name))
+
+    def runTest(self):
+        maps = self.load_manifest("ptf_out/psa-map-layout.json")
+        self.assertEqual(sorted(maps), ["drop_stats", "ingress_tbl_exact",
+                                        "ingress_tbl_exact_defaultAction", "ingress_tbl_lpm",
+                                        "ingress_tbl_lpm_defaultAction", "table_stats",
+                                        "tm_stats"])
+        self.assertEqual(maps["table_stats"]["indexes"], ["ingress_tbl_exact", "ingress_tbl_lpm"])
+
+        # an action with a field added, its maps have the same key but a bigger value
+        added = self.compile_variant("psa-map-layout-action-added", [
+            ("actions = { do_forward; do_drop; }",
+             "actions = { do_forward; do_drop; do_mark; }"),
+            ("    action do_drop() {",
+             "    action do_mark(bit<48> mark) {\n"
+             "        hdr.ethernet.srcAddr = mark;\n"
+             "    }\n\n"
+             "    action do_drop() {")])
+        for name in ["ingress_tbl_exact", "ingress_tbl_lpm"]:
+            self.assertEqual(added[name]["key_layout"], maps[name]["key_layout"])
+            self.assertNotEqual(added[name]["value_layout"], maps[name]["value_layout"])
+            self.assertEqual(added[name]["actions"][:2], maps[name]["actions"])
+        self.assertEqual(added["drop_stats"], maps["drop_stats"])
+
+        # renamed action parameter and another map prefix, only names of maps differ
+        renamed = self.compile_variant("psa-map-layout-renamed", [("egress_port", "port")],
+                                       "--map-prefix v2_")
+        self.assertEqual(sorted(renamed), ["v2_" + name for name in sorted(maps)])
+        for name, layout in maps.items():
+            layout["name"] = "v2_" + name
+            self.assertEqual(renamed["v2_" + name], layout)
+
+
 class BridgedMetadataPSATest(P4EbpfTest):
 
     p4_file_path = "p4testdata/bridged-metadata.p4"
@@ -288,6 +847,123 @@ class BridgedMetadataPSATest(P4EbpfTest):
         testutils.verify_no_other_packets(self)
 
 
+class BridgedNormalMetadataPSATest(P4EbpfTest):
+    """
+    Test if normal_meta is carried from the ingress deparser to the egress parser.
+    The egress pipeline writes the bridged EtherType to the source MAC address.
+    """
+
+    p4_file_path = "p4testdata/psa-bridged-normal-meta.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet()
+        exp_pkt = pkt.copy()
+        exp_pkt[Ether].src = "00:00:00:00:08:00"
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet_any_port(self, exp_pkt, ALL_PORTS)
+
+        pkt[Ether].dst = 'FF:FF:FF:FF:FF:FF'
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+
+class BridgedNormalMetadataInPacketPSATest(P4EbpfTest):
+    """
+    Test normal_meta larger than the spare space of skb->cb. It is prepended to the packet
+    by the ingress deparser and stripped by the egress pipeline, which parses the headers
+    after it and writes the bridged source MAC address and EtherType to the Ethernet header.
+    """
+
+    p4_file_path = "p4testdata/psa-bridged-normal-meta-in-packet.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_ip_packet(eth_src="00:11:22:33:44:55")
+        exp_pkt = pkt.copy()
+        exp_pkt[Ether].dst = "00:11:22:33:44:55"
+        exp_pkt[Ether].src = "00:00:00:00:08:00"
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, exp_pkt, PORT1)
+
+        # the packet is as long as received, only the Ethernet header differs
+        pkt = testutils.simple_tcp_packet(eth_src="00:11:22:33:44:55", pktlen=200)
+        exp_pkt = pkt.copy()
+        exp_pkt[Ether].dst = "00:11:22:33:44:55"
+        exp_pkt[Ether].src = "00:00:00:00:08:00"
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, exp_pkt, PORT1)
+
+        pkt[Ether].dst = 'FF:FF:FF:FF:FF:FF'
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_no_other_packets(self)
+
+
+class DeparserUnmodifiedHeaderPSATest(P4EbpfTest):
+    """
+    Test if a modified IPv4 header is written correctly after an unmodified Ethernet header,
+    which the ingress deparser leaves in place.
+    """
+
+    p4_file_path = "p4testdata/psa-deparser-unmodified-header.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_udp_packet(eth_dst="00:11:22:33:44:55", eth_src="00:aa:bb:cc:dd:ee",
+                                          ip_ttl=64)
+        raw = bytes(pkt)
+        # only the TTL is decremented, the checksum is not updated
+        exp_pkt = Ether(raw[:22] + bytes([63]) + raw[23:])
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, exp_pkt, PORT1)
+
+        # no IPv4 header, the packet is not modified
+        pkt = testutils.simple_arp_packet()
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+
+
+class EgressDeferredFieldsPSATest(P4EbpfTest):
+    """
+    Test if headers whose fields are not loaded by the egress parser are written correctly
+    when the egress pipeline inserts a shim header after the IPv4 header.
+    """
+
+    p4_file_path = "p4testdata/psa-egress-deferred-fields.p4"
+
+    def runTest(self):
+        pkt = testutils.simple_udp_packet()
+        raw = bytes(pkt)
+        exp_pkt = Ether(raw[:34] + b"\x00\x2a\x00\x00" + raw[34:])
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet_any_port(self, exp_pkt, ALL_PORTS)
+
+        # no shim header, the packet is not resized
+        pkt = testutils.simple_arp_packet()
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet_any_port(self, pkt, ALL_PORTS)
+
+
+class EgressPassThroughPSATest(P4EbpfTest):
+    """
+    Test if the pass-through tc-egress program generated for an empty Egress pipeline
+    is attached to the output port and sends packets unchanged.
+    """
+
+    p4_file_path = "p4testdata/psa-egress-pass-through.p4"
+
+    def runTest(self):
+        # the program neither parses nor deparses packets
+        with open(os.path.splitext(self.test_prog_image)[0] + ".c") as f:
+            egress_prog = f.read().split('SEC("classifier/tc-egress")')[1]
+        self.assertNotIn("hdr_md_cpumap", egress_prog)
+        _, stdout, _ = self.exec_ns_cmd("tc filter show dev {} egress".format(self.interfaces[PORT1]),
+                                        "Failed to show tc filters")
+        self.assertIn("tc_egress_func", stdout.decode("utf-8"))
+
+        pkt = testutils.simple_udp_packet()
+        testutils.send_packet(self, PORT0, pkt)
+        testutils.verify_packet(self, pkt, PORT1)
+        testutils.verify_no_other_packets(self)
+
+
 class QoSPSATest(P4EbpfTest):
 
     p4_file_path = "p4testdata/cos-psa.p4"